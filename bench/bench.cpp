@@ -0,0 +1,891 @@
+#include "benchmark.h"
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "sphere.h"
+#include "quad.h"
+#include "mesh.h"
+#include "perlin.h"
+#include "texture.h"
+#include "pdf.h"
+#include "bvh.h"
+#include "kdtree.h"
+#include "grid.h"
+#include "scene.h"
+#include "raytracer.h"
+#include "float_image.h"
+#include "denoise.h"
+#include "film.h"
+#include "image_io.h"
+#include "texture_registry.h"
+#include "baked_texture.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifndef TINYRT_SOURCE_DIR
+#define TINYRT_SOURCE_DIR ".."
+#endif
+
+struct BenchConfig {
+    std::string source_dir = TINYRT_SOURCE_DIR;
+    unsigned int seed = 1;
+    int threads = 1;
+    int scene_spp = 4;
+    int scene_width = 200;
+};
+
+static BenchConfig config;
+
+// inputs are regenerated from the same seed for every benchmark so runs are comparable
+static const int input_count = 1024;   // power of two
+
+static std::vector<Ray> make_rays() {
+    seed_random(config.seed);
+    std::vector<Ray> rays;
+    for (int i = 0; i < input_count; ++i) {
+        Point3f origin = 5.f * random_unit_vector();
+        Point3f target = random_vector(-1.5f, 1.5f);
+        rays.push_back(Ray(origin, target - origin, random_float()));
+    }
+    return rays;
+}
+
+static std::vector<Point3f> make_points(float min, float max) {
+    seed_random(config.seed);
+    std::vector<Point3f> points;
+    for (int i = 0; i < input_count; ++i)
+        points.push_back(random_vector(min, max));
+    return points;
+}
+
+static void hit_benchmark(BenchState& state, const Hittable& object) {
+    auto rays = make_rays();
+    HitRecord rec;
+    int i = 0;
+    while (state.keep_running()) {
+        bool hit = object.hit(rays[i++ & (input_count - 1)], Interval(0.001f, INFINITY), rec);
+        do_not_optimize(hit);
+    }
+}
+
+static void BM_aabb_hit(BenchState& state) {
+    aabb box(Point3f(-1.f, -1.f, -1.f), Point3f(1.f, 1.f, 1.f));
+    auto rays = make_rays();
+    int i = 0;
+    while (state.keep_running()) {
+        bool hit = box.hit(rays[i++ & (input_count - 1)], Interval(0.001f, INFINITY));
+        do_not_optimize(hit);
+    }
+}
+BENCHMARK(BM_aabb_hit);
+
+static void BM_sphere_hit(BenchState& state) {
+    Sphere sphere(Point3f(0.f, 0.f, 0.f), 1.f, nullptr);
+    hit_benchmark(state, sphere);
+}
+BENCHMARK(BM_sphere_hit);
+
+static void BM_moving_sphere_hit(BenchState& state) {
+    Sphere sphere(Point3f(0.f, 0.f, 0.f), Point3f(0.5f, 0.f, 0.f), 1.f, nullptr);
+    hit_benchmark(state, sphere);
+}
+BENCHMARK(BM_moving_sphere_hit);
+
+static void BM_quad_hit(BenchState& state) {
+    Quad quad(Point3f(-1.f, -1.f, 0.f), Vec3f(2.f, 0.f, 0.f), Vec3f(0.f, 2.f, 0.f), nullptr);
+    hit_benchmark(state, quad);
+}
+BENCHMARK(BM_quad_hit);
+
+static void BM_mesh_hit(BenchState& state) {
+    Mesh mesh(Point3f(-1.f, -1.f, 0.f), Vec3f(2.f, 0.f, 0.f), Vec3f(0.f, 2.f, 0.f), nullptr);
+    hit_benchmark(state, mesh);
+}
+BENCHMARK(BM_mesh_hit);
+
+static void BM_box_hit(BenchState& state) {
+    Box box(Point3f(-1.f, -1.f, -1.f), Point3f(1.f, 1.f, 1.f), nullptr);
+    hit_benchmark(state, box);
+}
+BENCHMARK(BM_box_hit);
+
+static void BM_perlin_noise(BenchState& state) {
+    seed_random(config.seed);
+    Perlin perlin;
+    auto points = make_points(0.f, 10.f);
+    int i = 0;
+    while (state.keep_running()) {
+        float n = perlin.noise(points[i++ & (input_count - 1)]);
+        do_not_optimize(n);
+    }
+}
+BENCHMARK(BM_perlin_noise);
+
+static void BM_perlin_turb(BenchState& state) {
+    seed_random(config.seed);
+    Perlin perlin;
+    auto points = make_points(0.f, 10.f);
+    int i = 0;
+    while (state.keep_running()) {
+        float n = perlin.turb(points[i++ & (input_count - 1)], 7);
+        do_not_optimize(n);
+    }
+}
+BENCHMARK(BM_perlin_turb);
+
+// batch API over the whole input, reported per point
+static void BM_perlin_turb_batch(BenchState& state) {
+    seed_random(config.seed);
+    Perlin perlin;
+    auto points = make_points(0.f, 10.f);
+    std::vector<float> out(input_count);
+    while (state.keep_running()) {
+        perlin.turb(points.data(), out.data(), input_count, 7);
+        do_not_optimize(out[0]);
+    }
+    state.set_items_processed(double(input_count) * state.iterations());
+}
+BENCHMARK(BM_perlin_turb_batch);
+
+static void BM_noise_texture_value(BenchState& state) {
+    seed_random(config.seed);
+    NoiseTexture tex(4.f);
+    auto points = make_points(0.f, 10.f);
+    int i = 0;
+    while (state.keep_running()) {
+        Color3f c = tex.value(0.f, 0.f, points[i++ & (input_count - 1)]);
+        do_not_optimize(c);
+    }
+}
+BENCHMARK(BM_noise_texture_value);
+
+// the same texture baked into a grid over a 2x2x2 box, random lookups inside it
+static void BM_noise_texture_baked(BenchState& state) {
+    static shared_ptr<BakedTexture> tex;
+    if (!tex) {
+        seed_random(config.seed);
+        tex = make_shared<BakedTexture>(make_shared<NoiseTexture>(4.f), 0.05f);
+        tex->bake(aabb(Point3f(0.f, 0.f, 0.f), Point3f(2.f, 2.f, 2.f)), size_t(256) << 20);
+    }
+    auto points = make_points(0.f, 2.f);
+    int i = 0;
+    while (state.keep_running()) {
+        Color3f c = tex->value(0.f, 0.f, points[i++ & (input_count - 1)]);
+        do_not_optimize(c);
+    }
+}
+BENCHMARK(BM_noise_texture_baked);
+
+static void BM_image_texture_value(BenchState& state) {
+    static shared_ptr<ImageTexture> tex;
+    if (!tex)
+        tex = make_shared<ImageTexture>((config.source_dir + "/images/earthmap.jpg").c_str());
+    auto uvs = make_points(0.f, 1.f);
+    int i = 0;
+    while (state.keep_running()) {
+        const Point3f& uv = uvs[i++ & (input_count - 1)];
+        Color3f c = tex->value(uv.x, uv.y, uv);
+        do_not_optimize(c);
+    }
+}
+BENCHMARK(BM_image_texture_value);
+
+// trilinear lookups with footprints spanning the whole pyramid
+static void image_texture_mip(BenchState& state, size_t stream_bytes) {
+    TextureOptions saved = texture_options();
+    texture_options().stream_bytes = stream_bytes;
+    Image image((config.source_dir + "/images/earthmap.jpg").c_str());
+    MipMap mipmap(image);
+    texture_options() = saved;
+    auto uvs = make_points(0.f, 1.f);
+    int i = 0;
+    while (state.keep_running()) {
+        const Point3f& uv = uvs[i++ & (input_count - 1)];
+        Color3f c = mipmap.lookup(uv.x, uv.y, uv.z * 0.01f);
+        do_not_optimize(c);
+    }
+}
+
+static void BM_image_texture_mip(BenchState& state) {
+    image_texture_mip(state, size_t(-1));
+}
+BENCHMARK(BM_image_texture_mip);
+
+// full resolution lookups along columns of the texture, as when scanning across a rotated surface
+static void BM_image_texture_coherent(BenchState& state) {
+    Image image((config.source_dir + "/images/earthmap.jpg").c_str());
+    MipMap mipmap(image);
+    const int steps = 4096;
+    int i = 0;
+    while (state.keep_running()) {
+        float u = float((i / steps) * 61 % 1024) / 1024.f;
+        float v = float(i % steps) / steps;
+        Color3f c = mipmap.lookup(u, v, 0.f);
+        do_not_optimize(c);
+        ++i;
+    }
+}
+BENCHMARK(BM_image_texture_coherent);
+
+// the same lookups with every page read through the shared texture cache
+static void BM_image_texture_streamed(BenchState& state) {
+    image_texture_mip(state, 0);
+}
+BENCHMARK(BM_image_texture_streamed);
+
+static void BM_cosine_pdf(BenchState& state) {
+    seed_random(config.seed);
+    CosinePDF pdf(Vec3f(0.f, 1.f, 0.f));
+    while (state.keep_running()) {
+        Vec3f dir = pdf.generate();
+        float value = pdf.value(dir);
+        do_not_optimize(value);
+    }
+}
+BENCHMARK(BM_cosine_pdf);
+
+static void BM_mixture_pdf(BenchState& state) {
+    seed_random(config.seed);
+    HittableList lights;
+    lights.add(make_shared<Quad>(Point3f(343.f, 554.f, 332.f), Vec3f(-130.f, 0.f, 0.f), Vec3f(0.f, 0.f, -105.f), nullptr));
+    lights.add(make_shared<Sphere>(Point3f(190.f, 90.f, 190.f), 90.f, nullptr));
+    Point3f origin(278.f, 0.f, 278.f);
+    MixturePDF pdf(make_shared<HittablePDF>(lights, origin), make_shared<CosinePDF>(Vec3f(0.f, 1.f, 0.f)));
+    while (state.keep_running()) {
+        Vec3f dir = pdf.generate();
+        float value = pdf.value(dir);
+        do_not_optimize(value);
+    }
+}
+BENCHMARK(BM_mixture_pdf);
+
+// 10k small spheres scattered in a cube, similar to the sphere cluster of the final scene
+static HittableList make_sphere_cloud() {
+    seed_random(config.seed);
+    HittableList list;
+    for (int i = 0; i < 10000; ++i)
+        list.add(make_shared<Sphere>(random_vector(-100.f, 100.f), 1.f, nullptr));
+    return list;
+}
+
+static void BM_bvh_build(BenchState& state) {
+    auto list = make_sphere_cloud();
+    while (state.keep_running()) {
+        LinearBVH bvh(list);
+        do_not_optimize(bvh.node_count());
+    }
+    state.set_items_processed(double(list.objects.size()) * state.iterations());
+}
+BENCHMARK(BM_bvh_build);
+
+// bounds of every node recomputed after the primitives moved, the per frame cost of an animated scene
+static void BM_bvh_refit(BenchState& state) {
+    auto list = make_sphere_cloud();
+    LinearBVH bvh(list);
+    while (state.keep_running()) {
+        bvh.refit();
+        do_not_optimize(bvh.bounding_box());
+    }
+    state.set_items_processed(double(list.objects.size()) * state.iterations());
+}
+BENCHMARK(BM_bvh_refit);
+
+// every sphere takes a small step per frame and the BVH is refitted, partially rebuilt once its quality drops
+static void BM_bvh_update(BenchState& state) {
+    auto list = make_sphere_cloud();
+    LinearBVH bvh(list);
+    std::vector<Vec3f> steps;
+    for (size_t i = 0; i < list.objects.size(); ++i)
+        steps.push_back(random_vector(-0.5f, 0.5f));
+    while (state.keep_running()) {
+        for (size_t i = 0; i < list.objects.size(); ++i)
+            list.objects[i]->translate(steps[i]);
+        auto kind = bvh.update();
+        do_not_optimize(kind);
+    }
+    state.set_items_processed(double(list.objects.size()) * state.iterations());
+}
+BENCHMARK(BM_bvh_update);
+
+static void bvh_hit(BenchState& state, LinearBVH::NodeFormat format) {
+    auto list = make_sphere_cloud();
+    LinearBVH bvh(list);
+    bvh.set_node_format(format);
+    seed_random(config.seed);
+    std::vector<Ray> rays;
+    for (int i = 0; i < input_count; ++i) {
+        Point3f origin = 300.f * random_unit_vector();
+        rays.push_back(Ray(origin, random_vector(-100.f, 100.f) - origin));
+    }
+    HitRecord rec;
+    int i = 0;
+    while (state.keep_running()) {
+        bool hit = bvh.hit(rays[i++ & (input_count - 1)], Interval(0.001f, INFINITY), rec);
+        do_not_optimize(hit);
+    }
+}
+
+static void BM_bvh_hit(BenchState& state) {
+    bvh_hit(state, LinearBVH::FLOAT_NODES);
+}
+BENCHMARK(BM_bvh_hit);
+
+// node bounds quantized relative to the parent, 16 and 12 bytes per node instead of 32
+static void BM_bvh_hit_q16(BenchState& state) {
+    bvh_hit(state, LinearBVH::QUANTIZED_16);
+}
+BENCHMARK(BM_bvh_hit_q16);
+
+static void BM_bvh_hit_q8(BenchState& state) {
+    bvh_hit(state, LinearBVH::QUANTIZED_8);
+}
+BENCHMARK(BM_bvh_hit_q8);
+
+// set associative LRU cache of 'line' byte lines, counts the misses of the addresses it is shown
+class CacheModel {
+public:
+    CacheModel(size_t bytes, size_t line, int ways)
+        : misses(0), line_bits(0), ways(ways), tags(bytes / line, ~uintptr_t(0)) {
+        while ((size_t(1) << line_bits) < line)
+            ++line_bits;
+        sets = tags.size() / ways;
+    }
+
+    void access(const void* address) {
+        uintptr_t tag = uintptr_t(address) >> line_bits;
+        uintptr_t* set = &tags[(tag % sets) * ways];
+        int way = 0;
+        while (way < ways - 1 && set[way] != tag)
+            ++way;
+        if (set[way] != tag)
+            ++misses;
+        // most recently used first
+        for (; way > 0; --way)
+            set[way] = set[way - 1];
+        set[0] = tag;
+    }
+
+    long long misses;
+
+private:
+    int line_bits;
+    int ways;
+    size_t sets;
+    std::vector<uintptr_t> tags;
+};
+
+// the node fetches of LinearBVH::hit() replayed through a model of the L2 cache and of the TLB; leaves are
+// intersected as well so that the ray shortens like in the real traversal
+static void replay_node_fetches(const LinearBVH& bvh, const HittableList& list, const Ray& ray,
+                                CacheModel& cache, CacheModel& tlb) {
+    const LinearBVHNode* nodes = bvh.node_data();
+    const std::vector<int>& order = bvh.primitive_order();
+    Interval ray_t(0.001f, INFINITY);
+    HitRecord rec;
+    int stack[64];
+    float entries[64];
+    int stack_size = 0;
+    int current = 0;
+    float entry;
+    cache.access(nodes);
+    tlb.access(nodes);
+    if (!nodes[0].bbox.hit(ray, ray_t, entry)) return;
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; ++i)
+                if (list.objects[order[i]]->hit(ray, ray_t, rec))
+                    ray_t.max = rec.t;
+        } else {
+            int child[2] = {node.count == 0 ? current + 1 : -node.count, node.offset};
+            float child_entry[2];
+            bool hit[2];
+            for (int c = 0; c < 2; ++c) {
+                cache.access(&nodes[child[c]]);
+                tlb.access(&nodes[child[c]]);
+                hit[c] = nodes[child[c]].bbox.hit(ray, ray_t, child_entry[c]);
+            }
+            if (hit[0] || hit[1]) {
+                int near = hit[0] && (!hit[1] || child_entry[0] <= child_entry[1]) ? 0 : 1;
+                if (hit[1 - near]) {
+                    stack[stack_size] = child[1 - near];
+                    entries[stack_size++] = child_entry[1 - near];
+                }
+                current = child[near];
+                continue;
+            }
+        }
+        while (stack_size > 0 && entries[stack_size - 1] >= ray_t.max)
+            --stack_size;
+        if (stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+}
+
+// a million spheres, the 32 MB of nodes are far larger than the L2 cache; random rays mostly miss the
+// cache below the upper levels of the tree
+static void large_bvh_hit(BenchState& state, LinearBVH::NodeLayout layout) {
+    seed_random(config.seed);
+    HittableList list;
+    for (int i = 0; i < 1000000; ++i)
+        list.add(make_shared<Sphere>(random_vector(-500.f, 500.f), 1.f, nullptr));
+    LinearBVH bvh(list);
+    bvh.set_node_layout(layout);
+    std::vector<Ray> rays;
+    for (int i = 0; i < input_count; ++i) {
+        Point3f origin = 1500.f * random_unit_vector();
+        rays.push_back(Ray(origin, random_vector(-500.f, 500.f) - origin));
+    }
+
+    // 1 MB 16 way L2 and a 1536 entry second level TLB of 4 KB pages; the first pass warms them up
+    CacheModel cache(1 << 20, 64, 16);
+    CacheModel tlb(1536 * 4096, 4096, 12);
+    for (int pass = 0; pass < 2; ++pass) {
+        cache.misses = tlb.misses = 0;
+        for (const Ray& ray : rays)
+            replay_node_fetches(bvh, list, ray, cache, tlb);
+    }
+    char label[96];
+    snprintf(label, sizeof(label), "simulated node misses/ray: L2 %.1f, TLB %.1f",
+             double(cache.misses) / input_count, double(tlb.misses) / input_count);
+    state.set_label(label);
+
+    HitRecord rec;
+    int i = 0;
+    while (state.keep_running()) {
+        bool hit = bvh.hit(rays[i++ & (input_count - 1)], Interval(0.001f, INFINITY), rec);
+        do_not_optimize(hit);
+    }
+}
+
+static void BM_bvh_large_hit(BenchState& state) {
+    large_bvh_hit(state, LinearBVH::DEPTH_FIRST);
+}
+BENCHMARK(BM_bvh_large_hit);
+
+// nodes regrouped into page sized treelets by the likelihood of a visit
+static void BM_bvh_large_hit_treelets(BenchState& state) {
+    large_bvh_hit(state, LinearBVH::TREELETS);
+}
+BENCHMARK(BM_bvh_large_hit_treelets);
+
+// small spheres between large slanted quads (ramps, roofs): the boxes of the quads are mostly empty and
+// swallow the spheres around them
+static void ramps_hit(BenchState& state, float spatial_split_budget) {
+    seed_random(config.seed);
+    HittableList list;
+    for (int i = 0; i < 2000; ++i)
+        list.add(make_shared<Sphere>(random_vector(-100.f, 100.f), 1.f, nullptr));
+    for (int i = 0; i < 40; ++i)
+        list.add(make_shared<Quad>(random_vector(-100.f, 100.f), 150.f * random_unit_vector(),
+                                   45.f * random_unit_vector(), nullptr));
+    LinearBVH bvh(list, spatial_split_budget);
+    std::vector<Ray> rays;
+    for (int i = 0; i < input_count; ++i) {
+        Point3f origin = 300.f * random_unit_vector();
+        rays.push_back(Ray(origin, random_vector(-100.f, 100.f) - origin));
+    }
+    HitRecord rec;
+    int i = 0;
+    while (state.keep_running()) {
+        bool hit = bvh.hit(rays[i++ & (input_count - 1)], Interval(0.001f, INFINITY), rec);
+        do_not_optimize(hit);
+    }
+}
+
+static void BM_bvh_ramps_hit(BenchState& state) {
+    ramps_hit(state, 0.f);
+}
+BENCHMARK(BM_bvh_ramps_hit);
+
+// SBVH with up to 50% more references than objects
+static void BM_bvh_ramps_hit_sbvh(BenchState& state) {
+    ramps_hit(state, 0.5f);
+}
+BENCHMARK(BM_bvh_ramps_hit_sbvh);
+
+// the sphere cloud heavily motion blurred, every sphere sweeps 20 units while the shutter is open
+static void BM_bvh_motion_hit(BenchState& state) {
+    seed_random(config.seed);
+    HittableList list;
+    for (int i = 0; i < 10000; ++i) {
+        Point3f center = random_vector(-100.f, 100.f);
+        list.add(make_shared<Sphere>(center, center + 20.f * random_unit_vector(), 1.f, nullptr));
+    }
+    LinearBVH bvh(list);
+    std::vector<Ray> rays;
+    for (int i = 0; i < input_count; ++i) {
+        Point3f origin = 300.f * random_unit_vector();
+        rays.push_back(Ray(origin, random_vector(-100.f, 100.f) - origin, random_float()));
+    }
+    HitRecord rec;
+    int i = 0;
+    while (state.keep_running()) {
+        bool hit = bvh.hit(rays[i++ & (input_count - 1)], Interval(0.001f, INFINITY), rec);
+        do_not_optimize(hit);
+    }
+}
+BENCHMARK(BM_bvh_motion_hit);
+
+// the same objects and rays through each accelerator, labelled with the memory of the structure
+static void accelerator_hit(BenchState& state, const HittableList& list, const std::vector<Ray>& rays,
+                            Accelerator::Type type) {
+    shared_ptr<Accelerator> accel;
+    if (type == Accelerator::KD_TREE)
+        accel = make_shared<KdTree>(list);
+    else if (type == Accelerator::GRID)
+        accel = make_shared<UniformGrid>(list);
+    else
+        accel = make_shared<LinearBVH>(list);
+    char label[64];
+    snprintf(label, sizeof(label), "%s, %.2f MB", accelerator_name(type), double(accel->memory_bytes()) / (1 << 20));
+    state.set_label(label);
+
+    HitRecord rec;
+    int i = 0;
+    while (state.keep_running()) {
+        bool hit = accel->hit(rays[i++ & (input_count - 1)], Interval(0.001f, INFINITY), rec);
+        do_not_optimize(hit);
+    }
+}
+
+// the sphere cloud of BM_bvh_hit: evenly spread particles of the same size, the case the grid is made for
+static void particles_hit(BenchState& state, Accelerator::Type type) {
+    auto list = make_sphere_cloud();
+    std::vector<Ray> rays;
+    for (int i = 0; i < input_count; ++i) {
+        Point3f origin = 300.f * random_unit_vector();
+        rays.push_back(Ray(origin, random_vector(-100.f, 100.f) - origin));
+    }
+    accelerator_hit(state, list, rays, type);
+}
+
+static void BM_particles_hit_bvh(BenchState& state) {
+    particles_hit(state, Accelerator::BVH);
+}
+BENCHMARK(BM_particles_hit_bvh);
+
+static void BM_particles_hit_kdtree(BenchState& state) {
+    particles_hit(state, Accelerator::KD_TREE);
+}
+BENCHMARK(BM_particles_hit_kdtree);
+
+static void BM_particles_hit_grid(BenchState& state) {
+    particles_hit(state, Accelerator::GRID);
+}
+BENCHMARK(BM_particles_hit_grid);
+
+// 100x100 columns of random height side by side like the ground of the final scene, seen at a low angle
+static void voxels_hit(BenchState& state, Accelerator::Type type) {
+    seed_random(config.seed);
+    HittableList list;
+    for (int i = 0; i < 100; ++i)
+        for (int j = 0; j < 100; ++j) {
+            Point3f corner(-100.f + 2.f * float(i), 0.f, -100.f + 2.f * float(j));
+            list.add(make_shared<Box>(corner, corner + Vec3f(2.f, random_float(1.f, 20.f), 2.f), nullptr));
+        }
+    std::vector<Ray> rays;
+    for (int i = 0; i < input_count; ++i) {
+        Point3f origin(random_float(-150.f, 150.f), 40.f, -200.f);
+        Point3f target(random_float(-100.f, 100.f), 0.f, random_float(-100.f, 100.f));
+        rays.push_back(Ray(origin, target - origin));
+    }
+    accelerator_hit(state, list, rays, type);
+}
+
+static void BM_voxels_hit_bvh(BenchState& state) {
+    voxels_hit(state, Accelerator::BVH);
+}
+BENCHMARK(BM_voxels_hit_bvh);
+
+static void BM_voxels_hit_kdtree(BenchState& state) {
+    voxels_hit(state, Accelerator::KD_TREE);
+}
+BENCHMARK(BM_voxels_hit_kdtree);
+
+static void BM_voxels_hit_grid(BenchState& state) {
+    voxels_hit(state, Accelerator::GRID);
+}
+BENCHMARK(BM_voxels_hit_grid);
+
+// 1080p HDR frame through the ACES curve, items are pixels
+static void BM_tonemap(BenchState& state) {
+    seed_random(config.seed);
+    FloatImage hdr(1920, 1080, 4);
+    for (int y = 0; y < hdr.get_height(); ++y)
+        for (int x = 0; x < hdr.get_width(); ++x)
+            hdr.set(x, y, Vec4f(4.f * random_vector(0.f, 1.f), 1.f));
+    Image ldr(hdr.get_width(), hdr.get_height(), Image::RGB);
+    ToneMapSettings settings;
+    settings.op = ToneMapSettings::ACES;
+    settings.gamma = 2.2f;
+    while (state.keep_running()) {
+        tonemap(hdr, ldr, settings, config.threads);
+        do_not_optimize(ldr.buffer()[0]);
+    }
+    state.set_items_processed(double(hdr.get_width()) * hdr.get_height() * state.iterations());
+}
+BENCHMARK(BM_tonemap);
+
+// a rendered 640x360 frame, items are bytes of pixel data
+static std::vector<unsigned char> render_preview_frame() {
+    seed_random(config.seed);
+    SceneDesc desc = parse_scene_file(config.source_dir + "/scenes/earth.scene");
+    Scene scene = build_scene(desc);
+    auto hdr = make_shared<FloatImage>(640, 360, 4);
+    RayTracer raytracer(hdr);
+    desc.setup(raytracer);
+    raytracer.samples_per_pixel = 1;
+    raytracer.num_threads = config.threads;
+    raytracer.render(*scene.world, scene.highlights);
+    Image ldr(640, 360, Image::RGB);
+    tonemap(*hdr, ldr, ToneMapSettings(), config.threads);
+    return std::vector<unsigned char>(ldr.buffer(), ldr.buffer() + 640 * 360 * 3);
+}
+
+static void BM_png_encode(BenchState& state) {
+    auto pixels = render_preview_frame();
+    while (state.keep_running()) {
+        auto png = encode_png(pixels.data(), 640, 360, 3, 6, config.threads);
+        do_not_optimize(png.size());
+    }
+    state.set_items_processed(double(pixels.size()) * state.iterations());
+}
+BENCHMARK(BM_png_encode);
+
+static void BM_qoi_encode(BenchState& state) {
+    auto pixels = render_preview_frame();
+    while (state.keep_running()) {
+        auto qoi = encode_qoi(pixels.data(), 640, 360, 3);
+        do_not_optimize(qoi.size());
+    }
+    state.set_items_processed(double(pixels.size()) * state.iterations());
+}
+BENCHMARK(BM_qoi_encode);
+
+// one tile of samples splatted through a 2 pixel Mitchell filter, items are samples
+static void BM_film_splat(BenchState& state) {
+    seed_random(config.seed);
+    std::vector<Vec3f> offsets(input_count);
+    for (auto& o : offsets)
+        o = Vec3f(random_float(), random_float(), 0.f);
+    Film film(64, 64, RayTracer::tile_size, make_shared<MitchellFilter>());
+    FilmTile& tile = film.begin_tile(5);
+    Color3f L(0.5f, 0.25f, 1.f);
+    int i = 0;
+    while (state.keep_running()) {
+        const Vec3f& o = offsets[i & (input_count - 1)];
+        film.add_sample(tile, 16 + (i & 15), 16 + ((i >> 4) & 15), o.x, o.y, L);
+        ++i;
+    }
+    do_not_optimize(tile.pixels[0]);
+    state.set_items_processed(double(state.iterations()));
+}
+BENCHMARK(BM_film_splat);
+
+// 512x512 noisy frame over two planes, items are pixels
+static void BM_denoise(BenchState& state) {
+    seed_random(config.seed);
+    const int size = 512;
+    FloatImage noisy(size, size, 4);
+    AOVBuffers aovs(size, size, AOVBuffers::ALBEDO | AOVBuffers::NORMAL | AOVBuffers::DEPTH);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            bool floor = y > size / 2;
+            noisy.set(x, y, Vec4f(random_float() < 0.1f ? 5.f * random_vector(0.f, 1.f) : Vec3f(), 1.f));
+            aovs.albedo.set(x, y, Vec4f(0.7f, 0.7f, 0.7f, 1.f));
+            aovs.normal.set(x, y, floor ? Vec4f(0.f, 1.f, 0.f, 0.f) : Vec4f(0.f, 0.f, 1.f, 0.f));
+            aovs.depth.pixel(x, y)[0] = floor ? 10.f + y * 0.01f : 20.f;
+        }
+    }
+    DenoiseSettings settings;
+    FloatImage image;
+    while (state.keep_running()) {
+        state.pause_timing();
+        image = noisy;
+        state.resume_timing();
+        denoise(image, aovs, settings, config.threads);
+        do_not_optimize(image.pixel(0, 0)[0]);
+    }
+    state.set_items_processed(double(size) * size * state.iterations());
+}
+BENCHMARK(BM_denoise);
+
+// building earth and final_scene, which share one image; 'cold' empties the texture registry first
+static void build_scenes(BenchState& state, bool cold) {
+    SceneDesc earth = parse_scene_file(config.source_dir + "/scenes/earth.scene");
+    SceneDesc final_scene = parse_scene_file(config.source_dir + "/scenes/final_scene.scene");
+    while (state.keep_running()) {
+        if (cold) {
+            state.pause_timing();
+            TextureRegistry::instance().release_unused();
+            state.resume_timing();
+        }
+        seed_random(config.seed);
+        Scene a = build_scene(earth);
+        Scene b = build_scene(final_scene);
+        do_not_optimize(b.textures.size());
+    }
+}
+
+static void BM_scene_build_cold(BenchState& state) { build_scenes(state, true); }
+BENCHMARK(BM_scene_build_cold);
+
+static void BM_scene_build_warm(BenchState& state) { build_scenes(state, false); }
+BENCHMARK(BM_scene_build_warm);
+
+// 整个场景的低采样渲染，报告 Mrays/s
+static void render_scene(BenchState& state, const char* name) {
+    seed_random(config.seed);
+    SceneDesc desc = parse_scene_file(config.source_dir + "/scenes/" + name + ".scene");
+    Scene scene = build_scene(desc);
+
+    int width = config.scene_width;
+    int height = std::max(1, int(float(width) * desc.image_height / desc.image_width + 0.5f));
+    auto image = make_shared<FloatImage>(width, height, 4);
+    RayTracer raytracer(image);
+    desc.setup(raytracer);
+    raytracer.samples_per_pixel = config.scene_spp;
+    raytracer.num_threads = config.threads;
+    raytracer.seed = config.seed;
+
+    double rays = 0.0;
+    while (state.keep_running()) {
+        raytracer.render(*scene.world, scene.highlights);
+        rays += double(raytracer.stats.rays());
+    }
+    state.set_items_processed(rays);
+}
+
+#define SCENE_BENCHMARK(scene) \
+    static void BM_scene_##scene(BenchState& state) { render_scene(state, #scene); } \
+    BENCHMARK_ONCE(BM_scene_##scene)
+
+SCENE_BENCHMARK(checkered_spheres);
+SCENE_BENCHMARK(earth);
+SCENE_BENCHMARK(perlin_spheres);
+SCENE_BENCHMARK(quad_mesh);
+SCENE_BENCHMARK(bouncing_spheres);
+SCENE_BENCHMARK(cornell_box);
+SCENE_BENCHMARK(final_scene);
+SCENE_BENCHMARK(instances);
+
+// the first frames of the turntable animation, the scene and the render threads are shared by all of them
+static void BM_scene_turntable_sequence(BenchState& state) {
+    seed_random(config.seed);
+    SceneDesc desc = parse_scene_file(config.source_dir + "/scenes/turntable.scene");
+    Scene scene = build_scene(desc);
+
+    int width = config.scene_width;
+    int height = std::max(1, int(float(width) * desc.image_height / desc.image_width + 0.5f));
+    auto image = make_shared<FloatImage>(width, height, 4);
+    RayTracer raytracer(image);
+    raytracer.pool = make_shared<ThreadPool>(config.threads);
+
+    double rays = 0.0;
+    while (state.keep_running()) {
+        for (int frame = desc.first_frame; frame < desc.first_frame + 8; ++frame) {
+            set_scene_frame(desc, scene, float(frame));
+            desc.setup(raytracer, float(frame));
+            raytracer.seed = RayTracer::frame_seed(config.seed, frame);
+            raytracer.samples_per_pixel = config.scene_spp;
+            raytracer.render(*scene.world, scene.highlights);
+            rays += double(raytracer.stats.rays());
+        }
+    }
+    state.set_items_processed(rays);
+}
+BENCHMARK_ONCE(BM_scene_turntable_sequence);
+
+static void usage(const char* prog) {
+    std::cerr <<
+        "usage: " << prog << " [options]\n"
+        "  --filter STR        only run benchmarks whose name contains STR\n"
+        "  --min-time SECS     minimum time per micro benchmark run (default 0.2)\n"
+        "  --repetitions N     runs per benchmark, the median is reported (default 5)\n"
+        "  --seed N            seed for all generated inputs (default 1)\n"
+        "  --threads N         render threads for scene benchmarks (default 1)\n"
+        "  --spp N             samples per pixel for scene benchmarks (default 4)\n"
+        "  --width N           image width for scene benchmarks (default 200)\n"
+        "  --source-dir PATH   directory holding scenes/ and images/\n"
+        "  --json PATH         also write the results as JSON\n";
+}
+
+int main(int argc, char** argv) {
+    std::string filter, json_path;
+    double min_time = 0.2;
+    int repetitions = 5;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--filter")              filter = value;
+        else if (arg == "--min-time")       min_time = atof(value);
+        else if (arg == "--repetitions")    repetitions = std::max(1, atoi(value));
+        else if (arg == "--seed")           config.seed = (unsigned int)strtoul(value, nullptr, 10);
+        else if (arg == "--threads")        config.threads = std::max(0, atoi(value));
+        else if (arg == "--spp")            config.scene_spp = std::max(1, atoi(value));
+        else if (arg == "--width")          config.scene_width = std::max(1, atoi(value));
+        else if (arg == "--source-dir")     config.source_dir = value;
+        else if (arg == "--json")           json_path = value;
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-32s %14s %14s %12s %8s %14s\n", "Benchmark", "Time(ns)", "Min(ns)", "Iterations", "Stddev", "Throughput");
+    std::vector<BenchResult> results;
+    for (const auto& entry : bench_registry()) {
+        if (!filter.empty() && entry.name.find(filter) == std::string::npos)
+            continue;
+        BenchResult r;
+        try {
+            r = run_benchmark(entry, min_time, repetitions);
+        } catch (const SceneError& e) {
+            std::cerr << entry.name << ": " << e.what() << std::endl;
+            continue;
+        }
+        char throughput[32] = "";
+        if (r.items_per_second > 0.0)
+            snprintf(throughput, sizeof(throughput), "%.3f M/s", r.items_per_second / 1e6);
+        printf("%-32s %14.1f %14.1f %12lld %7.1f%% %14s  %s\n", r.name.c_str(), r.ns_per_iteration, r.ns_min,
+               r.iterations, r.relative_stddev * 100.0, throughput, r.label.c_str());
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream out(json_path.c_str());
+        out << "{\"context\": {\"seed\": " << config.seed << ", \"threads\": " << config.threads
+            << ", \"scene_spp\": " << config.scene_spp << ", \"scene_width\": " << config.scene_width
+            << ", \"repetitions\": " << repetitions << "},\n \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            out << (i ? ",\n  " : "\n  ")
+                << "{\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+                << ", \"ns_per_iteration\": " << r.ns_per_iteration << ", \"ns_min\": " << r.ns_min
+                << ", \"relative_stddev\": " << r.relative_stddev
+                << ", \"items_per_second\": " << r.items_per_second;
+            if (!r.label.empty())
+                out << ", \"label\": \"" << r.label << "\"";
+            out << "}";
+        }
+        out << "\n]}" << std::endl;
+        if (!out) {
+            std::cerr << "failed to write '" << json_path << "'" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// 极简的 google-benchmark 风格测试框架：
+//   static void BM_foo(BenchState& state) { while (state.keep_running()) { ... } }
+//   BENCHMARK(BM_foo);
+// 每个测试先自动标定迭代次数使单次运行不短于 min_time，再重复若干次取中位数。
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class BenchState {
+public:
+    explicit BenchState(long long iterations) : max_iterations(iterations) {}
+
+    bool keep_running() {
+        if (done == 0)
+            start = std::chrono::steady_clock::now();
+        if (done < max_iterations) {
+            ++done;
+            return true;
+        }
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return false;
+    }
+
+    long long iterations() const { return max_iterations; }
+
+    // work done by the whole run, reported per second
+    void set_items_processed(double items) { items_processed = items; }
+
+    // extra information printed after the results, e.g. simulated cache misses
+    void set_label(const std::string& text) { label_text = text; }
+
+    // setup inside the loop can be excluded from timing
+    void pause_timing() { pause_start = std::chrono::steady_clock::now(); }
+    void resume_timing() { start += std::chrono::steady_clock::now() - pause_start; }
+
+    double seconds() const { return elapsed; }
+    double items() const { return items_processed; }
+    const std::string& label() const { return label_text; }
+
+private:
+    long long max_iterations;
+    long long done = 0;
+    double elapsed = 0.0;
+    double items_processed = 0.0;
+    std::string label_text;
+    std::chrono::steady_clock::time_point start, pause_start;
+};
+
+typedef void (*BenchFunction)(BenchState&);
+
+struct BenchEntry {
+    std::string name;
+    BenchFunction fn;
+    bool fixed_iterations;      // macro benchmarks run once per repetition
+};
+
+inline std::vector<BenchEntry>& bench_registry() {
+    static std::vector<BenchEntry> entries;
+    return entries;
+}
+
+inline int register_benchmark(const char* name, BenchFunction fn, bool fixed_iterations) {
+    bench_registry().push_back(BenchEntry{name, fn, fixed_iterations});
+    return 0;
+}
+
+#define BENCHMARK(fn) static int fn##_registered = register_benchmark(#fn, fn, false)
+#define BENCHMARK_ONCE(fn) static int fn##_registered = register_benchmark(#fn, fn, true)
+
+// keep the compiler from discarding a computed value
+template <typename T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T* sink;
+    sink = &value;
+#endif
+}
+
+struct BenchResult {
+    std::string name;
+    long long iterations;
+    double ns_per_iteration;        // median over the repetitions
+    double ns_min;
+    double relative_stddev;
+    double items_per_second;        // from the median repetition, 0 if not reported
+    std::string label;
+};
+
+inline BenchResult run_benchmark(const BenchEntry& entry, double min_time, int repetitions) {
+    long long iterations = 1;
+    if (!entry.fixed_iterations) {
+        while (true) {
+            BenchState state(iterations);
+            entry.fn(state);
+            if (state.seconds() >= min_time || iterations >= (1LL << 40))
+                break;
+            double scale = state.seconds() > 0.0 ? 1.4 * min_time / state.seconds() : 10.0;
+            iterations = std::max(iterations + 1, (long long)(iterations * std::min(scale, 10.0)));
+        }
+    }
+
+    std::vector<double> times;
+    std::vector<double> items;
+    std::string label;
+    for (int r = 0; r < repetitions; ++r) {
+        BenchState state(iterations);
+        entry.fn(state);
+        times.push_back(state.seconds());
+        items.push_back(state.items());
+        label = state.label();
+    }
+
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    double median = sorted[sorted.size() / 2];
+    size_t median_index = std::find(times.begin(), times.end(), median) - times.begin();
+    double mean = 0.0;
+    for (double t : times) mean += t;
+    mean /= times.size();
+    double var = 0.0;
+    for (double t : times) var += (t - mean) * (t - mean);
+    double stddev = std::sqrt(var / times.size());
+
+    BenchResult result;
+    result.name = entry.name;
+    result.iterations = iterations;
+    result.ns_per_iteration = median * 1e9 / iterations;
+    result.ns_min = sorted.front() * 1e9 / iterations;
+    result.relative_stddev = mean > 0.0 ? stddev / mean : 0.0;
+    result.items_per_second = median > 0.0 ? items[median_index] / median : 0.0;
+    result.label = label;
+    return result;
+}
+
+#endif
@@ -31,6 +31,18 @@ public:
     }
 
     bool hit(const Ray& r, Interval ray_t) const {
+        return clip(r, ray_t);
+    }
+
+    // 'entry' is where the ray enters the box, ray_t.min if it starts inside
+    bool hit(const Ray& r, Interval ray_t, float& entry) const {
+        if (!clip(r, ray_t)) return false;
+        entry = ray_t.min;
+        return true;
+    }
+
+    // shortens 'ray_t' to the part of the ray inside the box
+    bool clip(const Ray& r, Interval& ray_t) const {
         const Point3f& ray_orig = r.origin();
         const Vec3f& ray_dir = r.direction();
         for (int axis = 0; axis < 3; ++axis) {
@@ -59,6 +71,10 @@ public:
         return true;
     }
 
+    bool is_empty() const {
+        return x.min > x.max || y.min > y.max || z.min > z.max;
+    }
+
     int longest_axis() const {
         if (x.size() > y.size())
             return x.size() > z.size() ? 0 : 2;
@@ -66,6 +82,12 @@ public:
             return y.size() > z.size() ? 1 : 2;
     }
 
+    // 0 for the empty box
+    float surface_area() const {
+        if (x.size() < 0.f || y.size() < 0.f || z.size() < 0.f) return 0.f;
+        return 2.f * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
+    }
+
     static const aabb empty, universe;
 
 private:
@@ -77,6 +99,24 @@ private:
     }
 };
 
+// the box a linearly moving box covers at time 't', 0 at 'a' and 1 at 'b'
+inline aabb lerp_box(const aabb& a, const aabb& b, float t) {
+    aabb r;
+    r.x = Interval(a.x.min + t * (b.x.min - a.x.min), a.x.max + t * (b.x.max - a.x.max));
+    r.y = Interval(a.y.min + t * (b.y.min - a.y.min), a.y.max + t * (b.y.max - a.y.max));
+    r.z = Interval(a.z.min + t * (b.z.min - a.z.min), a.z.max + t * (b.z.max - a.z.max));
+    return r;
+}
+
+// the common part of two boxes, not padded, so that an empty result keeps min > max on some axis
+inline aabb overlap(const aabb& a, const aabb& b) {
+    aabb r;
+    r.x = Interval(std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max));
+    r.y = Interval(std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max));
+    r.z = Interval(std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max));
+    return r;
+}
+
 inline aabb operator+(const aabb& bbox, const Vec3f& offset) {
     return aabb(bbox.x + offset.x, bbox.y + offset.y, bbox.z + offset.z);
 }
@@ -0,0 +1,96 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include <vector>
+
+// 加速结构的公共接口：对一组基元求最近交点。
+// LinearBVH(默认)、SAH kd-tree 与均匀网格都实现它；场景用 render accel 选择，原型可以在 define 里单独选择，
+// 实例沿用原型的。kd-tree 与网格的一个基元可能落在多个叶子/格子里。
+class Accelerator : public Hittable {
+public:
+    enum Type { BVH, KD_TREE, GRID };
+
+    virtual Type type() const = 0;
+
+    // memory of the structure itself, the primitives are shared with the scene
+    virtual size_t memory_bytes() const = 0;
+
+    // the primitives moved in place, bring the structure up to date
+    virtual void objects_moved() = 0;
+};
+
+// 按空间划分的结构(kd-tree、网格)的公共部分：一个基元可能落在多个叶子/格子里，求交是随机的物体
+// (体积介质)不能测两次，放在结构之外，每条光线都测试。几何移动后整个结构重建。
+class SpatialAccelerator : public Accelerator {
+public:
+    explicit SpatialAccelerator(const HittableList& hittable_list) : objects(hittable_list.objects) {}
+
+    bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
+        bool hit_anything = false;
+        for (int i : unsplit) {
+            if (objects[i]->hit(ray, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+                rec.object_id = i;
+            }
+        }
+        return hit_structure(ray, ray_t, rec) || hit_anything;
+    }
+
+    aabb bounding_box() const override {
+        return bounds;
+    }
+
+    void translate(const Vec3f& offset) override {
+        for (auto& object : objects)
+            object->translate(offset);
+        build();
+    }
+
+    void rotate_y(float theta) override {
+        for (auto& object : objects)
+            object->rotate_y(theta);
+        build();
+    }
+
+    void objects_moved() override { build(); }
+
+protected:
+    std::vector<shared_ptr<Hittable>> objects;
+    std::vector<int> unsplit;       // objects that refuse clipping, tested on every ray
+    aabb bounds;                    // of all objects
+
+    // the objects in the structure, closer than 'ray_t', which the unsplit objects already shortened
+    virtual bool hit_structure(const Ray &ray, Interval ray_t, HitRecord &rec) const = 0;
+
+    // (re)build from 'objects', derived constructors call it once
+    virtual void build() = 0;
+
+    // fills 'unsplit' and 'bounds', the other objects go to 'refs' with their bounds in 'boxes';
+    // returns the bounds of those
+    aabb partition(std::vector<int>& refs, std::vector<aabb>& boxes) {
+        unsplit.clear();
+        bounds = aabb::empty;
+        aabb split_bounds = aabb::empty;
+        for (size_t i = 0; i < objects.size(); ++i) {
+            aabb box = objects[i]->bounding_box(), part;
+            bounds = aabb(bounds, box);
+            if (!objects[i]->clipped_bounds(box, part)) {
+                unsplit.push_back(int(i));
+                continue;
+            }
+            split_bounds = aabb(split_bounds, box);
+            refs.push_back(int(i));
+            boxes.push_back(box);
+        }
+        return split_bounds;
+    }
+};
+
+inline const char* accelerator_name(Accelerator::Type type) {
+    return type == Accelerator::KD_TREE ? "kdtree" : type == Accelerator::GRID ? "grid" : "bvh";
+}
+
+#endif
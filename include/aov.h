@@ -0,0 +1,79 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include <string>
+#include <vector>
+#include "float_image.h"
+#include "exr.h"
+
+// 与主图在同一次渲染中写出的辅助输出(AOV)，供降噪与合成使用。
+// albedo / normal / depth 为像素内所有样本首次相交结果的平均，未启用的缓冲不分配内存。
+struct AOVBuffers {
+    enum Flags {
+        ALBEDO = 1, NORMAL = 2, DEPTH = 4, IDS = 8, SAMPLES = 16,
+        ALL = ALBEDO | NORMAL | DEPTH | IDS | SAMPLES
+    };
+
+    int flags;
+    FloatImage albedo;          // RGB reflectance at the first hit, background color on a miss
+    FloatImage normal;          // XYZ world-space shading normal facing the camera, 0 on a miss
+    FloatImage depth;           // distance along the camera ray, +inf when every sample missed
+    FloatImage ids;             // top-level object index and material index, -1 on a miss
+    FloatImage sample_count;    // camera samples taken for the pixel
+
+    AOVBuffers(int w, int h, int flags) : flags(flags) {
+        if (enabled(ALBEDO)) albedo = FloatImage(w, h, 3);
+        if (enabled(NORMAL)) normal = FloatImage(w, h, 3);
+        if (enabled(DEPTH)) depth = FloatImage(w, h, 1);
+        if (enabled(IDS)) ids = FloatImage(w, h, 2);
+        if (enabled(SAMPLES)) sample_count = FloatImage(w, h, 1);
+    }
+
+    bool enabled(int flag) const { return (flags & flag) != 0; }
+
+    // layered channel names for a multi-channel EXR, e.g. "albedo.R", "depth.Z"
+    std::vector<ExrChannel> exr_channels() const {
+        std::vector<ExrChannel> channels;
+        if (enabled(ALBEDO)) {
+            channels.push_back(ExrChannel{"albedo.R", &albedo, 0});
+            channels.push_back(ExrChannel{"albedo.G", &albedo, 1});
+            channels.push_back(ExrChannel{"albedo.B", &albedo, 2});
+        }
+        if (enabled(NORMAL)) {
+            channels.push_back(ExrChannel{"normal.X", &normal, 0});
+            channels.push_back(ExrChannel{"normal.Y", &normal, 1});
+            channels.push_back(ExrChannel{"normal.Z", &normal, 2});
+        }
+        if (enabled(DEPTH))
+            channels.push_back(ExrChannel{"depth.Z", &depth, 0});
+        if (enabled(IDS)) {
+            channels.push_back(ExrChannel{"id.object", &ids, 0});
+            channels.push_back(ExrChannel{"id.material", &ids, 1});
+        }
+        if (enabled(SAMPLES))
+            channels.push_back(ExrChannel{"samples.Y", &sample_count, 0});
+        return channels;
+    }
+};
+
+// comma separated list of albedo, normal, depth, id, samples or all; returns -1 on an unknown name
+inline int parse_aov_flags(const std::string& list) {
+    int flags = 0;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(start, end - start);
+        if (name == "albedo") flags |= AOVBuffers::ALBEDO;
+        else if (name == "normal") flags |= AOVBuffers::NORMAL;
+        else if (name == "depth") flags |= AOVBuffers::DEPTH;
+        else if (name == "id") flags |= AOVBuffers::IDS;
+        else if (name == "samples") flags |= AOVBuffers::SAMPLES;
+        else if (name == "all") flags |= AOVBuffers::ALL;
+        else return -1;
+        start = end + 1;
+    }
+    return flags;
+}
+
+#endif
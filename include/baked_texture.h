@@ -0,0 +1,41 @@
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include <vector>
+#include "aabb.h"
+#include "texture.h"
+
+// 只依赖位置的程序纹理(噪声、棋盘格)的烘焙缓存：构建场景时把源纹理多线程地采样到覆盖
+// 其使用者包围盒的均匀三维网格上，渲染时做三线性插值，不再逐次计算 7 个倍频的 turbulence。
+// 网格分辨率从粗到细逐级加倍，直到随机测试点上的 RMS 误差不超过容差；所需内存超出上限时
+// 放弃烘焙，继续直接计算源纹理。烘焙前以及包围盒之外的点同样直接计算源纹理。
+class BakedTexture : public Texture {
+public:
+    BakedTexture(shared_ptr<Texture> source, float tolerance) : source(source), tolerance(tolerance) {}
+
+    // sample the source over 'bounds' with 'threads' threads (0: all hardware threads); false if the
+    // source is not position only or a grid within the tolerance would exceed 'max_bytes'
+    bool bake(const aabb& bounds, size_t max_bytes, int threads = 0);
+
+    bool baked() const { return !grid.empty(); }
+    float error() const { return rms_error; }   // measured RMS error of the last grid tried
+    size_t bytes() const { return grid.size() * sizeof(Color3f); }
+    int resolution(int axis) const { return dims[axis]; }
+    const shared_ptr<Texture>& source_texture() const { return source; }
+
+    Color3f value(float u, float v, const Point3f& p) const override;
+    bool position_only() const override { return true; }
+
+private:
+    shared_ptr<Texture> source;
+    float tolerance;
+    float rms_error = 0.f;
+    Point3f origin;
+    float inv_cell = 0.f;                   // grid vertices per world unit
+    int dims[3] = {0, 0, 0};                // vertices per axis, at least 2
+    std::vector<Color3f> grid;              // x fastest, then y, then z
+
+    void sample_grid(int threads);
+};
+
+#endif
@@ -2,15 +2,25 @@
 #define BVH_H
 
 #include "aabb.h"
+#include "accelerator.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <queue>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 class BVHNode : public Hittable {
 public:
     shared_ptr<Hittable> left;
     shared_ptr<Hittable> right;
     aabb bbox;
+    int axis = 0;       // left comes before right along this axis
 
     BVHNode(HittableList hittable_list) : BVHNode(hittable_list.objects, 0, hittable_list.objects.size()) {}
 
@@ -25,12 +35,15 @@ public:
             left = hittables[start];
             right = hittables[start + 1];
             bbox = aabb(left->bounding_box(), right->bounding_box());
+            axis = bbox.longest_axis();
+            if (box_compare(right, left, axis))
+                std::swap(left, right);
         } else {
             bbox = aabb::empty;
             for (int i = start; i < end; ++i) {
                 bbox = aabb(bbox, hittables[i]->bounding_box());
             }
-            auto axis = bbox.longest_axis();
+            axis = bbox.longest_axis();
             auto compare = axis == 0 ? x_box_compare :
                            axis == 1 ? y_box_compare :
                                        z_box_compare ;
@@ -43,13 +56,17 @@ public:
 
     bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
         // 前序遍历：先看本节点bvh，再看子节点是否相交
+        STAT_INC(bvh_nodes_visited);
         if (!bbox.hit(ray, ray_t))  return false;       // bvh 加速点：如果不碰bbox则认为bbox之内的物体都碰不到，则不继续递归
-        bool hit1 = left->hit(ray, ray_t, rec);
-        if (right != nullptr) {
-            bool hit2 = right->hit(ray, Interval(ray_t.min, hit1 ? rec.t : ray_t.max), rec);
-            return hit1 || hit2;
-        }
-        return hit1;
+        if (right == nullptr) return left->hit(ray, ray_t, rec);
+        // 先走光线方向上较近的孩子；它的交点缩短 ray_t 之后，远的孩子在自己的包围盒测试里就被剔除
+        const Hittable* near = left.get();
+        const Hittable* far = right.get();
+        if (ray.direction()[axis] < 0.f)
+            std::swap(near, far);
+        bool hit1 = near->hit(ray, ray_t, rec);
+        bool hit2 = far->hit(ray, Interval(ray_t.min, hit1 ? rec.t : ray_t.max), rec);
+        return hit1 || hit2;
     }
 
     aabb bounding_box() const override {
@@ -58,14 +75,19 @@ public:
 
     void translate(const Vec3f& offset) override {
         left->translate(offset);
-        right->translate(offset);
+        if (right != nullptr)
+            right->translate(offset);
         bbox = bbox + offset;
     }
 
     void rotate_y(float theta) override {
         left->rotate_y(theta);
-        right->rotate_y(theta);
-        bbox = aabb(left->bounding_box(), right->bounding_box());
+        if (right != nullptr) {
+            right->rotate_y(theta);
+            bbox = aabb(left->bounding_box(), right->bounding_box());
+        } else {
+            bbox = left->bounding_box();
+        }
     }
 
 private:
@@ -89,4 +111,1167 @@ private:
     }
 };
 
+// 扁平化的 BVH：节点默认按深度优先顺序存放在一个数组里，左孩子紧跟父节点，
+// 内部节点只记录右孩子下标(重排成 treelet 后另记左孩子)；叶子节点记录连续的一段基元。
+// 节点数组可以是自己持有的，也可以直接指向外部内存(如 mmap 的场景缓存)。
+// 有基元在快门时间内移动时，节点包围盒为快门打开时的包围盒，另存一份快门关闭时的，
+// 遍历时按光线的时间插值，快速移动的物体不必用整段轨迹的包围盒。
+struct LinearBVHNode {
+    aabb bbox;
+    int offset;     // interior: index of the right child, leaf: first primitive
+    int count;      // primitives in the leaf; interior: 0 if the left child follows the node, else minus its index
+};
+
+// node arrays start on a cache line, and on a page once they span one, so that the treelets of
+// LinearBVH::set_node_layout() line up with them
+template <typename T>
+struct NodeAllocator {
+    typedef T value_type;
+
+    NodeAllocator() {}
+    template <typename U> NodeAllocator(const NodeAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        size_t align = bytes >= 4096 ? 4096 : 64;
+        void* p = nullptr;
+#ifdef _WIN32
+        p = _aligned_malloc(bytes, align);
+#else
+        if (posix_memalign(&p, align, bytes) != 0)
+            p = nullptr;
+#endif
+        if (!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const NodeAllocator<T>&, const NodeAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const NodeAllocator<T>&, const NodeAllocator<U>&) { return false; }
+
+typedef std::vector<LinearBVHNode, NodeAllocator<LinearBVHNode>> LinearBVHNodeArray;
+
+// 量化的节点：包围盒相对于父节点(解码后的)包围盒存放，每轴把父盒分成 2^bits - 1 格，
+// 下界为离父盒下界的格数(向下取整)，上界为离父盒上界的格数(同样向外取整)，解码出的盒子总是包含原来的盒子。
+// 16 位的节点 16 字节、8 位的 12 字节，浮点节点 32 字节；遍历时沿路径逐层解码。
+template <typename T>
+struct QuantizedBVHNode {
+    T lo[3];            // cells above the minimum of the parent box
+    T hi[3];            // cells below its maximum
+    uint32_t offset : 28;
+    uint32_t count : 4;
+};
+
+class LinearBVH : public Accelerator {
+public:
+    static const int max_leaf_size = 2;
+    // deepest node below the root the traversal stacks hold; the builder stays above it, cached trees are
+    // checked against it
+    static const int max_depth = 64;
+
+    // 'spatial_split_budget' > 0 builds an SBVH, see build_spatial()
+    LinearBVH(const HittableList& hittable_list, float spatial_split_budget = 0.f)
+        : prims(hittable_list.objects), num_objects(prims.size()), split_budget(spatial_split_budget) {
+        build();
+        find_splittable();
+    }
+
+    // adopt prebuilt nodes, 'order[i]' is the index into 'objects' of the i-th primitive in BVH order;
+    // 'order_count' is larger than the number of objects when spatial splits put some into several leaves
+    LinearBVH(const std::vector<shared_ptr<Hittable>>& objects, const int* order, int order_count,
+              const LinearBVHNode* nodes, int node_count, shared_ptr<const void> backing,
+              float spatial_split_budget = 0.f)
+        : num_objects(objects.size()), split_budget(spatial_split_budget), nodes(nodes), num_nodes(node_count),
+          backing(backing) {
+        prims.reserve(order_count);
+        prim_order.assign(order, order + order_count);
+        for (auto idx : prim_order)
+            prims.push_back(objects[idx]);
+        // nodes written after set_node_layout() count as treelets, update() puts them back in depth first order
+        std::vector<int> depth_first;
+        depth_first_order(depth_first);
+        for (int i = 0; i < num_nodes && layout == DEPTH_FIRST; ++i)
+            if (depth_first[i] != i)
+                layout = TREELETS;
+        for (const auto& prim : prims) {
+            aabb open, close;
+            prim->linear_bounds(open, close);
+            if (!same_box(open, close)) {
+                refit();        // the cache holds the bounds at shutter open only
+                break;
+            }
+        }
+        find_splittable();
+    }
+
+    bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
+        if (num_nodes == 0) return false;
+        if (format == QUANTIZED_16) return hit_quantized(nodes16, ray, ray_t, rec);
+        if (format == QUANTIZED_8) return hit_quantized(nodes8, ray, ray_t, rec);
+
+        // the boxes of both children are tested at their parent, the nearer child is visited first and the
+        // farther one waits on the stack with its entry distance, skipped if a hit was found before it
+        TraversalEntry stack[max_depth];
+        int stack_size = 0;
+        int current = 0;
+        float entry;
+        bool hit_anything = false;
+        const aabb* close = close_boxes.empty() ? nullptr : close_boxes.data();
+        STAT_INC(bvh_nodes_visited);
+        if (!node_hit(close, 0, ray, ray_t, entry)) return false;
+        while (true) {
+            const LinearBVHNode& node = nodes[current];
+            if (node.count > 0) {
+                hit_anything |= hit_leaf(node.offset, node.count, ray, ray_t, rec);
+            } else {
+                int left = left_child(node, current);
+                float left_entry, right_entry;
+                STAT_INC(bvh_nodes_visited);
+                STAT_INC(bvh_nodes_visited);
+                bool hit_left = node_hit(close, left, ray, ray_t, left_entry);
+                bool hit_right = node_hit(close, node.offset, ray, ray_t, right_entry);
+                if (hit_left && hit_right) {
+                    if (right_entry < left_entry) {
+                        stack[stack_size].node = left;
+                        stack[stack_size++].entry = left_entry;
+                        current = node.offset;
+                    } else {
+                        stack[stack_size].node = node.offset;
+                        stack[stack_size++].entry = right_entry;
+                        current = left;
+                    }
+                    continue;
+                }
+                if (hit_left || hit_right) {
+                    current = hit_left ? left : node.offset;
+                    continue;
+                }
+            }
+            while (stack_size > 0 && stack[stack_size - 1].entry >= ray_t.max)
+                --stack_size;
+            if (stack_size == 0) break;
+            current = stack[--stack_size].node;
+        }
+        return hit_anything;
+    }
+
+    // a tree holding a primitive that has to stay in one leaf has to stay in one as well, e.g. as a prototype
+    bool clipped_bounds(const aabb& region, aabb& clipped) const override {
+        clipped = overlap(bounding_box(), region);
+        return splittable;
+    }
+
+    aabb bounding_box() const override {
+        if (num_nodes == 0) return aabb::empty;
+        if (format != FLOAT_NODES) return root_frame;
+        return close_boxes.empty() ? nodes[0].bbox : aabb(nodes[0].bbox, close_boxes[0]);
+    }
+
+    void linear_bounds(aabb& open, aabb& close) const override {
+        open = num_nodes == 0 ? aabb::empty : format != FLOAT_NODES ? root_frame : nodes[0].bbox;
+        close = close_boxes.empty() ? open : close_boxes[0];
+    }
+
+    void translate(const Vec3f& offset) override {
+        for (auto& object : unique_objects())
+            object->translate(offset);
+        NodeFormat packed = unpack_nodes();
+        own_nodes();
+        for (auto& node : owned_nodes)
+            node.bbox = node.bbox + offset;
+        for (auto& box : close_boxes)
+            box = box + offset;
+        for (auto& box : ref_boxes)
+            box = box + offset;
+        for (auto& box : built_boxes)
+            box = box + offset;
+        set_node_format(packed);
+    }
+
+    void rotate_y(float theta) override {
+        for (auto& object : unique_objects())
+            object->rotate_y(theta);
+        update();
+    }
+
+    // 动画：基元移动之后不必重建，自底向上重新计算节点包围盒即可(refit，O(n))。
+    // 但拓扑保持不变，移动越多树的质量越差，因此用 SAH 代价衡量质量，退化超过阈值的子树重建。
+    enum UpdateKind { REFITTED, PARTIALLY_REBUILT, REBUILT };
+
+    static constexpr float default_rebuild_threshold = 1.5f;
+
+    // recompute the bounds of every node from the current bounds of the primitives, with bounds at shutter
+    // close as well if any of them moves
+    void refit() {
+        NodeFormat packed = unpack_nodes();
+        refit_nodes();
+        set_node_format(packed);
+    }
+
+    // SAH cost of the tree: expected traversal and intersection cost of a ray that hits the root bounds
+    float sah_cost() const {
+        std::vector<float> cost;
+        if (format == FLOAT_NODES) {
+            subtree_costs(nodes, cost);
+        } else {
+            LinearBVHNodeArray decoded;
+            if (format == QUANTIZED_16)
+                dequantize(nodes16, decoded);
+            else
+                dequantize(nodes8, decoded);
+            subtree_costs(decoded.data(), cost);
+        }
+        return cost.empty() ? 0.f : cost[0];
+    }
+
+    // refit, then rebuild the largest subtrees whose SAH cost grew beyond 'threshold' times their cost
+    // when they were built; the subtree of a node keeps its nodes and primitives in place
+    UpdateKind update(float threshold = default_rebuild_threshold) {
+        NodeFormat packed = unpack_nodes();
+        NodeLayout laid_out = layout;
+        set_node_layout(DEPTH_FIRST);
+        UpdateKind kind = update_nodes(threshold);
+        set_node_layout(laid_out);
+        set_node_format(packed);
+        return kind;
+    }
+
+    // 节点内存成为瓶颈的大场景可以换成量化的节点，内存为浮点节点的 1/2 (16 位) 或 3/8 (8 位)，
+    // 代价是遍历时逐层解码。refit()/update()/translate() 先解码成浮点节点，完成后再量化。
+    enum NodeFormat { FLOAT_NODES, QUANTIZED_16, QUANTIZED_8 };
+
+    // false, keeping float nodes, for trees with moving primitives or unbounded boxes;
+    // quantized nodes are laid out depth first
+    bool set_node_format(NodeFormat wanted) {
+        if (wanted == format) return true;
+        unpack_nodes();
+        if (wanted == FLOAT_NODES || num_nodes == 0) return wanted == FLOAT_NODES;
+        const aabb& root = nodes[0].bbox;
+        if (!close_boxes.empty() || !std::isfinite(root.x.size() + root.y.size() + root.z.size()) ||
+            num_nodes >= (1 << 28) || prims.size() >= (size_t(1) << 28))
+            return false;
+
+        set_node_layout(DEPTH_FIRST);
+        root_frame = root;
+        if (wanted == QUANTIZED_16)
+            quantize(nodes16);
+        else
+            quantize(nodes8);
+        LinearBVHNodeArray().swap(owned_nodes);
+        nodes = nullptr;
+        backing.reset();
+        format = wanted;
+        return true;
+    }
+
+    NodeFormat node_format() const { return format; }
+
+    // 节点布局：深度优先时左孩子紧跟父节点，但树的上层散布在整个数组里，每一层都落在不同的缓存行和页上。
+    // 树大于 L2/L3 时可以重排成 treelet：从根开始按包围盒面积(即被访问的概率)贪心地把节点装满一页，
+    // 装不下的孩子作为后续 treelet 的根；热的上层节点因此集中在开头的几页里。
+    // update() 先换回深度优先再换回来，量化的节点总是深度优先。
+    enum NodeLayout { DEPTH_FIRST, TREELETS };
+
+    static const int treelet_bytes = 4096;
+
+    // false for quantized nodes, which stay depth first
+    bool set_node_layout(NodeLayout wanted) {
+        if (format != FLOAT_NODES) return wanted == DEPTH_FIRST;
+        if (wanted == layout) return true;
+        std::vector<int> order;
+        if (wanted == TREELETS)
+            treelet_order(order);
+        else
+            depth_first_order(order);
+        reorder_nodes(order);
+        layout = wanted;
+        return true;
+    }
+
+    NodeLayout node_layout() const { return layout; }
+
+    // memory held by the nodes, including the bounds at shutter close
+    size_t node_bytes() const {
+        size_t node_size = format == QUANTIZED_16 ? sizeof(QuantizedBVHNode<uint16_t>) :
+                           format == QUANTIZED_8 ? sizeof(QuantizedBVHNode<uint8_t>) : sizeof(LinearBVHNode);
+        return size_t(num_nodes) * node_size + close_boxes.size() * sizeof(aabb);
+    }
+
+    Type type() const override { return BVH; }
+
+    size_t memory_bytes() const override { return node_bytes(); }
+
+    void objects_moved() override { update(); }
+
+    // null while the nodes are quantized
+    const LinearBVHNode* node_data() const { return nodes; }
+    int node_count() const { return num_nodes; }
+    // one entry per leaf reference, objects split by the SBVH appear more than once
+    const std::vector<int>& primitive_order() const { return prim_order; }
+
+private:
+    std::vector<shared_ptr<Hittable>> prims;
+    std::vector<int> prim_order;
+    size_t num_objects;
+    float split_budget;                 // extra references allowed by spatial splits, per object
+    LinearBVHNodeArray owned_nodes;
+    const LinearBVHNode* nodes = nullptr;
+    int num_nodes = 0;
+    shared_ptr<const void> backing;
+    std::vector<float> built_cost;      // per node SAH cost of the subtree when it was built
+    bool splittable = true;             // see clipped_bounds()
+    std::vector<aabb> close_boxes;      // per node bounds at shutter close, empty when nothing moves
+    // after spatial splits: per reference bounds of its part of the object, and per object its bounds at the
+    // time, refit() keeps the clipped bounds of the objects that did not move since
+    std::vector<aabb> ref_boxes;
+    std::vector<aabb> built_boxes;
+
+    NodeLayout layout = DEPTH_FIRST;
+    NodeFormat format = FLOAT_NODES;
+    std::vector<QuantizedBVHNode<uint16_t>> nodes16;
+    std::vector<QuantizedBVHNode<uint8_t>> nodes8;
+    aabb root_frame;                    // the root node is quantized relative to its own float bounds
+
+    static_assert(max_leaf_size < 16, "leaf sizes must fit QuantizedBVHNode::count");
+
+    // relative costs of visiting an interior node and of intersecting a primitive
+    static constexpr float traversal_cost = 0.125f;
+    static constexpr float intersection_cost = 1.f;
+
+    void refit_nodes() {
+        own_nodes();
+        if (ref_boxes.empty() && close_boxes.empty() && refit_static())
+            return;
+        close_boxes.resize(num_nodes);
+        bool moving = false;
+        for (int i = num_nodes - 1; i >= 0; --i) {     // children are stored after their parent
+            LinearBVHNode& node = owned_nodes[i];
+            aabb& close = close_boxes[i];
+            if (node.count > 0) {
+                node.bbox = close = aabb::empty;
+                for (int p = node.offset; p < node.offset + node.count; ++p) {
+                    aabb a, b;
+                    prims[p]->linear_bounds(a, b);
+                    if (!same_box(a, b))
+                        moving = true;
+                    else
+                        a = b = reference_box(p, a);
+                    node.bbox = aabb(node.bbox, a);
+                    close = aabb(close, b);
+                }
+            } else {
+                int left = left_child(node, i);
+                node.bbox = aabb(owned_nodes[left].bbox, owned_nodes[node.offset].bbox);
+                close = aabb(close_boxes[left], close_boxes[node.offset]);
+            }
+        }
+        if (!moving)
+            close_boxes.clear();
+    }
+
+    UpdateKind update_nodes(float threshold) {
+        if (num_nodes == 0) return REFITTED;
+        if (built_cost.size() != size_t(num_nodes))    // adopted nodes, measured before anything moves
+            subtree_costs(nodes, built_cost);
+        refit_nodes();
+
+        std::vector<float> cost;
+        subtree_costs(nodes, cost);
+        if (cost[0] > threshold * built_cost[0]) {
+            build();
+            return REBUILT;
+        }
+
+        // first primitive and last node of every subtree
+        std::vector<int> first(num_nodes), last(num_nodes);
+        for (int i = num_nodes - 1; i >= 0; --i) {
+            const LinearBVHNode& node = nodes[i];
+            first[i] = node.count > 0 ? node.offset : first[i + 1];
+            last[i] = node.count > 0 ? i : last[node.offset];
+        }
+
+        std::vector<std::pair<int, int>> rebuilt;      // node ranges
+        int stack[max_depth];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            int i = stack[--stack_size];
+            const LinearBVHNode& node = nodes[i];
+            if (node.count > 0) continue;
+            if (cost[i] > threshold * built_cost[i]) {
+                int end = nodes[last[i]].offset + nodes[last[i]].count;
+                if (!rebuild_subtree(i, last[i] + 1, first[i], end)) {
+                    build();
+                    return REBUILT;
+                }
+                rebuilt.push_back(std::make_pair(i, last[i] + 1));
+            } else {
+                stack[stack_size++] = node.offset;
+                stack[stack_size++] = i + 1;
+            }
+        }
+        if (rebuilt.empty())
+            return REFITTED;
+        if (!close_boxes.empty())
+            refit_nodes();  // rebuilt subtrees only have bounds over the whole shutter interval
+        // new baseline of the rebuilt subtrees; the others keep theirs so that slow degradation adds up
+        subtree_costs(nodes, cost);
+        for (auto& range : rebuilt)
+            std::copy(cost.begin() + range.first, cost.begin() + range.second, built_cost.begin() + range.first);
+        return PARTIALLY_REBUILT;
+    }
+
+    void build() {
+        // restore the input order first so that 'prim_order' keeps indexing the original list
+        std::vector<shared_ptr<Hittable>> objects(num_objects);
+        for (size_t i = 0; i < prims.size(); ++i)
+            objects[prim_order.empty() ? i : prim_order[i]] = prims[i];
+
+        // split by the bounds over the whole shutter interval
+        std::vector<aabb> boxes(objects.size());
+        std::vector<int> order(objects.size());
+        bool moving = false;
+        for (size_t i = 0; i < objects.size(); ++i) {
+            aabb open, close;
+            objects[i]->linear_bounds(open, close);
+            boxes[i] = aabb(open, close);
+            order[i] = int(i);
+            moving = moving || !same_box(open, close);
+        }
+
+        owned_nodes.clear();
+        ref_boxes.clear();
+        built_boxes.clear();
+        if (split_budget > 0.f && !order.empty()) {
+            build_spatial(objects, boxes, order, ref_boxes);
+            built_boxes.swap(boxes);
+        } else {
+            owned_nodes.reserve(objects.size() * 2);
+            if (!order.empty())
+                build_recursive(owned_nodes, order, boxes, 0, int(order.size()));
+        }
+
+        prims.resize(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            prims[i] = objects[order[i]];
+        prim_order.swap(order);
+        nodes = owned_nodes.data();
+        num_nodes = int(owned_nodes.size());
+        backing.reset();
+        layout = DEPTH_FIRST;
+        close_boxes.clear();
+        if (moving)
+            refit_nodes();
+        subtree_costs(nodes, built_cost);
+    }
+
+    int build_recursive(LinearBVHNodeArray& out, std::vector<int>& order, const std::vector<aabb>& boxes,
+                        int start, int end) {
+        int index = int(out.size());
+        out.push_back(LinearBVHNode());
+
+        aabb bbox = aabb::empty;
+        for (int i = start; i < end; ++i)
+            bbox = aabb(bbox, boxes[order[i]]);
+
+        auto span = end - start;
+        if (span <= max_leaf_size) {
+            out[index].bbox = bbox;
+            out[index].offset = start;
+            out[index].count = span;
+            return index;
+        }
+
+        auto axis = bbox.longest_axis();
+        auto mid = start + span / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+            [&](int a, int b) {
+                return boxes[a].axis_interval(axis).min < boxes[b].axis_interval(axis).min;
+            });
+        build_recursive(out, order, boxes, start, mid);
+        int right = build_recursive(out, order, boxes, mid, end);
+
+        out[index].bbox = bbox;
+        out[index].offset = right;
+        out[index].count = 0;
+        return index;
+    }
+
+    // SBVH (Stich et al. 2009): besides partitioning the objects, a node may split space, an object straddling
+    // the plane then goes to both children, each side with the bounds of its part there (a reference).
+    // Large slanted objects no longer stretch the boxes of everything next to them.
+    // Both kinds of split are chosen by binned SAH; spatial splits stop once there are
+    // (1 + split_budget) times as many references as objects. Moving objects stay whole, clipped bounds
+    // only hold at one time.
+    static const int split_bins = 16;
+    static const int max_split_depth = 40;     // median splits below, within max_depth
+
+    struct Reference {
+        aabb box;
+        int object;
+    };
+
+    struct SpatialBuild {
+        const std::vector<shared_ptr<Hittable>>& objects;
+        const std::vector<bool>& moving;
+        std::vector<int>& order;            // objects of the leaves, in leaf order
+        std::vector<aabb>& boxes;           // and their clipped bounds
+        size_t references;
+        size_t max_references;
+        float min_overlap;                  // surface area, spatial splits are tried where object splits overlap more
+    };
+
+    void build_spatial(const std::vector<shared_ptr<Hittable>>& objects, const std::vector<aabb>& boxes,
+                       std::vector<int>& order, std::vector<aabb>& clipped) {
+        std::vector<Reference> refs(objects.size());
+        std::vector<bool> moving(objects.size());
+        aabb root = aabb::empty;
+        for (size_t i = 0; i < objects.size(); ++i) {
+            refs[i].box = boxes[i];
+            refs[i].object = int(i);
+            root = aabb(root, boxes[i]);
+            aabb open, close;
+            objects[i]->linear_bounds(open, close);
+            moving[i] = !same_box(open, close);
+        }
+        std::vector<int> leaf_order;
+        leaf_order.reserve(objects.size());
+        clipped.clear();
+        clipped.reserve(objects.size());
+        SpatialBuild b = {objects, moving, leaf_order, clipped, objects.size(),
+                          objects.size() + size_t(double(split_budget) * double(objects.size())),
+                          1e-5f * root.surface_area()};
+        owned_nodes.reserve(objects.size() * 2);
+        build_spatial_recursive(b, refs, 0);
+        order.swap(leaf_order);
+    }
+
+    int build_spatial_recursive(SpatialBuild& b, std::vector<Reference>& refs, int depth) {
+        int index = int(owned_nodes.size());
+        owned_nodes.push_back(LinearBVHNode());
+
+        aabb bbox = aabb::empty;
+        for (const auto& ref : refs)
+            bbox = aabb(bbox, ref.box);
+
+        int n = int(refs.size());
+        if (n <= max_leaf_size) {
+            owned_nodes[index].bbox = bbox;
+            owned_nodes[index].offset = int(b.order.size());
+            owned_nodes[index].count = n;
+            for (const auto& ref : refs) {
+                b.order.push_back(ref.object);
+                b.boxes.push_back(ref.box);
+            }
+            return index;
+        }
+
+        std::vector<Reference> left, right;
+        if (depth >= max_split_depth || !sah_split(b, refs, bbox, left, right))
+            median_split(refs, left, right);
+        std::vector<Reference>().swap(refs);
+        build_spatial_recursive(b, left, depth + 1);
+        int second = build_spatial_recursive(b, right, depth + 1);
+
+        owned_nodes[index].bbox = bbox;
+        owned_nodes[index].offset = second;
+        owned_nodes[index].count = 0;
+        return index;
+    }
+
+    static float centroid(const aabb& box, int axis) {
+        const Interval& i = box.axis_interval(axis);
+        return 0.5f * (i.min + i.max);
+    }
+
+    static int bin_of(float x, float lo, float extent) {
+        int k = int((x - lo) * (float(split_bins) / extent));
+        return std::min(std::max(k, 0), split_bins - 1);
+    }
+
+    // 'box' cut down to [min, max] along 'axis'
+    static aabb slab(const aabb& box, int axis, float min, float max) {
+        aabb r = box;
+        Interval& i = axis == 0 ? r.x : axis == 1 ? r.y : r.z;
+        i = Interval(std::max(i.min, min), std::min(i.max, max));
+        return r;
+    }
+
+    // the cheapest object or spatial split by SAH, false if the references cannot be told apart
+    bool sah_split(SpatialBuild& b, const std::vector<Reference>& refs, const aabb& bbox,
+                   std::vector<Reference>& left, std::vector<Reference>& right) const {
+        int n = int(refs.size());
+        float best_cost = INFINITY;
+        int best_axis = -1, best_plane = 0;
+        bool spatial = false;
+        aabb best_left = aabb::empty, best_right = aabb::empty;
+
+        struct Bin {
+            aabb box;
+            int count;      // object splits: centroids, spatial splits: references entering the bin
+            int exits;      // spatial splits: references leaving the bin
+        };
+        Bin bins[split_bins];
+        aabb right_box[split_bins];
+        int right_count[split_bins];
+
+        // object splits, binned by centroid
+        for (int a = 0; a < 3; ++a) {
+            float lo = INFINITY, hi = -INFINITY;
+            for (const auto& ref : refs) {
+                lo = std::min(lo, centroid(ref.box, a));
+                hi = std::max(hi, centroid(ref.box, a));
+            }
+            if (!(hi > lo)) continue;
+            for (auto& bin : bins)
+                bin.box = aabb::empty, bin.count = 0;
+            for (const auto& ref : refs) {
+                Bin& bin = bins[bin_of(centroid(ref.box, a), lo, hi - lo)];
+                bin.box = aabb(bin.box, ref.box);
+                ++bin.count;
+            }
+            aabb acc = aabb::empty;
+            int count = 0;
+            for (int k = split_bins - 1; k > 0; --k) {
+                acc = aabb(acc, bins[k].box);
+                count += bins[k].count;
+                right_box[k] = acc;
+                right_count[k] = count;
+            }
+            acc = aabb::empty;
+            count = 0;
+            for (int k = 1; k < split_bins; ++k) {
+                acc = aabb(acc, bins[k - 1].box);
+                count += bins[k - 1].count;
+                if (count == 0 || right_count[k] == 0) continue;
+                float cost = acc.surface_area() * count + right_box[k].surface_area() * right_count[k];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_plane = k;
+                    best_left = acc;
+                    best_right = right_box[k];
+                }
+            }
+        }
+        int object_axis = best_axis, object_plane = best_plane;
+
+        // spatial splits, binned by position with every reference clipped to the bins it covers
+        bool try_spatial = b.references < b.max_references &&
+                           (best_axis < 0 || overlap(best_left, best_right).surface_area() > b.min_overlap);
+        for (int a = 0; try_spatial && a < 3; ++a) {
+            float lo = bbox.axis_interval(a).min, extent = bbox.axis_interval(a).size();
+            if (!(extent > 0.f)) continue;
+            for (auto& bin : bins)
+                bin.box = aabb::empty, bin.count = bin.exits = 0;
+            for (const auto& ref : refs) {
+                const Interval& range = ref.box.axis_interval(a);
+                int first = bin_of(range.min, lo, extent), last = bin_of(range.max, lo, extent);
+                aabb parts[split_bins];
+                bool split = first < last && !b.moving[ref.object];
+                for (int k = first; split && k <= last; ++k) {
+                    float min = lo + extent * float(k) / float(split_bins);
+                    float max = lo + extent * float(k + 1) / float(split_bins);
+                    split = b.objects[ref.object]->clipped_bounds(slab(ref.box, a, min, max), parts[k]);
+                }
+                if (!split) {   // whole, on the side of its centroid
+                    first = last = bin_of(centroid(ref.box, a), lo, extent);
+                    parts[first] = ref.box;
+                }
+                for (int k = first; k <= last; ++k)
+                    if (!parts[k].is_empty())
+                        bins[k].box = aabb(bins[k].box, parts[k]);
+                ++bins[first].count;
+                ++bins[last].exits;
+            }
+            aabb acc = aabb::empty;
+            int count = 0;
+            for (int k = split_bins - 1; k > 0; --k) {
+                acc = aabb(acc, bins[k].box);
+                count += bins[k].exits;
+                right_box[k] = acc;
+                right_count[k] = count;
+            }
+            acc = aabb::empty;
+            count = 0;
+            for (int k = 1; k < split_bins; ++k) {
+                acc = aabb(acc, bins[k - 1].box);
+                count += bins[k - 1].count;
+                int duplicates = count + right_count[k] - n;
+                if (count == 0 || right_count[k] == 0 || count == n || right_count[k] == n ||
+                    b.references + duplicates > b.max_references)
+                    continue;
+                float cost = acc.surface_area() * count + right_box[k].surface_area() * right_count[k];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_plane = k;
+                    spatial = true;
+                }
+            }
+        }
+
+        if (spatial) {
+            const Interval& range = bbox.axis_interval(best_axis);
+            float lo = range.min, extent = range.size();
+            float plane = lo + extent * float(best_plane) / float(split_bins);
+            for (const auto& ref : refs) {
+                const Interval& r = ref.box.axis_interval(best_axis);
+                if (r.max <= plane) {
+                    left.push_back(ref);
+                } else if (r.min >= plane) {
+                    right.push_back(ref);
+                } else {
+                    const Hittable& object = *b.objects[ref.object];
+                    Reference l = ref, h = ref;
+                    if (!b.moving[ref.object] &&
+                        object.clipped_bounds(slab(ref.box, best_axis, r.min, plane), l.box) &&
+                        object.clipped_bounds(slab(ref.box, best_axis, plane, r.max), h.box) &&
+                        !(l.box.is_empty() && h.box.is_empty())) {
+                        if (!l.box.is_empty()) left.push_back(l);
+                        if (!h.box.is_empty()) right.push_back(h);
+                    } else if (bin_of(centroid(ref.box, best_axis), lo, extent) < best_plane) {
+                        left.push_back(ref);
+                    } else {
+                        right.push_back(ref);
+                    }
+                }
+            }
+            // the bins only approximate the clipped references, check that both sides got smaller
+            if (!left.empty() && !right.empty() && int(left.size()) < n && int(right.size()) < n) {
+                b.references += left.size() + right.size() - size_t(n);
+                return true;
+            }
+            left.clear();
+            right.clear();
+        }
+
+        if (object_axis < 0)
+            return false;
+        float lo = INFINITY, hi = -INFINITY;
+        for (const auto& ref : refs) {
+            lo = std::min(lo, centroid(ref.box, object_axis));
+            hi = std::max(hi, centroid(ref.box, object_axis));
+        }
+        for (const auto& ref : refs) {
+            if (bin_of(centroid(ref.box, object_axis), lo, hi - lo) < object_plane)
+                left.push_back(ref);
+            else
+                right.push_back(ref);
+        }
+        return true;
+    }
+
+    // halves by centroid along the longest axis, for references that SAH cannot separate
+    static void median_split(std::vector<Reference>& refs, std::vector<Reference>& left,
+                             std::vector<Reference>& right) {
+        aabb centroids = aabb::empty;
+        for (const auto& ref : refs) {
+            Point3f c(centroid(ref.box, 0), centroid(ref.box, 1), centroid(ref.box, 2));
+            centroids = aabb(centroids, aabb(c, c));
+        }
+        int axis = centroids.longest_axis();
+        size_t mid = refs.size() / 2;
+        std::nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+            [&](const Reference& a, const Reference& b) {
+                return centroid(a.box, axis) < centroid(b.box, axis);
+            });
+        left.assign(refs.begin(), refs.begin() + mid);
+        right.assign(refs.begin() + mid, refs.end());
+    }
+
+    // rebuild the subtree at node 'root' occupying nodes [root, node_end) over primitives [first, end).
+    // The node count only depends on the primitive count, so the new subtree fits in the same place;
+    // false if it does not, for nodes that were not built by build_recursive().
+    bool rebuild_subtree(int root, int node_end, int first, int end) {
+        int span = end - first;
+        std::vector<aabb> boxes(span);
+        std::vector<int> order(span);
+        for (int i = 0; i < span; ++i) {
+            boxes[i] = reference_box(first + i, prims[first + i]->bounding_box());
+            order[i] = i;
+        }
+
+        LinearBVHNodeArray subtree;
+        subtree.reserve(node_end - root);
+        build_recursive(subtree, order, boxes, 0, span);
+        if (int(subtree.size()) != node_end - root)
+            return false;
+        for (size_t i = 0; i < subtree.size(); ++i) {
+            LinearBVHNode node = subtree[i];
+            node.offset += node.count > 0 ? first : root;
+            owned_nodes[root + i] = node;
+        }
+
+        std::vector<shared_ptr<Hittable>> moved(span);
+        std::vector<int> moved_order(span);
+        for (int i = 0; i < span; ++i) {
+            moved[i] = prims[first + order[i]];
+            moved_order[i] = prim_order[first + order[i]];
+        }
+        std::copy(moved.begin(), moved.end(), prims.begin() + first);
+        std::copy(moved_order.begin(), moved_order.end(), prim_order.begin() + first);
+        if (!ref_boxes.empty()) {
+            std::vector<aabb> moved_boxes(span);
+            for (int i = 0; i < span; ++i)
+                moved_boxes[i] = ref_boxes[first + order[i]];
+            std::copy(moved_boxes.begin(), moved_boxes.end(), ref_boxes.begin() + first);
+        }
+        return true;
+    }
+
+    // per node SAH cost of its subtree, relative to a ray that hits the node bounds
+    void subtree_costs(const LinearBVHNode* tree, std::vector<float>& cost) const {
+        std::vector<float> weighted(num_nodes);    // cost times surface area
+        cost.assign(num_nodes, 0.f);
+        for (int i = num_nodes - 1; i >= 0; --i) {
+            const LinearBVHNode& node = tree[i];
+            // moving nodes are measured half way through the shutter interval
+            float area = close_boxes.empty() ? node.bbox.surface_area()
+                                             : lerp_box(node.bbox, close_boxes[i], 0.5f).surface_area();
+            if (node.count > 0)
+                weighted[i] = area * intersection_cost * node.count;
+            else
+                weighted[i] = area * traversal_cost + weighted[left_child(node, i)] + weighted[node.offset];
+            cost[i] = area > 0.f ? weighted[i] / area : 0.f;
+        }
+    }
+
+    // refit() of a tree without motion, false as soon as a primitive turns out to move
+    bool refit_static() {
+        for (int i = num_nodes - 1; i >= 0; --i) {
+            LinearBVHNode& node = owned_nodes[i];
+            if (node.count > 0) {
+                node.bbox = aabb::empty;
+                for (int p = node.offset; p < node.offset + node.count; ++p) {
+                    aabb a, b;
+                    prims[p]->linear_bounds(a, b);
+                    if (!same_box(a, b))
+                        return false;
+                    node.bbox = aabb(node.bbox, a);
+                }
+            } else {
+                node.bbox = aabb(owned_nodes[left_child(node, i)].bbox, owned_nodes[node.offset].bbox);
+            }
+        }
+        return true;
+    }
+
+    static bool same_box(const aabb& a, const aabb& b) {
+        return a.x.min == b.x.min && a.x.max == b.x.max && a.y.min == b.y.min && a.y.max == b.y.max &&
+               a.z.min == b.z.min && a.z.max == b.z.max;
+    }
+
+    struct TraversalEntry {
+        int node;
+        float entry;    // where the ray enters the box of the node
+    };
+
+    bool node_hit(const aabb* close, int i, const Ray& ray, const Interval& ray_t, float& entry) const {
+        return close ? lerp_box(nodes[i].bbox, close[i], ray.time()).hit(ray, ray_t, entry)
+                     : nodes[i].bbox.hit(ray, ray_t, entry);
+    }
+
+    void find_splittable() {
+        aabb part;
+        splittable = true;
+        for (const auto& prim : prims)
+            splittable = splittable && prim->clipped_bounds(prim->bounding_box(), part);
+    }
+
+    static int left_child(const LinearBVHNode& node, int index) {
+        return node.count == 0 ? index + 1 : -node.count;
+    }
+
+    void depth_first_order(std::vector<int>& order) const {
+        order.clear();
+        if (num_nodes == 0) return;
+        order.reserve(num_nodes);
+        std::vector<int> stack(1, 0);
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            order.push_back(i);
+            if (nodes[i].count <= 0) {
+                stack.push_back(nodes[i].offset);
+                stack.push_back(left_child(nodes[i], i));
+            }
+        }
+    }
+
+    // pages filled greedily by surface area, so the nodes of a page are the likeliest ones below its root;
+    // within the page they are written depth first, the left child still shares the cache line of its parent
+    void treelet_order(std::vector<int>& order) const {
+        const size_t page_nodes = treelet_bytes / sizeof(LinearBVHNode);
+        order.clear();
+        if (num_nodes == 0) return;
+        order.reserve(num_nodes);
+        std::vector<int> treelet_of(num_nodes, -1);
+        std::vector<int> roots(1, 0);
+        std::priority_queue<std::pair<float, int>> frontier;
+        std::vector<std::pair<float, int>> rest;
+        std::vector<int> stack;
+        for (int treelet = 0; !roots.empty(); ++treelet) {
+            int root = roots.back();
+            roots.pop_back();
+            frontier.push(std::make_pair(nodes[root].bbox.surface_area(), root));
+            // the rest of the current page, a small subtree leaves room for the next treelet
+            size_t room = page_nodes - order.size() % page_nodes;
+            for (; room > 0 && !frontier.empty(); --room) {
+                int i = frontier.top().second;
+                frontier.pop();
+                treelet_of[i] = treelet;
+                if (nodes[i].count <= 0) {
+                    int left = left_child(nodes[i], i);
+                    frontier.push(std::make_pair(nodes[left].bbox.surface_area(), left));
+                    frontier.push(std::make_pair(nodes[nodes[i].offset].bbox.surface_area(), nodes[i].offset));
+                }
+            }
+            stack.assign(1, root);
+            while (!stack.empty()) {
+                int i = stack.back();
+                stack.pop_back();
+                order.push_back(i);
+                if (nodes[i].count <= 0) {
+                    if (treelet_of[nodes[i].offset] == treelet)
+                        stack.push_back(nodes[i].offset);
+                    if (treelet_of[left_child(nodes[i], i)] == treelet)
+                        stack.push_back(left_child(nodes[i], i));
+                }
+            }
+            // the nodes that did not fit root the following treelets, the largest first
+            rest.clear();
+            for (; !frontier.empty(); frontier.pop())
+                rest.push_back(frontier.top());
+            for (auto it = rest.rbegin(); it != rest.rend(); ++it)
+                roots.push_back(it->second);
+        }
+    }
+
+    // node order[i] moves to index i, together with its per node data
+    void reorder_nodes(const std::vector<int>& order) {
+        std::vector<int> index(num_nodes);
+        for (int i = 0; i < num_nodes; ++i)
+            index[order[i]] = i;
+        LinearBVHNodeArray moved(num_nodes);
+        for (int i = 0; i < num_nodes; ++i) {
+            const LinearBVHNode& node = nodes[order[i]];
+            moved[i] = node;
+            if (node.count <= 0) {
+                int left = index[left_child(node, order[i])];
+                moved[i].offset = index[node.offset];
+                moved[i].count = left == i + 1 ? 0 : -left;
+            }
+        }
+        owned_nodes.swap(moved);
+        nodes = owned_nodes.data();
+        backing.reset();
+        permute(close_boxes, order);
+        permute(built_cost, order);
+    }
+
+    template <typename T>
+    void permute(std::vector<T>& per_node, const std::vector<int>& order) const {
+        if (per_node.size() != size_t(num_nodes)) return;
+        std::vector<T> moved(num_nodes);
+        for (int i = 0; i < num_nodes; ++i)
+            moved[i] = per_node[order[i]];
+        per_node.swap(moved);
+    }
+
+    // bounds of reference 'p' whose object has bounds 'current' now, clipped if the object is where it was
+    // when spatial splits clipped it
+    aabb reference_box(int p, const aabb& current) const {
+        if (ref_boxes.empty() || !same_box(current, built_boxes[prim_order[p]]))
+            return current;
+        return ref_boxes[p];
+    }
+
+    // every object once, while spatial splits may put it into several leaves
+    std::vector<shared_ptr<Hittable>> unique_objects() const {
+        if (prims.size() == num_objects)
+            return prims;
+        std::vector<shared_ptr<Hittable>> objects(num_objects);
+        for (size_t i = 0; i < prims.size(); ++i)
+            objects[prim_order[i]] = prims[i];
+        return objects;
+    }
+
+    void own_nodes() {
+        if (nodes != owned_nodes.data()) {
+            owned_nodes.assign(nodes, nodes + num_nodes);
+            nodes = owned_nodes.data();
+            backing.reset();
+        }
+    }
+
+    bool hit_leaf(int first, int count, const Ray& ray, Interval& ray_t, HitRecord& rec) const {
+        bool hit_anything = false;
+        for (int i = first; i < first + count; ++i) {
+            if (prims[i]->hit(ray, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+                rec.object_id = prim_order[i];
+            }
+        }
+        return hit_anything;
+    }
+
+    // the same traversal as hit(), every node is decoded within the box of its parent on the way down
+    template <typename T>
+    bool hit_quantized(const std::vector<QuantizedBVHNode<T>>& packed, const Ray& ray, Interval ray_t,
+                       HitRecord& rec) const {
+        TraversalEntry stack[max_depth];
+        QuantizedFrame frames[max_depth];      // decoded box of each node on the stack
+        int stack_size = 0;
+        int current = 0;
+        float entry;
+        bool hit_anything = false;
+        STAT_INC(bvh_nodes_visited);
+        aabb box = decode(frame_of<T>(root_frame), packed[0]);
+        if (!box.hit(ray, ray_t, entry)) return false;
+        QuantizedFrame frame = frame_of<T>(box);
+        while (true) {
+            const QuantizedBVHNode<T>& node = packed[current];
+            if (node.count > 0) {
+                hit_anything |= hit_leaf(node.offset, node.count, ray, ray_t, rec);
+            } else {
+                float left_entry, right_entry;
+                STAT_INC(bvh_nodes_visited);
+                STAT_INC(bvh_nodes_visited);
+                aabb left = decode(frame, packed[current + 1]);
+                aabb right = decode(frame, packed[node.offset]);
+                bool hit_left = left.hit(ray, ray_t, left_entry);
+                bool hit_right = right.hit(ray, ray_t, right_entry);
+                if (hit_left && hit_right) {
+                    bool right_first = right_entry < left_entry;
+                    stack[stack_size].node = right_first ? current + 1 : node.offset;
+                    stack[stack_size].entry = right_first ? left_entry : right_entry;
+                    frames[stack_size++] = frame_of<T>(right_first ? left : right);
+                    frame = frame_of<T>(right_first ? right : left);
+                    current = right_first ? node.offset : current + 1;
+                    continue;
+                }
+                if (hit_left || hit_right) {
+                    frame = frame_of<T>(hit_left ? left : right);
+                    current = hit_left ? current + 1 : node.offset;
+                    continue;
+                }
+            }
+            while (stack_size > 0 && stack[stack_size - 1].entry >= ray_t.max)
+                --stack_size;
+            if (stack_size == 0) break;
+            --stack_size;
+            current = stack[stack_size].node;
+            frame = frames[stack_size];
+        }
+        return hit_anything;
+    }
+
+    // a decoded box with the size of its cells, plain floats so that the traversal stack is not initialized
+    struct QuantizedFrame {
+        float min[3], max[3], step[3];
+    };
+
+    template <typename T>
+    static QuantizedFrame frame_of(const aabb& box) {
+        QuantizedFrame f;
+        for (int a = 0; a < 3; ++a) {
+            const Interval& i = box.axis_interval(a);
+            f.min[a] = i.min;
+            f.max[a] = i.max;
+            f.step[a] = (i.max - i.min) * (1.f / float(std::numeric_limits<T>::max()));
+        }
+        return f;
+    }
+
+    // encoding and decoding must round the cell boundaries the same way
+    static float cell_above(const QuantizedFrame& f, int a, int cells) { return f.min[a] + float(cells) * f.step[a]; }
+    static float cell_below(const QuantizedFrame& f, int a, int cells) { return f.max[a] - float(cells) * f.step[a]; }
+
+    template <typename T>
+    static aabb decode(const QuantizedFrame& f, const QuantizedBVHNode<T>& node) {
+        aabb box;
+        box.x = Interval(cell_above(f, 0, node.lo[0]), cell_below(f, 0, node.hi[0]));
+        box.y = Interval(cell_above(f, 1, node.lo[1]), cell_below(f, 1, node.hi[1]));
+        box.z = Interval(cell_above(f, 2, node.lo[2]), cell_below(f, 2, node.hi[2]));
+        return box;
+    }
+
+    // whole cells outside 'bounds', stepping back where rounding put the boundary inside
+    template <typename T>
+    static void encode(const QuantizedFrame& f, const aabb& bounds, QuantizedBVHNode<T>& node) {
+        const float max_cells = float(std::numeric_limits<T>::max());
+        for (int a = 0; a < 3; ++a) {
+            const Interval& b = bounds.axis_interval(a);
+            int lo = 0, hi = 0;
+            if (f.step[a] > 0.f) {
+                lo = int(std::min(std::max((b.min - f.min[a]) / f.step[a], 0.f), max_cells));
+                hi = int(std::min(std::max((f.max[a] - b.max) / f.step[a], 0.f), max_cells));
+                while (lo > 0 && cell_above(f, a, lo) > b.min) --lo;
+                while (hi > 0 && cell_below(f, a, hi) < b.max) --hi;
+            }
+            node.lo[a] = T(lo);
+            node.hi[a] = T(hi);
+        }
+    }
+
+    // nodes are stored after their parent, so each one is encoded within the already decoded parent
+    template <typename T>
+    void quantize(std::vector<QuantizedBVHNode<T>>& packed) const {
+        packed.resize(num_nodes);
+        std::vector<QuantizedFrame> frames(num_nodes);
+        frames[0] = frame_of<T>(root_frame);
+        for (int i = 0; i < num_nodes; ++i) {
+            const LinearBVHNode& node = nodes[i];
+            QuantizedBVHNode<T>& q = packed[i];
+            encode(frames[i], node.bbox, q);
+            q.offset = uint32_t(node.offset);
+            q.count = uint32_t(node.count);
+            if (node.count == 0)
+                frames[i + 1] = frames[node.offset] = frame_of<T>(decode(frames[i], q));
+        }
+    }
+
+    template <typename T>
+    void dequantize(const std::vector<QuantizedBVHNode<T>>& packed, LinearBVHNodeArray& out) const {
+        out.resize(num_nodes);
+        std::vector<QuantizedFrame> frames(num_nodes);
+        frames[0] = frame_of<T>(root_frame);
+        for (int i = 0; i < num_nodes; ++i) {
+            out[i].bbox = decode(frames[i], packed[i]);
+            out[i].offset = int(packed[i].offset);
+            out[i].count = int(packed[i].count);
+            if (out[i].count == 0)
+                frames[i + 1] = frames[out[i].offset] = frame_of<T>(out[i].bbox);
+        }
+    }
+
+    // back to float nodes, with the decoded bounds; returns the format the nodes had
+    NodeFormat unpack_nodes() {
+        NodeFormat packed = format;
+        if (format == QUANTIZED_16)
+            dequantize(nodes16, owned_nodes);
+        else if (format == QUANTIZED_8)
+            dequantize(nodes8, owned_nodes);
+        if (format != FLOAT_NODES) {
+            std::vector<QuantizedBVHNode<uint16_t>>().swap(nodes16);
+            std::vector<QuantizedBVHNode<uint8_t>>().swap(nodes8);
+            nodes = owned_nodes.data();
+            format = FLOAT_NODES;
+        }
+        return packed;
+    }
+};
+
 #endif
@@ -18,6 +18,7 @@ public:
           phase_function(make_shared<Isotropic>(albedo)) {}
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        STAT_INC(medium_tests);
         HitRecord rec1, rec2;
         
         // 注意这里先用无限区间判断是否与边界相交，再用ray_t区间约束交点
@@ -45,6 +46,7 @@ public:
 
         rec.normal = Vec3f(1.f, 0.f, 0.f);  // arbitrary
         rec.front_face = true;
+        rec.footprint = 0.f;
         rec.mat = phase_function;
 
         return true;
@@ -54,6 +56,16 @@ public:
         return boundary->bounding_box();
     }
 
+    // a second test in another leaf would draw a second scattering distance
+    bool clipped_bounds(const aabb& region, aabb& clipped) const override {
+        clipped = overlap(bounding_box(), region);
+        return false;
+    }
+
+    void linear_bounds(aabb& open, aabb& close) const override {
+        boundary->linear_bounds(open, close);
+    }
+
     void translate(const Vec3f& offset) override {
         boundary->translate(offset);
     }
@@ -0,0 +1,13 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <vector>
+
+// 自带的 zlib 格式压缩器(固定 Huffman 码 + 哈希链 LZ77)，供 PNG 写出使用。
+// 输入被切成若干块并行压缩，块之间以 sync flush (空的 stored block) 对齐到字节后直接拼接，
+// 块内的匹配不跨越块边界，压缩率略有损失。
+//   level 0: stored only, 1..9: longer hash chains, better ratio
+std::vector<unsigned char> zlib_compress(const unsigned char* data, size_t size, int level, int threads);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "float_image.h"
+#include "aov.h"
+
+// 边缘保持的 à-trous 小波滤波 (Dammertz et al. 2010)，由 albedo / normal / depth AOV 引导。
+// 先除以 albedo 得到近似的光照项，滤波后再乘回，纹理细节因此不会被抹平。
+// 颜色边缘按局部噪声标准差归一化 (同 SVGF)，方差随每轮滤波一起传播，孤立的高亮噪点也能被平滑。
+struct DenoiseSettings {
+    int iterations = 5;         // filter widths 5, 9, 17, 33, 65 pixels
+    float sigma_color = 4.0f;   // luminance difference in standard deviations of the local noise
+    float sigma_normal = 0.1f;  // 1 - dot(n_p, n_q)
+    float sigma_depth = 0.02f;  // depth difference relative to the center depth
+};
+
+// filter the RGB channels of 'color' in place; missing AOVs simply do not guide the filter
+void denoise(FloatImage& color, const AOVBuffers& aovs, const DenoiseSettings& settings, int threads);
+
+#endif
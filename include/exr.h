@@ -0,0 +1,26 @@
+#ifndef EXR_H
+#define EXR_H
+
+#include <string>
+#include <vector>
+#include "float_image.h"
+
+// 最小的 OpenEXR 扫描线文件写出器，支持无压缩与 RLE 压缩，half 或 float 像素。
+enum class ExrCompression { NONE = 0, RLE = 1 };
+enum class ExrPixelType { HALF = 1, FLOAT = 2 };
+
+struct ExrChannel {
+	std::string name;		// e.g. "R", or "albedo.R" for a layer
+	const FloatImage *image;
+	int component;			// channel of 'image' stored under 'name'
+};
+
+// all channel images must share the same size; returns false on I/O failure
+bool write_exr(const char *filename, std::vector<ExrChannel> channels,
+			   ExrCompression compression, ExrPixelType pixel_type, int threads = 0);
+
+// R, G, B (and A for 4-channel images) of a single image
+bool write_exr(const char *filename, const FloatImage &image,
+			   ExrCompression compression, ExrPixelType pixel_type, int threads = 0);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "filter.h"
+#include "float_image.h"
+
+// 图块的局部胶片缓冲：覆盖图块本身并向外扩展滤波半径，相邻图块的缓冲互相重叠。
+struct FilmTile {
+    int x0 = 0, y0 = 0;             // first pixel of the region
+    int width = 0, height = 0;
+    std::vector<Vec4f> pixels;      // filter weighted RGB sum, weight sum in w
+};
+
+// 样本按重建滤波器溅射(splat)到周围像素。每个图块只由一个线程写入自己的 FilmTile，
+// 渲染结束后 develop() 按图块序号依次累加，无需加锁，结果也与线程调度无关。
+class Film {
+public:
+    Film(int width, int height, int tile_size, shared_ptr<Filter> filter);
+
+    // clear and return the buffer of tile 'index', only one thread may use a tile at a time
+    FilmTile& begin_tile(int index);
+
+    // add radiance 'L' sampled at (fx, fy) in [0, 1)^2 inside pixel (i, j); keeping the pixel index
+    // separate avoids rounding a sample into the neighbouring pixel
+    void add_sample(FilmTile& tile, int i, int j, float fx, float fy, const Color3f& L) const;
+
+    // mark tile 'index' finished, it is not written again and may be read by a concurrent develop()
+    void end_tile(int index) { done[index].store(true, std::memory_order_release); }
+
+    // merge all tiles and write the normalized RGB (alpha 1) to 'image'; with 'finished_only'
+    // tiles still being rendered are skipped, which is safe while the render is running
+    void develop(FloatImage& image, int threads, bool finished_only = false) const;
+
+private:
+    static const int table_size = 64;
+
+    int width, height;
+    int tile_size;
+    int tiles_x, tiles_y;
+    int grow;                       // pixels a tile region extends past the tile
+    float radius;
+    float table_scale;
+    float table[table_size];        // the 1D filter sampled on [0, radius]
+    std::vector<FilmTile> tiles;
+    std::unique_ptr<std::atomic<bool>[]> done;
+
+    float weight(float d) const {
+        return table[std::min(table_size - 1, int(std::fabs(d) * table_scale))];
+    }
+};
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include "rtweekend.h"
+
+// 像素重建滤波器，均为可分离的 f(x, y) = f(x) * f(y)，x、y 为样本到像素中心的偏移(像素)。
+class Filter {
+public:
+    explicit Filter(float radius) : radius(radius) {}
+    virtual ~Filter() = default;
+
+    virtual float evaluate_1d(float x) const = 0;
+
+    float evaluate(float x, float y) const {
+        return evaluate_1d(x) * evaluate_1d(y);
+    }
+
+    float radius;
+};
+
+// the old behaviour: every sample counts once for the pixel it falls in
+class BoxFilter : public Filter {
+public:
+    BoxFilter(float radius = 0.5f) : Filter(radius) {}
+
+    float evaluate_1d(float x) const override {
+        return std::fabs(x) <= radius ? 1.f : 0.f;
+    }
+};
+
+// truncated gaussian shifted down so that it reaches 0 at the radius
+class GaussianFilter : public Filter {
+public:
+    GaussianFilter(float radius = 1.5f, float alpha = 2.f)
+        : Filter(radius), alpha(alpha), edge(std::exp(-alpha * radius * radius)) {}
+
+    float evaluate_1d(float x) const override {
+        return std::max(0.f, std::exp(-alpha * x * x) - edge);
+    }
+
+private:
+    float alpha;
+    float edge;
+};
+
+// Mitchell-Netravali cubic, negative lobes sharpen slightly; B = C = 1/3 is the recommended pair
+class MitchellFilter : public Filter {
+public:
+    MitchellFilter(float radius = 2.f, float B = 1.f / 3, float C = 1.f / 3) : Filter(radius), B(B), C(C) {}
+
+    float evaluate_1d(float x) const override {
+        x = std::fabs(2.f * x / radius);
+        if (x > 2.f) return 0.f;
+        if (x > 1.f)
+            return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+                    (-12 * B - 48 * C) * x + (8 * B + 24 * C)) * (1.f / 6.f);
+        return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x +
+                (6 - 2 * B)) * (1.f / 6.f);
+    }
+
+private:
+    float B, C;
+};
+
+// 4-term Blackman-Harris window centered on the pixel, very low sidelobes
+class BlackmanHarrisFilter : public Filter {
+public:
+    BlackmanHarrisFilter(float radius = 2.f) : Filter(radius) {}
+
+    float evaluate_1d(float x) const override {
+        if (std::fabs(x) > radius) return 0.f;
+        float t = pi * x / radius;
+        return 0.35875f + 0.48829f * std::cos(t) + 0.14128f * std::cos(2.f * t) + 0.01168f * std::cos(3.f * t);
+    }
+};
+
+// "box", "gaussian", "mitchell" or "blackman-harris"; radius <= 0 keeps the filter's default, nullptr for unknown names
+inline shared_ptr<Filter> make_filter(const std::string& name, float radius = 0.f) {
+    if (name == "box") return radius > 0.f ? make_shared<BoxFilter>(radius) : make_shared<BoxFilter>();
+    if (name == "gaussian") return radius > 0.f ? make_shared<GaussianFilter>(radius) : make_shared<GaussianFilter>();
+    if (name == "mitchell") return radius > 0.f ? make_shared<MitchellFilter>(radius) : make_shared<MitchellFilter>();
+    if (name == "blackman-harris")
+        return radius > 0.f ? make_shared<BlackmanHarrisFilter>(radius) : make_shared<BlackmanHarrisFilter>();
+    return nullptr;
+}
@@ -0,0 +1,49 @@
+#ifndef FLOAT_IMAGE_H
+#define FLOAT_IMAGE_H
+
+#include <vector>
+#include "geometry.h"
+#include "image.h"
+
+// 线性浮点帧缓冲，每像素 channels 个 float，按行优先存放，第 0 行在图像顶部。
+class FloatImage {
+public:
+	FloatImage() : width(0), height(0), channels(0) {}
+	FloatImage(int w, int h, int channels);
+
+	int get_width() const { return width; }
+	int get_height() const { return height; }
+	int get_channels() const { return channels; }
+
+	float *pixel(int x, int y) { return &data[(size_t(y) * width + x) * channels]; }
+	const float *pixel(int x, int y) const { return &data[(size_t(y) * width + x) * channels]; }
+	float *buffer() { return data.data(); }
+	const float *buffer() const { return data.data(); }
+
+	// missing channels read as 0 (alpha as 1), extra channels are ignored
+	Vec4f get(int x, int y) const;
+	void set(int x, int y, const Vec4f &c);
+	void clear();
+
+	// Portable Float Map, 1 channel as "Pf", otherwise RGB as "PF"
+	bool write_pfm(const char *filename) const;
+	bool read_pfm(const char *filename);
+
+private:
+	int width;
+	int height;
+	int channels;
+	std::vector<float> data;
+};
+
+struct ToneMapSettings {
+	enum Operator { CLAMP, REINHARD, ACES };
+	Operator op = CLAMP;
+	float exposure = 0.f;		// stops
+	float gamma = 2.f;
+};
+
+// expose, tone map and gamma encode 'hdr' into the 8-bit 'ldr' of the same size
+void tonemap(const FloatImage &hdr, Image &ldr, const ToneMapSettings &settings, int threads);
+
+#endif
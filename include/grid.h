@@ -0,0 +1,260 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "aabb.h"
+#include "accelerator.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// 均匀网格：把包围盒分成大小相同的格子，每个格子记录与它重叠的基元，光线用 3D-DDA 逐格前进
+// (Amanatides & Woo)，格子里的交点落在格子之内即可结束。格子数约为基元数的 cell_density 倍，
+// 按包围盒的长宽比分到三个轴上。多层：基元多于 max_cell_size 且比格子小的格子内再建一层网格，
+// 物体分布不均时在稠密处加密。跨格子的基元在每个格子里各有一个引用，最近测过的基元记在
+// 一个小的邮箱里，相邻格子里不再重复测试。
+class UniformGrid : public SpatialAccelerator {
+public:
+    UniformGrid(const HittableList& hittable_list) : SpatialAccelerator(hittable_list) {
+        build();
+    }
+
+    Type type() const override { return GRID; }
+
+    size_t memory_bytes() const override {
+        size_t bytes = (entries.size() + unsplit.size()) * sizeof(int);
+        for (const auto& level : levels)
+            bytes += sizeof(GridLevel) + level.cells.size() * sizeof(GridCell);
+        return bytes;
+    }
+
+    // the top level and the nested grids
+    int level_count() const { return int(levels.size()); }
+    int cell_count() const {
+        int cells = 0;
+        for (const auto& level : levels)
+            cells += int(level.cells.size());
+        return cells;
+    }
+
+protected:
+    bool hit_structure(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
+        Interval range = ray_t;
+        if (levels.empty() || !levels[0].bounds.clip(ray, range))
+            return false;
+        Mailbox mailbox;
+        return hit_level(0, ray, range.min, range.max, ray_t, rec, mailbox);
+    }
+
+private:
+    static constexpr float cell_density = 4.f;      // cells per object
+    static const int max_resolution = 256;          // per axis
+    static const int max_cell_size = 16;            // objects in a cell before it gets a nested grid
+    static const int max_depth = 2;                 // nested levels below the top one
+    static constexpr float cell_margin = 1e-3f;     // of a cell, against rounding at the cell boundaries
+
+    struct GridCell {
+        int first;      // objects: first of them in 'entries'; nested grid: its index in 'levels'
+        int count;      // objects in the cell, -1 for a nested grid
+    };
+
+    struct GridLevel {
+        aabb bounds;
+        int res[3];
+        float cell_size[3], inv_cell_size[3];
+        std::vector<GridCell> cells;    // x fastest
+    };
+
+    // the objects tested last; skipping one is safe because ray_t only shrinks, a miss stays a miss and a hit
+    // is already in the record
+    struct Mailbox {
+        static const int size = 8;
+        int ids[size];
+        int next = 0;
+
+        Mailbox() { std::fill(ids, ids + size, -1); }
+
+        bool tested(int id) {
+            for (int i = 0; i < size; ++i)
+                if (ids[i] == id) return true;
+            ids[next] = id;
+            next = (next + 1) % size;
+            return false;
+        }
+    };
+
+    std::vector<GridLevel> levels;
+    std::vector<int> entries;       // object indices of the cells
+
+    // 3D-DDA through 'level' between 't_enter' and 't_exit', which lie inside its bounds
+    bool hit_level(int level, const Ray& ray, float t_enter, float t_exit, Interval& ray_t, HitRecord& rec,
+                   Mailbox& mailbox) const {
+        const GridLevel& g = levels[level];
+        int cell[3], step[3], out[3];
+        float next[3], delta[3];
+        for (int a = 0; a < 3; ++a) {
+            float origin = ray.origin()[a], dir = ray.direction()[a];
+            float min = g.bounds.axis_interval(a).min;
+            float p = origin + t_enter * dir;
+            cell[a] = std::min(std::max(int((p - min) * g.inv_cell_size[a]), 0), g.res[a] - 1);
+            if (dir > 0.f) {
+                next[a] = (min + float(cell[a] + 1) * g.cell_size[a] - origin) / dir;
+                delta[a] = g.cell_size[a] / dir;
+                step[a] = 1;
+                out[a] = g.res[a];
+            } else if (dir < 0.f) {
+                next[a] = (min + float(cell[a]) * g.cell_size[a] - origin) / dir;
+                delta[a] = -g.cell_size[a] / dir;
+                step[a] = -1;
+                out[a] = -1;
+            } else {
+                next[a] = INFINITY;
+                delta[a] = 0.f;
+                step[a] = 0;
+                out[a] = -1;
+            }
+        }
+
+        bool hit_anything = false;
+        float t_cell = t_enter;
+        while (true) {
+            STAT_INC(accel_cells_visited);
+            int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            float cell_exit = std::min(next[axis], t_exit);
+            const GridCell& c = g.cells[(cell[2] * g.res[1] + cell[1]) * g.res[0] + cell[0]];
+            if (c.count < 0) {
+                hit_anything |= hit_level(c.first, ray, t_cell, cell_exit, ray_t, rec, mailbox);
+            } else {
+                for (int i = c.first; i < c.first + c.count; ++i) {
+                    int id = entries[i];
+                    if (mailbox.tested(id)) continue;
+                    if (objects[id]->hit(ray, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                        rec.object_id = id;
+                    }
+                }
+            }
+            // a hit inside this cell is closer than anything in the cells after it
+            if (ray_t.max <= cell_exit || next[axis] >= t_exit) break;
+            cell[axis] += step[axis];
+            if (cell[axis] == out[axis]) break;
+            t_cell = next[axis];
+            next[axis] += delta[axis];
+        }
+        return hit_anything;
+    }
+
+    void build() override {
+        levels.clear();
+        entries.clear();
+        std::vector<int> refs;
+        std::vector<aabb> boxes;
+        aabb grid_bounds = partition(refs, boxes);
+        if (!refs.empty())
+            build_level(grid_bounds, refs, boxes, 0);
+    }
+
+    // returns the index of the new level, 'boxes' are the bounds of the references inside 'region'
+    int build_level(const aabb& region, const std::vector<int>& refs, const std::vector<aabb>& boxes, int depth) {
+        int index = int(levels.size());
+        levels.push_back(GridLevel());
+        GridLevel g;
+        g.bounds = region;
+        float volume = 1.f;
+        for (int a = 0; a < 3; ++a)
+            volume *= region.axis_interval(a).size();
+        float cells_per_unit = std::cbrt(cell_density * float(refs.size()) / volume);
+        for (int a = 0; a < 3; ++a) {
+            float size = region.axis_interval(a).size();
+            g.res[a] = std::min(std::max(int(size * cells_per_unit), 1), max_resolution);
+            g.cell_size[a] = size / float(g.res[a]);
+            g.inv_cell_size[a] = 1.f / g.cell_size[a];
+        }
+        size_t num_cells = size_t(g.res[0]) * size_t(g.res[1]) * size_t(g.res[2]);
+
+        // (cell, reference) pairs sorted by cell; the range of cells of a reference is widened by a sliver so
+        // that rounding never leaves an object out of a cell it touches, objects that only cross the corner of
+        // their range are dropped from the cells they do not reach
+        std::vector<std::pair<size_t, int>> pairs;
+        for (size_t r = 0; r < refs.size(); ++r) {
+            int lo[3], hi[3];
+            for (int a = 0; a < 3; ++a) {
+                float min = region.axis_interval(a).min;
+                const Interval& s = boxes[r].axis_interval(a);
+                lo[a] = std::min(std::max(int((s.min - min) * g.inv_cell_size[a] - cell_margin), 0), g.res[a] - 1);
+                hi[a] = std::min(std::max(int((s.max - min) * g.inv_cell_size[a] + cell_margin), 0), g.res[a] - 1);
+            }
+            bool spans = lo[0] != hi[0] || lo[1] != hi[1] || lo[2] != hi[2];
+            for (int z = lo[2]; z <= hi[2]; ++z)
+                for (int y = lo[1]; y <= hi[1]; ++y)
+                    for (int x = lo[0]; x <= hi[0]; ++x) {
+                        aabb part;
+                        if (spans && (!objects[refs[r]]->clipped_bounds(cell_box(g, x, y, z, cell_margin), part) ||
+                                      part.is_empty()))
+                            continue;
+                        pairs.push_back(std::make_pair((size_t(z) * g.res[1] + y) * g.res[0] + x, int(r)));
+                    }
+        }
+        std::sort(pairs.begin(), pairs.end());
+
+        g.cells.resize(num_cells);
+        std::vector<int> in_cell;
+        for (size_t c = 0, p = 0; c < num_cells; ++c) {
+            in_cell.clear();
+            for (; p < pairs.size() && pairs[p].first == c; ++p)
+                in_cell.push_back(pairs[p].second);
+            g.cells[c].first = int(entries.size());
+            g.cells[c].count = int(in_cell.size());
+            aabb region_c = cell_box(g, int(c % g.res[0]), int(c / g.res[0] % g.res[1]),
+                                     int(c / (size_t(g.res[0]) * g.res[1])), 0.f);
+            if (nested(region_c, in_cell, boxes, depth)) {
+                std::vector<int> sub_refs;
+                std::vector<aabb> sub_boxes;
+                for (int r : in_cell) {
+                    sub_refs.push_back(refs[r]);
+                    sub_boxes.push_back(overlap(boxes[r], region_c));
+                }
+                g.cells[c].first = build_level(region_c, sub_refs, sub_boxes, depth + 1);
+                g.cells[c].count = -1;
+                continue;
+            }
+            for (int r : in_cell)
+                entries.push_back(refs[r]);
+        }
+        levels[index] = g;
+        return index;
+    }
+
+    // a crowded cell is refined when its objects are small compared to it, a nested grid does not help
+    // objects that cover the whole cell anyway
+    bool nested(const aabb& cell, const std::vector<int>& in_cell, const std::vector<aabb>& boxes, int depth) const {
+        if (depth >= max_depth || int(in_cell.size()) <= max_cell_size) return false;
+        float covered = 0.f;
+        for (int r : in_cell) {
+            aabb part = overlap(boxes[r], cell);
+            covered += std::max(part.x.size(), 0.f) * std::max(part.y.size(), 0.f) * std::max(part.z.size(), 0.f);
+        }
+        return covered < 0.5f * float(in_cell.size()) * cell.x.size() * cell.y.size() * cell.z.size();
+    }
+
+    // widened by 'margin' cells on every side
+    static aabb cell_box(const GridLevel& g, int x, int y, int z, float margin) {
+        int cell[3] = {x, y, z};
+        Interval axes[3];
+        for (int a = 0; a < 3; ++a) {
+            float min = g.bounds.axis_interval(a).min;
+            axes[a] = Interval(min + (float(cell[a]) - margin) * g.cell_size[a],
+                               min + (float(cell[a] + 1) + margin) * g.cell_size[a]);
+        }
+        aabb box;
+        box.x = axes[0];
+        box.y = axes[1];
+        box.z = axes[2];
+        return box;
+    }
+};
+
+#endif
@@ -15,6 +15,8 @@ public:
     float u;
     float v;
     bool front_face;
+    int object_id = -1;     // index of the hit object in the top-level BVH
+    float footprint = 0.f;  // width of the ray cone in uv units, 0: sample the finest texture level
 
     // set the hit record normal direction
     void set_face_normal(const Ray &r, const Vec3f &outward_normal) {
@@ -23,6 +25,18 @@ public:
         normal = front_face ? outward_normal : -outward_normal;
     }
 
+    // project the ray cone onto the surface, 'uv_per_unit' is the uv change per unit of world length;
+    // call after t and the normal are set
+    void set_footprint(const Ray &r, float uv_per_unit) {
+        float width = r.cone_width_at(t);
+        if (width <= 0.f) {
+            footprint = 0.f;
+            return;
+        }
+        float cos_theta = std::max(std::abs(dot(r.direction(), normal)), 0.05f);
+        footprint = width * uv_per_unit / cos_theta;
+    }
+
 };
 
 class Hittable {
@@ -33,6 +47,19 @@ public:
 
     virtual aabb bounding_box() const = 0;
 
+    // bounds at shutter open (ray time 0) and close (ray time 1), at any time in between the object stays
+    // inside their linear interpolation; moving objects override this, BVH nodes store both
+    virtual void linear_bounds(aabb& open, aabb& close) const {
+        open = close = bounding_box();
+    }
+
+    // bounds of the part of the object inside 'region', used by spatial splits of the BVH, where one object
+    // can end up in several leaves; false if it has to stay in one leaf, e.g. when hit() is random
+    virtual bool clipped_bounds(const aabb& region, aabb& clipped) const {
+        clipped = overlap(bounding_box(), region);
+        return true;
+    }
+
     virtual void translate(const Vec3f& offset) = 0;
 
     virtual void rotate_y(float theta) = 0;
@@ -45,6 +45,28 @@ public:
         return bbox;
     }
 
+    void linear_bounds(aabb& open, aabb& close) const override {
+        open = close = aabb::empty;
+        for (const auto& object : objects) {
+            aabb a, b;
+            object->linear_bounds(a, b);
+            open = aabb(open, a);
+            close = aabb(close, b);
+        }
+    }
+
+    bool clipped_bounds(const aabb& region, aabb& clipped) const override {
+        clipped = aabb::empty;
+        for (const auto& object : objects) {
+            aabb part;
+            if (!object->clipped_bounds(region, part))
+                return false;
+            if (!part.is_empty())
+                clipped = aabb(clipped, part);
+        }
+        return true;
+    }
+
     void translate(const Vec3f& offset) override {
         for (auto &object : objects) {
             object->translate(offset);
@@ -53,7 +75,7 @@ public:
     }
 
     void rotate_y(float theta) override {
-        aabb bbox;
+        bbox = aabb::empty;
         for (auto& object : objects) {
             object->rotate_y(theta);
             bbox = aabb(bbox, object->bounding_box());
@@ -4,6 +4,11 @@
 #include <fstream>
 #include "color.h"
 
+struct ImageWriteOptions {
+	int png_level = 6;			// 0 (stored) .. 9, see zlib_compress()
+	int jpeg_quality = 90;
+	int threads = 0;			// PNG compression threads, 0: all hardware threads
+};
 
 class Image {
 protected:
@@ -11,6 +16,7 @@ protected:
 	int width;
 	int height;
 	int bytespp;
+	bool owns_data;
 
 public:
 	enum Format {
@@ -20,9 +26,14 @@ public:
 	Image();
     Image(int w, int h, int bpp);
 	Image(const char *filename);
+	// wrap external pixels without taking ownership, 'pixels' must outlive the image
+	Image(int w, int h, int bpp, unsigned char *pixels);
 	Image(const Image &img);
     void read_file(const char *filename);
 	void write_png_file(const char *filename);
+	// format is one of "png", "jpg", "bmp", "tga", "qoi"; encoded in memory and written with
+	// write_file_atomic, so a preview being rewritten is never read half written; returns false on failure
+	bool write_file(const char *filename, const char *format, const ImageWriteOptions &options = ImageWriteOptions());
 	Color get(int x, int y);
 	bool set(int x, int y, const Color &c);
 	~Image();
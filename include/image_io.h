@@ -0,0 +1,20 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <vector>
+
+// 8 位图像的编码器：并行压缩的 PNG 与用于快速预览的 QOI (https://qoiformat.org)。
+// pixels 为 channels (1..4) 字节交错、按行优先存放的数据。
+
+// PNG with the per-row filter chosen by the minimum sum of absolute differences;
+// rows are filtered and deflate chunks compressed in parallel, level 0..9 as zlib
+std::vector<unsigned char> encode_png(const unsigned char* pixels, int width, int height, int channels,
+                                      int level, int threads);
+
+// QOI, gray images are expanded to RGB(A)
+std::vector<unsigned char> encode_qoi(const unsigned char* pixels, int width, int height, int channels);
+
+// write to 'filename.tmp' first and rename, readers never see a half written file
+bool write_file_atomic(const char* filename, const std::vector<unsigned char>& bytes);
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <vector>
+#include "hittable.h"
+#include "transform.h"
+
+// 实例：引用一份共享的几何(通常是原型的 BVH，即 BLAS)并附带一个仿射变换。
+// 求交时把光线变换到物体空间，而不是复制并移动几何；交点、法线再变换回世界空间。
+// 场景的顶层 BVH 以实例为基元，即 TLAS。
+// 运动模糊：变换可以是快门时间内等间隔的若干个采样，相邻采样之间按光线的时间线性插值；
+// 分段越多，插值得到的矩阵越接近真实的旋转。
+class Instance : public Hittable {
+public:
+    Instance(shared_ptr<Hittable> object, const Transform& object_to_world) : object(object), to_world(object_to_world) {
+        update();
+    }
+
+    bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
+        STAT_INC(instance_tests);
+        if (motion.empty())
+            return hit_with(ray, ray_t, rec, to_world, to_object, cone_scale);
+        Transform m = pose(ray.time());
+        Transform inv = m.inverse();
+        return hit_with(ray, ray_t, rec, m, inv, std::cbrt(std::abs(inv.determinant())));
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    void linear_bounds(aabb& open, aabb& close) const override {
+        open = open_box;
+        close = close_box;
+    }
+
+    // refused when the geometry refuses, the box is not clipped any further than the world space bounds
+    bool clipped_bounds(const aabb& region, aabb& clipped) const override {
+        aabb local;
+        clipped = overlap(bbox, region);
+        return object->clipped_bounds(object->bounding_box(), local);
+    }
+
+    void translate(const Vec3f& offset) override {
+        to_world = Transform::translate(offset) * to_world;
+        for (auto& m : motion)
+            m = Transform::translate(offset) * m;
+        update();
+    }
+
+    // about the world y axis through the origin, not the center of the instance
+    void rotate_y(float theta) override {
+        to_world = Transform::rotate(Vec3f(0.f, 1.f, 0.f), theta) * to_world;
+        for (auto& m : motion)
+            m = Transform::rotate(Vec3f(0.f, 1.f, 0.f), theta) * m;
+        update();
+    }
+
+    // replaces the transform, animation moves the instance this way every frame
+    void set_object_to_world(const Transform& object_to_world) {
+        to_world = object_to_world;
+        motion.clear();
+        update();
+    }
+
+    // transforms at ray times i / (n - 1), a single one is the same as set_object_to_world()
+    void set_motion(const std::vector<Transform>& samples) {
+        to_world = samples.front();
+        motion.clear();
+        if (samples.size() > 1)
+            motion = samples;
+        update();
+    }
+
+    const shared_ptr<Hittable>& prototype() const { return object; }
+    // at ray time 0
+    const Transform& object_to_world() const { return to_world; }
+    // empty when the instance does not move
+    const std::vector<Transform>& motion_samples() const { return motion; }
+
+private:
+    shared_ptr<Hittable> object;
+    Transform to_world;
+    Transform to_object;
+    std::vector<Transform> motion;
+    aabb bbox;
+    aabb open_box, close_box;   // the instance stays inside their interpolation at any ray time
+    float cone_scale;       // object units per world unit, geometric mean over the axes
+
+    bool hit_with(const Ray &ray, Interval ray_t, HitRecord &rec, const Transform& world, const Transform& local_space,
+                  float local_cone_scale) const {
+        // Ray keeps its direction normalized, so distances along the object space ray differ by 'scale'
+        Vec3f dir = local_space.vector(ray.direction());
+        float scale = dir.norm();
+        Ray local(local_space.point(ray.origin()), dir, ray.time());
+        local.set_cone(ray.cone_width() * local_cone_scale, ray.cone_spread() * local_cone_scale / scale);
+
+        if (!object->hit(local, Interval(ray_t.min * scale, ray_t.max * scale), rec))
+            return false;
+        rec.t /= scale;
+        rec.p = world.point(rec.p);
+        // the normal faces the object space ray and its transpose-inverse image faces the world ray
+        rec.normal = local_space.transposed_vector(rec.normal).unit();
+        return true;
+    }
+
+    Transform pose(float time) const {
+        int n = int(motion.size()) - 1;
+        float x = std::min(std::max(time, 0.f), 1.f) * n;
+        int i = std::min(int(x), n - 1);
+        return Transform::lerp(motion[i], motion[i + 1], x - float(i));
+    }
+
+    void update() {
+        to_object = to_world.inverse();
+        cone_scale = std::cbrt(std::abs(to_object.determinant()));
+        aabb local = object->bounding_box();
+        if (motion.empty()) {
+            bbox = open_box = close_box = to_world.box(local);
+            return;
+        }
+
+        // a point moves linearly between two samples, so it stays inside the interpolation of their boxes;
+        // the line from the first box to the last is moved outwards until it covers every sample
+        int n = int(motion.size()) - 1;
+        std::vector<aabb> boxes(motion.size());
+        bbox = aabb::empty;
+        for (int i = 0; i <= n; ++i) {
+            boxes[i] = motion[i].box(local);
+            bbox = aabb(bbox, boxes[i]);
+        }
+        Interval open[3], close[3];
+        for (int a = 0; a < 3; ++a) {
+            const Interval& first = boxes[0].axis_interval(a);
+            const Interval& last = boxes[n].axis_interval(a);
+            float below = 0.f, above = 0.f;
+            for (int i = 1; i < n; ++i) {
+                float t = float(i) / float(n);
+                const Interval& s = boxes[i].axis_interval(a);
+                below = std::max(below, first.min + t * (last.min - first.min) - s.min);
+                above = std::max(above, s.max - (first.max + t * (last.max - first.max)));
+            }
+            open[a] = Interval(first.min - below, first.max + above);
+            close[a] = Interval(last.min - below, last.max + above);
+        }
+        open_box = aabb(open[0], open[1], open[2]);
+        close_box = aabb(close[0], close[1], close[2]);
+    }
+};
+
+#endif
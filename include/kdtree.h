@@ -0,0 +1,242 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include "aabb.h"
+#include "accelerator.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// 8 字节的 kd-tree 节点，低两位为划分轴(3 为叶子)
+struct KdTreeNode {
+    union {
+        float split;    // interior: position of the plane
+        int first;      // leaf: first of its entries in KdTree::entries
+    };
+    uint32_t bits;      // above the axis bits: interior: index of the child above the plane, the one below
+                        // follows the node; leaf: number of entries
+
+    bool leaf() const { return (bits & 3) == 3; }
+    int axis() const { return int(bits & 3); }
+    int above() const { return int(bits >> 2); }
+    int count() const { return int(bits >> 2); }
+};
+
+// SAH kd-tree：空间被轴对齐的平面递归地一分为二，跨过平面的基元两边各放一个引用，裁剪到各自一侧
+// (四边形按平面裁剪多边形，其他物体取包围盒与该侧的交)。每个节点在三个轴上扫描基元包围盒的边界，
+// 取 SAH 代价最小的平面(Wald & Havran)。遍历从前到后，叶子里找到的交点落在叶子之内即可结束。
+class KdTree : public SpatialAccelerator {
+public:
+    KdTree(const HittableList& hittable_list) : SpatialAccelerator(hittable_list) {
+        build();
+    }
+
+    Type type() const override { return KD_TREE; }
+
+    size_t memory_bytes() const override {
+        return nodes.size() * sizeof(KdTreeNode) + (entries.size() + unsplit.size()) * sizeof(int);
+    }
+
+    int node_count() const { return int(nodes.size()); }
+    // leaf references, larger than the number of objects when some were split
+    int entry_count() const { return int(entries.size()); }
+
+protected:
+    bool hit_structure(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
+        Interval range = ray_t;
+        if (nodes.empty() || !tree_bounds.clip(ray, range))
+            return false;
+
+        bool hit_anything = false;
+        Vec3f inv_dir(1.f / ray.direction().x, 1.f / ray.direction().y, 1.f / ray.direction().z);
+        struct Todo {
+            int node;
+            float t_min, t_max;
+        };
+        Todo todo[64];
+        int todo_size = 0;
+        int current = 0;
+        float t_min = range.min, t_max = range.max;
+        while (true) {
+            // a hit before the node is closer than anything in it
+            if (ray_t.max < t_min) break;
+            const KdTreeNode& node = nodes[current];
+            STAT_INC(accel_cells_visited);
+            if (!node.leaf()) {
+                int axis = node.axis();
+                float origin = ray.origin()[axis];
+                float t_plane = (node.split - origin) * inv_dir[axis];
+                bool below_first = origin < node.split || (origin == node.split && ray.direction()[axis] <= 0.f);
+                int first = below_first ? current + 1 : node.above();
+                int second = below_first ? node.above() : current + 1;
+                if (t_plane > t_max || t_plane <= 0.f) {
+                    current = first;
+                } else if (t_plane < t_min) {
+                    current = second;
+                } else {
+                    todo[todo_size].node = second;
+                    todo[todo_size].t_min = t_plane;
+                    todo[todo_size++].t_max = t_max;
+                    current = first;
+                    t_max = t_plane;
+                }
+                continue;
+            }
+            for (int i = node.first; i < node.first + node.count(); ++i) {
+                if (objects[entries[i]]->hit(ray, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                    rec.object_id = entries[i];
+                }
+            }
+            if (todo_size == 0) break;
+            --todo_size;
+            current = todo[todo_size].node;
+            t_min = todo[todo_size].t_min;
+            t_max = todo[todo_size].t_max;
+        }
+        return hit_anything;
+    }
+
+private:
+    // relative costs of a traversal step and of intersecting a primitive, empty children are preferred
+    static constexpr float traversal_cost = 1.f;
+    static constexpr float intersection_cost = 80.f;
+    static constexpr float empty_bonus = 0.5f;
+    static const int max_leaf_size = 1;
+
+    struct Edge {
+        float t;
+        int ref;
+        bool start;
+
+        bool operator<(const Edge& e) const {
+            return t != e.t ? t < e.t : start && !e.start;
+        }
+    };
+
+    std::vector<KdTreeNode> nodes;
+    std::vector<int> entries;           // object indices of the leaves
+    aabb tree_bounds;                   // of the objects in the tree
+
+    void build() override {
+        nodes.clear();
+        entries.clear();
+        std::vector<int> refs;
+        std::vector<aabb> boxes;
+        tree_bounds = partition(refs, boxes);
+        if (refs.empty()) return;
+        int max_depth = int(std::lround(8.f + 1.3f * std::log2(float(refs.size()))));
+        build_recursive(tree_bounds, refs, boxes, max_depth, 0);
+    }
+
+    void make_leaf(int index, const std::vector<int>& refs) {
+        nodes[index].first = int(entries.size());
+        nodes[index].bits = (uint32_t(refs.size()) << 2) | 3u;
+        entries.insert(entries.end(), refs.begin(), refs.end());
+    }
+
+    // 'boxes' are the bounds of the references clipped to 'region'
+    void build_recursive(const aabb& region, std::vector<int>& refs, std::vector<aabb>& boxes, int depth,
+                         int bad_refines) {
+        int index = int(nodes.size());
+        nodes.push_back(KdTreeNode());
+        int n = int(refs.size());
+        if (n <= max_leaf_size || depth == 0) {
+            make_leaf(index, refs);
+            return;
+        }
+
+        // sweep the edges of the boxes along each axis, the longest first
+        float total_area = region.surface_area();
+        float inv_area = total_area > 0.f ? 1.f / total_area : 0.f;
+        float leaf_cost = intersection_cost * float(n);
+        float best_cost = INFINITY;
+        int best_axis = -1, best_edge = -1;
+        std::vector<Edge> edges(2 * n), best_edges;
+        int axis = region.longest_axis();
+        for (int tries = 0; tries < 3 && best_axis < 0; ++tries, axis = (axis + 1) % 3) {
+            for (int i = 0; i < n; ++i) {
+                const Interval& s = boxes[i].axis_interval(axis);
+                edges[2 * i] = Edge{s.min, i, true};
+                edges[2 * i + 1] = Edge{s.max, i, false};
+            }
+            std::sort(edges.begin(), edges.end());
+
+            const Interval& extent = region.axis_interval(axis);
+            const Interval& a = region.axis_interval((axis + 1) % 3);
+            const Interval& b = region.axis_interval((axis + 2) % 3);
+            float cap = 2.f * a.size() * b.size(), rim = 2.f * (a.size() + b.size());
+            int below = 0, above = n;
+            for (int i = 0; i < 2 * n; ++i) {
+                if (!edges[i].start) --above;
+                float t = edges[i].t;
+                if (t > extent.min && t < extent.max) {
+                    float below_area = cap + rim * (t - extent.min);
+                    float above_area = cap + rim * (extent.max - t);
+                    float bonus = below == 0 || above == 0 ? empty_bonus : 0.f;
+                    float cost = traversal_cost + intersection_cost * (1.f - bonus) * inv_area *
+                                 (below_area * float(below) + above_area * float(above));
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_edge = i;
+                    }
+                }
+                if (edges[i].start) ++below;
+            }
+            if (best_axis == axis)
+                best_edges.swap(edges);
+            edges.resize(2 * n);
+        }
+
+        if (best_cost > leaf_cost) ++bad_refines;
+        if (best_axis < 0 || (best_cost > 4.f * leaf_cost && n < 16) || bad_refines == 3) {
+            make_leaf(index, refs);
+            return;
+        }
+
+        // references starting before the plane go below, ending after it above
+        float split = best_edges[best_edge].t;
+        aabb below_region = region, above_region = region;
+        set_axis(below_region, best_axis, Interval(region.axis_interval(best_axis).min, split));
+        set_axis(above_region, best_axis, Interval(split, region.axis_interval(best_axis).max));
+        std::vector<int> below_refs, above_refs;
+        std::vector<aabb> below_boxes, above_boxes;
+        for (int i = 0; i < best_edge; ++i)
+            if (best_edges[i].start)
+                add_clipped(best_edges[i].ref, refs, boxes, below_region, below_refs, below_boxes);
+        for (int i = best_edge + 1; i < 2 * n; ++i)
+            if (!best_edges[i].start)
+                add_clipped(best_edges[i].ref, refs, boxes, above_region, above_refs, above_boxes);
+        std::vector<int>().swap(refs);
+        std::vector<aabb>().swap(boxes);
+        std::vector<Edge>().swap(best_edges);
+
+        nodes[index].split = split;
+        build_recursive(below_region, below_refs, below_boxes, depth - 1, bad_refines);
+        nodes[index].bits = (uint32_t(nodes.size()) << 2) | uint32_t(best_axis);
+        build_recursive(above_region, above_refs, above_boxes, depth - 1, bad_refines);
+    }
+
+    // the part of the reference in 'region', dropped if the object itself does not reach into it
+    void add_clipped(int i, const std::vector<int>& refs, const std::vector<aabb>& boxes, const aabb& region,
+                     std::vector<int>& out_refs, std::vector<aabb>& out_boxes) const {
+        aabb part;
+        objects[refs[i]]->clipped_bounds(region, part);
+        part = overlap(part, overlap(boxes[i], region));
+        if (part.is_empty()) return;
+        out_refs.push_back(refs[i]);
+        out_boxes.push_back(part);
+    }
+
+    static void set_axis(aabb& box, int axis, const Interval& s) {
+        (axis == 0 ? box.x : axis == 1 ? box.y : box.z) = s;
+    }
+};
+
+#endif
@@ -15,8 +15,15 @@ public:
 
 class Material {
 public:
+    int id = -1;    // index in the scene's material list, reported by the id AOV
+
     virtual ~Material() = default;
 
+    // reflectance seen at the hit point without sampling a direction, used by the albedo AOV
+    virtual Color3f reflectance(const HitRecord& rec) const {
+        return Color3f(0.f, 0.f, 0.f);
+    }
+
     virtual Color3f emit(const Ray& r_in, const HitRecord& rec, float u, float v, const Point3f& p) const {
         return Color3f(0.f, 0.f, 0.f);
     }
@@ -41,10 +48,14 @@ public:
     Lambertian(const Color &albedo) : Lambertian(color2Vec(albedo).cutVec3()) {}
     Lambertian(shared_ptr<Texture> tex) : tex(tex) {}
 
+    Color3f reflectance(const HitRecord& rec) const override {
+        return tex->value(rec.u, rec.v, rec.p, rec.footprint);
+    }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, ScatterRecord& srec) 
     const override {
         // auto scatter_direction = normal_to_world_dir(random_cosine_direction(), rec.normal);
-        srec.attenuation = tex->value(rec.u, rec.v, rec.p);
+        srec.attenuation = tex->value(rec.u, rec.v, rec.p, rec.footprint);
         srec.pdf_ptr = make_shared<CosinePDF>(rec.normal);
         srec.skip_pdf = false;
         return true;
@@ -64,6 +75,10 @@ public:
     Metal(const Color3f &albedo, float fuzz) : albedo(albedo), fuzz(fuzz < 1.f ? fuzz : 1.f) {}
     Metal(const Color &albedo, float fuzz) : albedo(color2Vec(albedo).cutVec3()), fuzz(fuzz < 1.f ? fuzz : 1.f) {}
 
+    Color3f reflectance(const HitRecord& rec) const override {
+        return albedo;
+    }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, ScatterRecord& srec) 
     const override {
         Vec3f refl = reflect(r_in.direction(), rec.normal);
@@ -89,6 +104,10 @@ private:
 public:
     Dielectric(float refraction_index) : refraction_index(refraction_index) {}
 
+    Color3f reflectance(const HitRecord& rec) const override {
+        return Color3f(1.f, 1.f, 1.f);
+    }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, ScatterRecord& srec)
     const override {
         srec.attenuation = Color3f(1.f, 1.f, 1.f);
@@ -121,10 +140,16 @@ public:
     DiffuseLight(shared_ptr<Texture> tex) : tex(tex) {}
     DiffuseLight(const Color3f& emit) : tex(make_shared<SolidColor>(emit)) {}
 
+    // emitters report their color clamped to [0, 1]
+    Color3f reflectance(const HitRecord& rec) const override {
+        Color3f c = tex->value(rec.u, rec.v, rec.p, rec.footprint);
+        return Color3f(std::min(c.x, 1.f), std::min(c.y, 1.f), std::min(c.z, 1.f));
+    }
+
     Color3f emit(const Ray& r_in, const HitRecord& rec, float u, float v, const Point3f& p) const override {
         if (!rec.front_face)
             return Color3f(0.f, 0.f, 0.f);
-        return tex->value(u, v, p);
+        return tex->value(u, v, p, rec.footprint);
     }
 };
 
@@ -135,9 +160,13 @@ public:
     Isotropic(const Color3f& albedo) : tex(make_shared<SolidColor>(albedo)) {}
     Isotropic(shared_ptr<Texture> tex) : tex(tex) {}
 
+    Color3f reflectance(const HitRecord& rec) const override {
+        return tex->value(rec.u, rec.v, rec.p, rec.footprint);
+    }
+
     bool scatter(const Ray &r_in, const HitRecord &rec, ScatterRecord& srec) 
     const override {
-        srec.attenuation = tex->value(rec.u, rec.v, rec.p);
+        srec.attenuation = tex->value(rec.u, rec.v, rec.p, rec.footprint);
         srec.pdf_ptr = make_shared<SpherePDF>();
         srec.skip_pdf = false;
 
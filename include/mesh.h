@@ -10,12 +10,14 @@ private:
     Vec3f normal;
     shared_ptr<Material> mat;
     aabb bbox;
+    float uv_scale;     // uv change per unit of surface length, rotation keeps it
 public:
     Mesh(const Point3f& Q, const Vec3f& u, const Vec3f& v, shared_ptr<Material> mat)
         : Q(Q), u(u), v(v), mat(mat) {
         auto n = cross(u, v);
         w = n / dot(n, n);
         normal = n.unit();
+        uv_scale = 1.f / std::sqrt(u.norm() * v.norm());
 
         auto bbox1 = aabb(Q, Q + u);
         auto bbox2 = aabb(Q, Q + v);
@@ -27,6 +29,7 @@ public:
     }
 
     bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const {
+        STAT_INC(mesh_tests);
         auto demon = dot(ray.direction(), normal);
         if (std::abs(demon) < 1e-6f) {
             return false;
@@ -49,6 +52,7 @@ public:
         rec.t = t;
         rec.p = p;
         rec.set_face_normal(ray, normal);
+        rec.set_footprint(ray, uv_scale);
 
         return true;
     }
@@ -0,0 +1,151 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "geometry.h"
+#include "image.h"
+
+// 纹理采样设置，由 main 在构建场景前设置，对之后创建的 MipMap 生效
+struct TextureOptions {
+    enum FilterMode { NEAREST, BILINEAR, TRILINEAR };
+    FilterMode filter = TRILINEAR;
+    size_t cache_bytes = size_t(256) << 20;     // capacity of the shared page cache
+    size_t stream_bytes = size_t(256) << 20;    // larger pyramids stay on disk and are paged in through the cache
+    size_t bake_bytes = size_t(256) << 20;      // largest grid a baked procedural texture may use, 0 disables baking
+};
+
+TextureOptions& texture_options();
+
+// 纹理按页(一个 mip 级别中 32x32 的 texel 块, 4 KB)存放，texel 统一为打包的 RGBA8。
+// 页内再分成 4x4 的块，每块正好占一条 64 字节缓存行，双线性插值的 2x2 texel 多数情况下
+// 落在同一行内；行主序时它们总是跨两行。
+static const int texture_page_shift = 5;
+static const int texture_page_size = 1 << texture_page_shift;
+static const int texture_page_texels = texture_page_size * texture_page_size;
+static const size_t texture_page_align = 64;
+
+struct TexturePage {
+    uint32_t texels[texture_page_texels];   // 4x4 blocks, see texel_index()
+};
+
+// 4x4 blocks in row-major order, texels row-major inside a block
+inline int texel_index(int x, int y) {
+    return ((y & 28) << 5) | ((x & 28) << 2) | ((y & 3) << 2) | (x & 3);
+}
+
+// 所有流式纹理共用的 LRU 页缓存，容量超出时淘汰最久未用的页。
+// 渲染线程先查各自的 thread_local 小缓存，命中时不需要加锁。
+class TextureCache {
+public:
+    static TextureCache& instance();
+
+    void set_capacity(size_t bytes);
+    size_t capacity() const { return capacity_bytes; }
+    size_t resident_bytes();
+
+    // page 'page' of texture 'texture_id', read with 'load' on a miss
+    template <typename Loader>
+    std::shared_ptr<const TexturePage> fetch(uint64_t texture_id, uint32_t page, const Loader& load);
+
+    // drop all pages of a texture that is being destroyed
+    void evict(uint64_t texture_id);
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<const TexturePage> page;
+    };
+
+    std::mutex mutex;
+    size_t capacity_bytes = size_t(256) << 20;
+    std::list<Entry> lru;                   // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+
+    static uint64_t make_key(uint64_t texture_id, uint32_t page) { return (texture_id << 32) | page; }
+    void trim();
+};
+
+// 图像纹理的 mip 金字塔：加载时逐级 2x2 盒式降采样并转换为 RGBA8。
+// 金字塔小于 TextureOptions::stream_bytes 时全部常驻内存；否则各页写入临时文件，
+// 采样时经 TextureCache 按需读入，内存占用由缓存容量限定。
+class MipMap {
+public:
+    explicit MipMap(Image& image);
+    ~MipMap();
+    MipMap(const MipMap&) = delete;
+    MipMap& operator=(const MipMap&) = delete;
+
+    bool valid() const { return !levels.empty(); }
+    int width() const { return valid() ? levels[0].width : 0; }
+    int height() const { return valid() ? levels[0].height : 0; }
+    int level_count() const { return int(levels.size()); }
+    bool streamed() const { return page_file != nullptr; }
+    size_t bytes() const { return size_t(page_count) * sizeof(TexturePage); }
+
+    // 'footprint' is the width of the ray cone in uv units; (u, v) are clamped to [0, 1],
+    // v = 0 is the bottom row of the image
+    Color3f lookup(float u, float v, float footprint) const;
+
+    // bilinear sample of one level at continuous texel coordinates
+    Color3f bilinear(int level, float x, float y) const;
+
+private:
+    struct Level {
+        int width, height;
+        int pages_x;
+        uint32_t first_page;
+    };
+
+    TextureOptions::FilterMode filter;
+    std::vector<Level> levels;
+    float lod_scale;                        // texels per uv unit, geometric mean of width and height
+    uint32_t page_count = 0;
+    TexturePage* pages = nullptr;           // resident pages, cache line aligned; null when streamed
+    uint64_t id;
+    FILE* page_file = nullptr;
+    mutable std::mutex file_mutex;
+
+    const TexturePage* page_at(const Level& level, int x, int y) const {
+        uint32_t page = level.first_page + uint32_t((y >> texture_page_shift) * level.pages_x + (x >> texture_page_shift));
+        return streamed() ? cached_page(page) : &pages[page];
+    }
+
+    uint32_t texel(const Level& level, int x, int y) const {
+        return page_at(level, x, y)->texels[texel_index(x, y)];
+    }
+
+    const TexturePage* cached_page(uint32_t page) const;
+    std::shared_ptr<const TexturePage> load_page(uint32_t page) const;
+};
+
+template <typename Loader>
+std::shared_ptr<const TexturePage> TextureCache::fetch(uint64_t texture_id, uint32_t page, const Loader& load) {
+    uint64_t key = make_key(texture_id, page);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->page;
+        }
+    }
+
+    // read without holding the lock, another thread may load the same page meanwhile
+    std::shared_ptr<const TexturePage> loaded = load();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end())
+        return it->second->page;
+    lru.push_front(Entry{key, loaded});
+    entries[key] = lru.begin();
+    trim();
+    return loaded;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 0 or negative: one thread per hardware thread
+inline int resolve_thread_count(int requested) {
+    if (requested > 0) return requested;
+    return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+// call fn(i) for every i in [0, count), items are handed out dynamically to the threads
+template <typename Fn>
+void parallel_for(int count, int threads, Fn fn) {
+    threads = std::max(1, std::min(resolve_thread_count(threads), count));
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool)
+        th.join();
+}
+
+// 常驻线程池：逐帧渲染动画序列时复用同一组线程，而不是每帧重新创建、销毁
+class ThreadPool {
+public:
+    // 0 or negative: one thread per hardware thread, the calling thread counts as one of them
+    explicit ThreadPool(int threads) {
+        for (int t = 1; t < resolve_thread_count(threads); ++t)
+            workers.emplace_back([this, t]() { loop(t); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            ++generation;
+        }
+        start.notify_all();
+        for (auto& th : workers)
+            th.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return int(workers.size()) + 1; }
+
+    // call fn(index) once on every thread of the pool, index 0 on the calling thread, and wait for all of them
+    void run(const std::function<void(int)>& fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            pending = int(workers.size());
+            ++generation;
+        }
+        start.notify_all();
+        fn(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start, done;
+    const std::function<void(int)>* job = nullptr;
+    int pending = 0;
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    void loop(int index) {
+        unsigned long long seen = 0;
+        while (true) {
+            const std::function<void(int)>* fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start.wait(lock, [&]() { return generation != seen; });
+                seen = generation;
+                if (stopping) return;
+                fn = job;
+            }
+            (*fn)(index);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+};
+
+#endif
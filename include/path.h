@@ -15,6 +15,10 @@ public:
     Point3f at(float t) const {
         return src + t * (dst - src);
     }
+
+    bool moving() const {
+        return src.x != dst.x || src.y != dst.y || src.z != dst.z;
+    }
 };
 
 #endif
@@ -35,7 +35,7 @@ public:
 
     float value(const Vec3f& direction) const override {
         auto cosine_theta = dot(direction.unit(), normal);
-        return cosine_theta > 0.f ? 0.f : cosine_theta;
+        return cosine_theta <= 0.f ? 0.f : cosine_theta / pi;
     }
 
     Vec3f generate() const override {
@@ -2,6 +2,9 @@
 
 #include "rtweekend.h"
 
+// 梯度噪声。梯度由哈希值的位直接选出(与 Ken Perlin 改进噪声的 16 个梯度相同)，不再经过 switch；
+// 8 个角点按 x、y、z 依次线性插值。turb() 与批量接口每次以 SIMD 同时计算 4 个点(或 4 个倍频)，
+// 逐点的 noise() 与之使用相同的运算顺序，结果逐位一致。
 class Perlin {
 private:
     static const int point_count = 256;
@@ -10,7 +13,7 @@ private:
     int perm_z[point_count];
 
     static void perlin_generate_perm(int* p) {
-        for (int i = 0; i < point_count; ++i) 
+        for (int i = 0; i < point_count; ++i)
             p[i] = i;
         permute(p, point_count);
     }
@@ -22,48 +25,21 @@ private:
         }
     }
 
-    static float grad(int hash, float x, float y, float z) {
-        switch (hash & 0xF) {
-            case 0x0: return x+y;
-            case 0x1: return -x+y;
-            case 0x2: return x-y;
-            case 0x3: return -x-y;
-            case 0x4: return x+z;
-            case 0x5: return -x+z;
-            case 0x6: return x-z;
-            case 0x7: return -x-z;
-            case 0x8: return y+z;
-            case 0x9: return -y+z;
-            case 0xA: return y-z;
-            case 0xB: return -y-z;
-            case 0xC: return y+x;
-            case 0xD: return -y+z;
-            case 0xE: return y-x;
-            case 0xF: return -y-z;
-            default: return 0.f; // never happens
-        }
-    }
-
-    static float fade(float x) {
-        float x2 = x*x;
-        return x2*x*(10-15*x+6*x2);
-    }
-
-    static float trilinear_interpolate(float c[2][2][2], float u, float v, float w) {
-        float rst = 0.f;
+    // hashes of the 8 lattice corners around cell (X, Y, Z), corner index i*4 + j*2 + k
+    void corner_hashes(int X, int Y, int Z, int* hash, int stride) const {
         for (int i = 0; i < 2; ++i) {
+            int hx = perm_x[(X+i)&255];
             for (int j = 0; j < 2; ++j) {
-                for (int k = 0; k < 2; ++k) {
-                    rst += (i*u + (1-i)*(1-u)) *
-                           (j*v + (1-j)*(1-v)) * 
-                           (k*w + (1-k)*(1-w)) * 
-                           c[i][j][k];
-                }
+                int hy = perm_y[(hx+Y+j)&255];
+                hash[(i*4 + j*2) * stride] = perm_z[(hy+Z)&255];
+                hash[(i*4 + j*2 + 1) * stride] = perm_z[(hy+Z+1)&255];
             }
         }
-        return rst;
     }
 
+    // noise at 4 points given as separate coordinate arrays
+    void noise4(const float* px, const float* py, const float* pz, float* out) const;
+
 public:
     Perlin() {
         perlin_generate_perm(perm_x);
@@ -71,43 +47,12 @@ public:
         perlin_generate_perm(perm_z);
     }
 
-    float noise(const Point3f& p) const {
-        auto X = int(std::floor(p.x));
-        auto Y = int(std::floor(p.y));
-        auto Z = int(std::floor(p.z));
-
-        float x = p.x - std::floor(p.x);
-        float y = p.y - std::floor(p.y);
-        float z = p.z - std::floor(p.z);
-        
-        auto u = fade(x);
-        auto v = fade(y);
-        auto w = fade(z);
+    float noise(const Point3f& p) const;
 
-        float c[2][2][2];
+    // sum of 'layer' octaves, each at twice the frequency and half the weight of the previous one
+    float turb(const Point3f& p, int layer) const;
 
-        for (int i = 0; i < 2; ++i) {
-            for (int j = 0; j < 2; ++j) {
-                for (int k = 0; k < 2; ++k) {
-                    auto hash = perm_z[(perm_y[(perm_x[(X+i)&255]+Y+j)&255]+Z+k)&255];
-                    c[i][j][k] = grad(hash, x-i, y-j, z-k);
-                }
-            }
-        }
-
-        return trilinear_interpolate(c, u, v, w);
-    }
-
-    float turb(const Point3f& p, int layer) const {
-        auto accum = 0.f;
-        auto temp_p = p;
-        auto weight = 1.f;
-
-        for (int i = 0; i < layer; ++i) {
-            accum += weight * noise(temp_p);
-            temp_p *= 2.f;
-            weight *= 0.5f;
-        }
-        return std::fabs(accum);
-    }
+    // batch versions, equal to calling noise() / turb() on every point
+    void noise(const Point3f* points, float* out, int count) const;
+    void turb(const Point3f* points, float* out, int count, int layer) const;
 };
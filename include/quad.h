@@ -1,6 +1,44 @@
 #pragma once
 
 #include "hittable.h"
+#include "hittable_list.h"
+
+// bounds of the convex polygon 'poly' (n <= 4 corners) clipped by the six planes of 'region'
+// (Sutherland-Hodgman), every plane adds at most one corner
+inline aabb clipped_polygon_bounds(const Point3f* corners, int n, const aabb& region) {
+    Point3f poly[10], next[10];
+    std::copy(corners, corners + n, poly);
+    for (int a = 0; a < 3; ++a) {
+        for (int side = 0; side < 2 && n > 0; ++side) {
+            float plane = side == 0 ? region.axis_interval(a).min : region.axis_interval(a).max;
+            float sign = side == 0 ? 1.f : -1.f;    // inside where sign * (p[a] - plane) >= 0
+            int m = 0;
+            for (int i = 0; i < n; ++i) {
+                const Point3f& p = poly[i];
+                const Point3f& q = poly[(i + 1) % n];
+                float dp = sign * (p[a] - plane);
+                float dq = sign * (q[a] - plane);
+                if (dp >= 0.f)
+                    next[m++] = p;
+                if ((dp < 0.f) != (dq < 0.f)) {
+                    Point3f x = p + (dp / (dp - dq)) * (q - p);
+                    x[a] = plane;
+                    next[m++] = x;
+                }
+            }
+            std::copy(next, next + m, poly);
+            n = m;
+        }
+    }
+
+    if (n == 0)
+        return aabb::empty;
+    Interval axes[3];
+    for (int i = 0; i < n; ++i)
+        for (int a = 0; a < 3; ++a)
+            axes[a] = Interval(std::min(axes[a].min, poly[i][a]), std::max(axes[a].max, poly[i][a]));
+    return aabb(axes[0], axes[1], axes[2]);
+}
 
 class Quad : public Hittable {
 private:
@@ -10,6 +48,7 @@ private:
     Vec3f normal;
     shared_ptr<Material> mat;
     aabb bbox;
+    float uv_scale;     // uv change per unit of surface length, rotation keeps it
     float area;
 
 public:
@@ -20,6 +59,7 @@ public:
         normal = n.unit();
 
         area = n.norm();
+        uv_scale = 1.f / std::sqrt(u.norm() * v.norm());
 
         auto bbox1 = aabb(Q, Q + u + v);
         auto bbox2 = aabb(Q + u, Q + v);
@@ -31,6 +71,7 @@ public:
     }
 
     bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const {
+        STAT_INC(quad_tests);
         auto demon = dot(ray.direction(), normal);
         if (std::abs(demon) < 1e-6f) {
             return false;
@@ -54,10 +95,17 @@ public:
         rec.t = t;
         rec.p = p;
         rec.set_face_normal(ray, normal);
+        rec.set_footprint(ray, uv_scale);
 
         return true;
     }
 
+    bool clipped_bounds(const aabb& region, aabb& clipped) const override {
+        Point3f poly[4] = {Q, Q + u, Q + u + v, Q + v};
+        clipped = clipped_polygon_bounds(poly, 4, region);
+        return true;
+    }
+
     void translate(const Vec3f& offset) override {
         Q = Q + offset;
         bbox = bbox + offset;
@@ -91,6 +139,7 @@ public:
     }
 
     float pdf_value(const Point3f& origin, const Vec3f& direction) const override {
+        STAT_INC(shadow_rays);
         HitRecord rec;
         if (!this->hit(Ray(origin, direction), Interval(0.001f, INFINITY), rec)) 
             return 0.f;     // 除了那块立体角外其他地方pdf为0
@@ -107,48 +156,158 @@ public:
     }
 };
 
+// 长方体：在自身坐标系中轴对齐，一次 slab 测试求交，法线与 uv 取自击中的面(与原先六个四边形的参数化相同)。
+// 自身坐标系只能绕中心的 y 轴旋转(rotate_y)，其他旋转与缩放通过实例变换
 class Box : public Hittable {
 private:
-    shared_ptr<HittableList> sides;
-    Point3f mass_point;
-public:
-    Box(const Point3f& a, const Point3f& b, shared_ptr<Material> mat) {
-        sides = make_shared<HittableList>();
-        auto min = Point3f(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
-        auto max = Point3f(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
-        
-        mass_point = (a + b) / 2.f;
-
-        auto dx = Vec3f(max.x - min.x, 0.f, 0.f);
-        auto dy = Vec3f(0.f, max.y - min.y, 0.f);
-        auto dz = Vec3f(0.f, 0.f, max.z - min.z);
+    Point3f min, max;           // corners in the box frame, which is the world frame until rotated
+    Point3f center;             // of the rotation
+    float theta = 0.f;          // box frame to world: rotation about y through the center
+    float cos_theta = 1.f, sin_theta = 0.f;
+    shared_ptr<Material> mat;
+    aabb bbox;
+    float uv_scale[3];          // per axis of the face normal, uv change per unit of surface length
+    float inv_size[3];          // 0 for a flat side
 
-        sides->add(make_shared<Quad>(Point3f(min.x, min.y, max.z), dx, dy, mat)); // front
-        sides->add(make_shared<Quad>(Point3f(max.x, min.y, max.z), -dz, dy, mat)); // right
-        sides->add(make_shared<Quad>(Point3f(max.x, min.y, min.z), -dx, dy, mat)); // back
-        sides->add(make_shared<Quad>(Point3f(min.x, min.y, min.z), dz, dy, mat)); // left
-        sides->add(make_shared<Quad>(Point3f(min.x, max.y, max.z), dx, -dz, mat)); // top
-        sides->add(make_shared<Quad>(Point3f(min.x, min.y, min.z), dx, dz, mat)); // bottom
+public:
+    Box(const Point3f& a, const Point3f& b, shared_ptr<Material> mat) : mat(mat) {
+        min = Point3f(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+        max = Point3f(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+        center = (a + b) / 2.f;
+        Vec3f size = max - min;
+        for (int axis = 0; axis < 3; ++axis) {
+            inv_size[axis] = size[axis] > 0.f ? 1.f / size[axis] : 0.f;
+            // the faces are parametrized by their two edges
+            float area = size[(axis + 1) % 3] * size[(axis + 2) % 3];
+            uv_scale[axis] = area > 0.f ? 1.f / std::sqrt(area) : 0.f;
+        }
+        bbox = aabb(min, max);
     }
 
     bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
-        return sides->hit(ray, ray_t, rec);
+        STAT_INC(box_tests);
+        // without a rotation the faces are tested where they were given, adjacent boxes stay seamless
+        Point3f o = ray.origin();
+        Vec3f d = ray.direction();
+        if (theta != 0.f) {
+            o = center + to_box(o - center);
+            d = to_box(d);
+        }
+
+        // entering through the last slab entered, leaving through the first slab left
+        float t_near = -INFINITY, t_far = INFINITY;
+        int near_axis = 0, far_axis = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (d[axis] == 0.f) {
+                if (o[axis] < min[axis] || o[axis] > max[axis]) return false;
+                continue;
+            }
+            float inv_d = 1.f / d[axis];
+            float t0 = (min[axis] - o[axis]) * inv_d;
+            float t1 = (max[axis] - o[axis]) * inv_d;
+            if (inv_d < 0.f) std::swap(t0, t1);
+            if (t0 > t_near) { t_near = t0; near_axis = axis; }
+            if (t1 < t_far) { t_far = t1; far_axis = axis; }
+        }
+        if (t_near > t_far) return false;
+
+        // from inside the box the ray leaves through the far face
+        float t;
+        int axis;
+        float side;     // +1 for the face on the positive side of 'axis'
+        if (ray_t.contains(t_near) && t_near > -INFINITY) {
+            t = t_near;
+            axis = near_axis;
+            side = d[axis] > 0.f ? -1.f : 1.f;
+        } else if (ray_t.contains(t_far) && t_far < INFINITY) {
+            t = t_far;
+            axis = far_axis;
+            side = d[axis] > 0.f ? 1.f : -1.f;
+        } else {
+            return false;
+        }
+
+        // position on the box in [0, 1] per axis, the faces keep the orientation of the old quads
+        Vec3f q;
+        for (int a = 0; a < 3; ++a)
+            q[a] = a == axis ? (side > 0.f ? 1.f : 0.f)
+                             : Interval::unit.clamp((o[a] + t * d[a] - min[a]) * inv_size[a]);
+        if (axis == 0) {
+            rec.u = side > 0.f ? 1.f - q.z : q.z;
+            rec.v = q.y;
+        } else if (axis == 1) {
+            rec.u = q.x;
+            rec.v = side > 0.f ? 1.f - q.z : q.z;
+        } else {
+            rec.u = side > 0.f ? q.x : 1.f - q.x;
+            rec.v = q.y;
+        }
+
+        Vec3f normal(0.f, 0.f, 0.f);
+        normal[axis] = side;
+        rec.mat = mat;
+        rec.t = t;
+        rec.p = ray.at(t);
+        rec.set_face_normal(ray, to_world_dir(normal));
+        rec.set_footprint(ray, uv_scale[axis]);
+        return true;
     }
 
     aabb bounding_box() const override {
-        return sides->bbox;
+        return bbox;
+    }
+
+    // the six faces clipped to 'region', like the quads the box used to be made of
+    bool clipped_bounds(const aabb& region, aabb& clipped) const override {
+        Point3f corners[8];
+        for (int i = 0; i < 8; ++i)
+            corners[i] = to_world(Point3f(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z));
+        static const int faces[6][4] = {
+            {0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}
+        };
+        clipped = aabb::empty;
+        for (const auto& face : faces) {
+            Point3f poly[4] = {corners[face[0]], corners[face[1]], corners[face[2]], corners[face[3]]};
+            clipped = aabb(clipped, clipped_polygon_bounds(poly, 4, region));
+        }
+        return true;
     }
 
     void translate(const Vec3f& offset) override {
-        sides->translate(offset);
-        mass_point = mass_point + offset;
+        min = min + offset;
+        max = max + offset;
+        center = center + offset;
+        bbox = bbox + offset;
     }
 
-    void rotate_y(float theta) override {
-        sides->bbox = aabb();
-        for (auto &quad : sides->objects) {
-            std::dynamic_pointer_cast<Quad>(quad)->rotate_y(theta, mass_point);
-            sides->bbox = aabb(sides->bbox, quad->bounding_box());
+    void rotate_y(float angle) override {   // rotate around the center
+        theta += degrees_to_radians(angle);
+        cos_theta = std::cos(theta);
+        sin_theta = std::sin(theta);
+        update_bounds();
+    }
+
+private:
+    // same direction of rotation as Quad::rotate_y
+    Point3f to_world(const Point3f& p) const {
+        return theta != 0.f ? center + to_world_dir(p - center) : p;
+    }
+
+    Vec3f to_world_dir(const Vec3f& v) const {
+        return Vec3f(cos_theta * v.x + sin_theta * v.z, v.y, -sin_theta * v.x + cos_theta * v.z);
+    }
+
+    Vec3f to_box(const Vec3f& v) const {
+        return Vec3f(cos_theta * v.x - sin_theta * v.z, v.y, sin_theta * v.x + cos_theta * v.z);
+    }
+
+    void update_bounds() {
+        Point3f lo(INFINITY, INFINITY, INFINITY), hi(-INFINITY, -INFINITY, -INFINITY);
+        for (int i = 0; i < 8; ++i) {
+            Point3f p = to_world(Point3f(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z));
+            lo = Point3f(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+            hi = Point3f(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
         }
+        bbox = aabb(lo, hi);
     }
-};
\ No newline at end of file
+};
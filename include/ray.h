@@ -18,10 +18,22 @@ public:
 
     float time() const { return tm; }
 
+    // 光锥：以起点处的宽度与每单位距离的扩张角近似光线微分，用于选择纹理的 mip 级别；
+    // 两者为 0 时纹理按最精细的级别采样
+    float cone_width() const { return width; }
+    float cone_spread() const { return spread; }
+    float cone_width_at(float t) const { return width + spread * t; }
+    void set_cone(float cone_width, float cone_spread) {
+        width = cone_width;
+        spread = cone_spread;
+    }
+
 private:
     Point3f orig;
     Vec3f dir;
     float tm;
+    float width = 0.f;
+    float spread = 0.f;
 };
 
 #endif
\ No newline at end of file
@@ -1,13 +1,17 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <functional>
 #include "geometry.h"
-#include "image.h"
+#include "float_image.h"
+#include "aov.h"
+#include "film.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include "ray.h"
 #include "material.h"
 #include "pdf.h"
+#include "parallel.h"
 
 class RayTracer {
 public:
@@ -24,25 +28,72 @@ public:
     float focus_dist = 10.f;
     Color3f background = Color3f(0.7f, 0.8f, 1.0f);
 
-    RayTracer(shared_ptr<Image> image);
+    // pixel reconstruction filter, nullptr is a box over the pixel (plain average)
+    shared_ptr<Filter> filter;
+
+    // optional AOV buffers of the image size, filled during render()
+    shared_ptr<AOVBuffers> aovs;
+
+    // progressive preview: called from one render thread with the tiles finished so far,
+    // at most every 'preview_interval' seconds; the other threads keep rendering meanwhile
+    std::function<void(const FloatImage&)> preview;
+    double preview_interval = 1.0;
+
+    int num_threads = 0;            // 0: one thread per hardware thread
+    shared_ptr<ThreadPool> pool;    // when set, render on its threads instead of starting 'num_threads' new ones
+    unsigned int seed = 0;
+    static const int tile_size = 16;
+
+    // seed of one frame of a sequence, the noise must not stay fixed on the screen while the scene moves;
+    // frame 0 keeps 'seed', and a frame rendered alone matches the same frame of a sequence
+    static unsigned int frame_seed(unsigned int seed, int frame) {
+        unsigned int h = (unsigned int)frame * 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return seed ^ h;
+    }
+
+    // filled in by render(), the timing fields of 'stats' are left to the caller
+    RenderStats stats;
+    unsigned long long ray_count = 0;
+    int threads_used = 0;
+
+    // radiance is accumulated linearly into an RGBA float image, see tonemap()
+    RayTracer(shared_ptr<FloatImage> image);
     void render(const Hittable &world, const HittableList& highlights);
+    int samples_per_pixel_used() const { return sqrt_spp * sqrt_spp; }
 
 private:
-    shared_ptr<Image> image;
+    shared_ptr<FloatImage> image;
     int image_width;
     int image_height;
 
     Point3f center;
     Vec3f pixel_delta_u;
     Vec3f pixel_delta_v;
+    float pixel_spread;             // ray cone spread angle of camera rays
     Vec3f pixel00_loc;
     Vec3f x_cam, y_cam, z_cam;
     Vec3f defocus_disk_u;
     Vec3f defocus_disk_v;
+    int tiles_x, tiles_y;
+
+    // what a camera ray hit first, recorded only while AOVs are enabled
+    struct FirstHit {
+        bool hit = false;
+        float t = 0.f;
+        Color3f albedo;
+        Vec3f normal;
+        int object_id = -1;
+        int material_id = -1;
+    };
 
-    Color3f ray_color(const Ray &r, int depth, const Hittable& world, const HittableList& highlights);   
+    Color3f ray_color(const Ray &r, int depth, const Hittable& world, const HittableList& highlights,
+                      FirstHit* first = nullptr);
+    void render_tile(int tile, Film& film, const Hittable& world, const HittableList& highlights);
     Ray get_sample_ray(int i, int j) const;
-    Ray get_sample_ray(int i, int j, int s_i, int s_j) const;
+    Ray get_sample_ray(int i, int j, const Vec3f& offset) const;
     Vec3f sample_square_stratified(int s_i, int s_j) const;
     void init();
 };
@@ -1,6 +1,7 @@
 #ifndef RTWEEKEND_H
 #define RTWEEKEND_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <limits>
@@ -17,6 +18,7 @@ using std::shared_ptr;
 #include "geometry.h"
 #include "interval.h"
 #include "path.h"
+#include "stats.h"
 
 // Constants
 const float pi = 3.1415927f;
@@ -26,10 +28,19 @@ inline float degrees_to_radians(float degrees) {
     return degrees * pi / 180.f;
 }
 
+// 每个线程独立的随机数发生器，渲染时按图块重新播种以保证结果与线程数无关
+inline std::mt19937& random_generator() {
+    static thread_local std::mt19937 generator;
+    return generator;
+}
+
+inline void seed_random(unsigned int seed) {
+    random_generator().seed(seed);
+}
+
 inline float random_float() {
-    static std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-    static std::mt19937 generator;
-    return distribution(generator);
+    static thread_local std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    return distribution(random_generator());
 }
 
 inline float random_float(float min, float max) {
@@ -37,9 +48,7 @@ inline float random_float(float min, float max) {
 }
 
 inline int random_int(int min, int max) {
-    static std::uniform_int_distribution<int> distribution(min, max);
-    static std::mt19937 generator;
-    return distribution(generator);
+    return std::min(max, min + static_cast<int>(random_float() * (max - min + 1)));
 }
 
 inline Vec3f random_vector() {
@@ -0,0 +1,185 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "texture.h"
+#include "raytracer.h"
+#include "image.h"
+#include "accelerator.h"
+#include "bvh.h"
+#include "transform.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// 场景描述：由场景文件解析得到，只记录参数，不创建任何对象。
+// 纹理、材质之间通过下标互相引用(-1 表示无)，build_scene 再据此实例化。
+
+class SceneError : public std::runtime_error {
+public:
+    explicit SceneError(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+struct TextureDesc {
+    enum Type { SOLID, CHECKER, IMAGE, NOISE };
+    Type type = SOLID;
+    Color3f color;          // SOLID
+    float scale = 1.f;      // CHECKER, NOISE
+    int even = -1;          // CHECKER
+    int odd = -1;           // CHECKER
+    std::string path;       // IMAGE, resolved against the scene file directory
+    float bake_tolerance = 0.f; // CHECKER, NOISE: bake into a grid with at most this RMS error, 0: never
+};
+
+struct MaterialDesc {
+    enum Type { LAMBERTIAN, METAL, DIELECTRIC, DIFFUSE_LIGHT, ISOTROPIC };
+    Type type = LAMBERTIAN;
+    int texture = -1;       // LAMBERTIAN, DIFFUSE_LIGHT, ISOTROPIC
+    Color3f albedo;         // METAL
+    float fuzz = 0.f;       // METAL
+    float ior = 1.f;        // DIELECTRIC
+};
+
+// shapes only take TRANSLATE and ROTATE_Y, which move their geometry in place (rotating about the
+// shape's own center); instances compose all of them into one matrix acting about the origin
+struct TransformDesc {
+    enum Type { TRANSLATE, ROTATE_Y, ROTATE, SCALE };
+    Type type = TRANSLATE;
+    Vec3f offset;           // TRANSLATE: offset, ROTATE: axis, SCALE: factors
+    float angle = 0.f;      // ROTATE_Y, ROTATE: degrees
+};
+
+struct ShapeDesc {
+    enum Type { SPHERE, QUAD, MESH, BOX };
+    Type type = SPHERE;
+    int material = -1;
+    // SPHERE: p[0] = center, p[1] = center at time 1
+    // QUAD/MESH: p[0] = Q, p[1] = u, p[2] = v
+    // BOX: p[0], p[1] = opposite corners
+    Point3f p[3];
+    float radius = 0.f;
+    std::vector<TransformDesc> transforms;      // applied in order
+};
+
+// 关键帧：两个关键帧之间的相机参数、变换参数按帧号线性插值，第一个之前、最后一个之后保持不变
+struct CameraKey {
+    int frame = 0;
+    float fovY = 90.f;
+    Point3f eye;
+    Point3f lookat;
+    float defocus_angle = 0.f;
+    float focus_dist = 10.f;
+};
+
+// every key of an object lists the same transform types in the same order, so the parameters can be
+// interpolated one by one: rotate_y 0 to rotate_y 360 turns a full circle
+struct TransformKey {
+    int frame = 0;
+    std::vector<TransformDesc> transforms;
+};
+
+struct ObjectDesc {
+    ShapeDesc shape;
+    bool medium = false;    // shape is the boundary of a constant medium
+    float density = 0.f;
+    int phase_texture = -1;
+    int prototype = -1;     // >= 0: instance of SceneDesc::prototypes[prototype] placed by shape.transforms
+    std::vector<TransformKey> keys;     // animated: the interpolated transforms follow shape.transforms
+};
+
+// geometry defined once in object space and placed any number of times by instances
+struct PrototypeDesc {
+    std::vector<ObjectDesc> objects;    // instances in here refer to earlier prototypes only
+    int accelerator = -1;               // Accelerator::Type, -1 for the scene's
+};
+
+class SceneDesc {
+public:
+    std::string name;
+
+    int image_width = 400;
+    int image_height = 225;
+
+    // RayTracer settings
+    int samples_per_pixel = 30;
+    int max_depth = 50;
+    float fovY = 90.f;
+    Point3f eye = Point3f(0.f, 0.f, 0.f);
+    Point3f lookat = Point3f(0.f, 0.f, -1.f);
+    float defocus_angle = 0.f;
+    float focus_dist = 10.f;
+    Color3f background = Color3f(0.7f, 0.8f, 1.0f);
+
+    std::vector<TextureDesc> textures;
+    std::vector<MaterialDesc> materials;
+    std::vector<PrototypeDesc> prototypes;
+    std::vector<ObjectDesc> objects;
+    std::vector<ShapeDesc> lights;      // importance sampling targets, material ignored
+
+    // animation: frames rendered by a sequence and the camera keys, none for a still
+    int first_frame = 0;
+    int last_frame = 0;
+    std::vector<CameraKey> camera_keys;
+    // motion blur of animated objects: the shutter stays open for 'shutter' frames after each frame, during
+    // which their transforms are interpolated over 'motion_segments' pieces (ray time 0 to 1)
+    float shutter = 0.f;
+    int motion_segments = 1;
+    // spatial splits in the BVHs (SBVH): extra leaf references allowed, as a fraction of the objects; 0 for none
+    float spatial_splits = 0.f;
+    // of the whole scene and of the prototypes that do not choose their own
+    Accelerator::Type accelerator = Accelerator::BVH;
+
+    // copy camera and sampling settings into the raytracer
+    void setup(RayTracer& raytracer) const;
+    // the same with the camera interpolated at 'frame'
+    void setup(RayTracer& raytracer, float frame) const;
+};
+
+class Instance;
+
+// an object with keys, placed in the world by an instance whose transform changes from frame to frame
+struct AnimatedObject {
+    int object;                     // index into SceneDesc::objects
+    shared_ptr<Instance> instance;
+    Transform placement;            // instances of prototypes: shape.transforms, applied before the keys
+};
+
+// 实例化后的场景，world 为整个场景的加速结构(默认为 BVH)，基元顺序与 SceneDesc::objects 对应
+class Scene {
+public:
+    shared_ptr<const void> backing;             // memory the prebuilt data lives in, released last
+    shared_ptr<Accelerator> world;
+    std::vector<shared_ptr<Accelerator>> prototypes;    // per SceneDesc::prototypes, shared by its instances
+    std::vector<AnimatedObject> animated;
+    HittableList highlights;
+    std::vector<shared_ptr<Texture>> textures;
+    std::vector<shared_ptr<Material>> materials;
+    double bvh_build_secs = 0.0;
+};
+
+// 由场景缓存提供的预处理数据，build_scene 直接使用而不再解码图像、构建 BVH
+struct PrebuiltScene {
+    std::vector<shared_ptr<Image>> images;      // per texture, null unless an image texture
+    const LinearBVHNode* nodes = nullptr;
+    int node_count = 0;
+    const int* order = nullptr;                 // one entry per leaf reference, every object at least once
+    int order_count = 0;
+    shared_ptr<const void> backing;             // keeps 'nodes' and image pixels alive
+};
+
+// throw SceneError with "file:line: message" on malformed input
+SceneDesc parse_scene(const std::string& text, const std::string& name, const std::string& base_dir);
+SceneDesc parse_scene_file(const std::string& filename);
+
+// animated objects are placed at 'desc.first_frame'
+Scene build_scene(const SceneDesc& desc, const PrebuiltScene* prebuilt = nullptr);
+
+// move the animated objects to 'frame' and refit the top level BVH if any of them moved, textures and
+// prototype BVHs are left as they are; returns the number of objects that moved
+int set_scene_frame(const SceneDesc& desc, Scene& scene, float frame);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "scene.h"
+
+#include <cstdint>
+#include <string>
+
+// 二进制场景缓存：保存场景描述、扁平化的 BVH 节点以及解码后的纹理像素。
+// 文件内只使用相对文件起始处的偏移量，加载时直接 mmap，节点与像素原地使用，无需解析。
+// 缓存以场景文件内容的哈希以及纹理文件的大小、修改时间校验，任一不符即视为失效。
+
+// Returns false if 'cache_file' is missing, corrupt or stale with respect to
+// 'scene_file'; 'desc' and 'scene' are only written on success.
+bool load_scene_cache(const std::string& cache_file, const std::string& scene_file,
+                      SceneDesc& desc, Scene& scene);
+
+// Throws SceneError if the cache cannot be written.
+void write_scene_cache(const std::string& cache_file, const std::string& scene_file,
+                       const SceneDesc& desc, const Scene& scene);
+
+#endif
@@ -12,9 +12,12 @@ public:
         aabb box1(center.dst - rvec, center.dst + rvec);
         aabb box2(center.src - rvec, center.src + rvec);
         bbox = aabb(box1, box2);
+        // u 绕一周为 2*pi*r，v 从南极到北极为 pi*r，取两者的几何平均
+        uv_scale = this->radius > 0.f ? 1.f / (std::sqrt(2.f) * pi * this->radius) : 0.f;
     }
     
     bool hit(const Ray &ray, Interval ray_t, HitRecord &rec) const override {
+        STAT_INC(sphere_tests);
         auto time = ray.time();
         auto center_t = center.at(time);
 
@@ -44,6 +47,7 @@ public:
         Vec3f outward_normal = (rec.p - center_t) / radius;
         rec.set_face_normal(ray, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.set_footprint(ray, uv_scale);
         rec.mat = mat;
 
         return true;
@@ -53,6 +57,16 @@ public:
         return bbox;
     }
 
+    void linear_bounds(aabb& open, aabb& close) const override {
+        if (!center.moving()) {
+            open = close = bbox;
+            return;
+        }
+        Vec3f rvec(radius, radius, radius);
+        open = aabb(center.src - rvec, center.src + rvec);
+        close = aabb(center.dst - rvec, center.dst + rvec);
+    }
+
     void translate(const Vec3f& offset) override {
         center.src = center.src + offset;
         center.dst = center.dst + offset;
@@ -62,6 +76,7 @@ public:
     void rotate_y(float theta) override {}
 
     float pdf_value(const Point3f& origin, const Vec3f& direction) const {
+        STAT_INC(shadow_rays);
         HitRecord rec;
         if (!this->hit(Ray(origin, direction), Interval(0.001f, INFINITY), rec))
             return 0.f;
@@ -95,6 +110,7 @@ public:
 private:
     Path center;
     float radius;
+    float uv_scale;     // uv change per unit of surface length
     shared_ptr<Material> mat;
     aabb bbox;
 
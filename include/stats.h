@@ -0,0 +1,56 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <ostream>
+
+// 渲染统计：每个线程各自累加 thread_local 计数器，渲染结束后由 RayTracer 汇总，热路径上没有锁或原子操作。
+// 以 -DTINYRT_NO_STATS 编译时所有 STAT_* 宏为空操作。
+struct RenderStats {
+    unsigned long long camera_rays = 0;
+    unsigned long long bounce_rays = 0;
+    unsigned long long shadow_rays = 0;        // rays cast towards lights to evaluate their pdf
+    unsigned long long bvh_nodes_visited = 0;
+    unsigned long long accel_cells_visited = 0; // kd-tree nodes and grid cells
+    unsigned long long sphere_tests = 0;
+    unsigned long long quad_tests = 0;
+    unsigned long long box_tests = 0;
+    unsigned long long mesh_tests = 0;
+    unsigned long long medium_tests = 0;
+    unsigned long long instance_tests = 0;     // rays transformed into an instance
+    unsigned long long pdf_rejections = 0;     // paths ended because the sample pdf was too small
+    unsigned long long texture_page_loads = 0; // texture pages read from disk on a cache miss
+
+    unsigned long long bvh_node_bytes = 0;     // memory of the BVH nodes (kd-trees, grids), filled in by the caller
+
+    // wall-clock time of each stage, filled in by the caller
+    double load_secs = 0.0;
+    double bvh_build_secs = 0.0;
+    double bvh_refit_secs = 0.0;    // animation: moving objects and refitting the BVH, over all frames
+    double render_secs = 0.0;
+    double denoise_secs = 0.0;
+    double write_secs = 0.0;
+
+    unsigned long long rays() const { return camera_rays + bounce_rays; }
+    // path segments per camera ray
+    double average_path_length() const {
+        return camera_rays ? double(rays()) / camera_rays : 0.0;
+    }
+
+    void reset_counters();
+    void merge_counters(const RenderStats& other);
+    void print(std::ostream& out) const;
+    void write_json(std::ostream& out) const;
+};
+
+inline RenderStats& thread_stats() {
+    static thread_local RenderStats stats;
+    return stats;
+}
+
+#ifdef TINYRT_NO_STATS
+#define STAT_INC(counter) ((void)0)
+#else
+#define STAT_INC(counter) (++thread_stats().counter)
+#endif
+
+#endif
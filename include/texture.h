@@ -2,6 +2,8 @@
 
 #include "rtweekend.h"
 #include "perlin.h"
+#include "image.h"
+#include "mipmap.h"
 
 class Texture {
 public:
@@ -9,6 +11,20 @@ public:
 
     virtual Color3f value(float u, float v, const Point3f& p) const = 0;
 
+    // 'footprint' is the width of the ray cone in uv units (see HitRecord::footprint), textures
+    // that can filter override this overload
+    virtual Color3f value(float u, float v, const Point3f& p, float footprint) const {
+        return value(u, v, p);
+    }
+
+    // true if value() depends on p only, such textures can be baked (see BakedTexture)
+    virtual bool position_only() const { return false; }
+
+    // value() of position only textures at many points
+    virtual void values(const Point3f* points, Color3f* out, int count) const {
+        for (int i = 0; i < count; ++i)
+            out[i] = value(0.f, 0.f, points[i]);
+    }
 };
 
 class SolidColor : public Texture {
@@ -20,6 +36,8 @@ public:
         return albedo;
     }
 
+    bool position_only() const override { return true; }
+
 private:
     Color3f albedo;
 };
@@ -33,6 +51,10 @@ public:
         : inv_scale(1.f / scale), even(make_shared<SolidColor>(c1)), odd(make_shared<SolidColor>(c2)) {}
     
     Color3f value(float u, float v, const Point3f& p) const override {
+        return value(u, v, p, 0.f);
+    }
+
+    Color3f value(float u, float v, const Point3f& p, float footprint) const override {
         auto x_int = static_cast<int>(floorf(inv_scale * p.x));
         auto y_int = static_cast<int>(floorf(inv_scale * p.y));
         auto z_int = static_cast<int>(floorf(inv_scale * p.z));
@@ -41,9 +63,11 @@ public:
         bool isEven = (x_int + y_int + z_int) % 2 == 0;     // checker
         // bool isEven = pos_int % 2 == 0;
 
-        return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+        return isEven ? even->value(u, v, p, footprint) : odd->value(u, v, p, footprint);
     }
 
+    bool position_only() const override { return even->position_only() && odd->position_only(); }
+
 private:
     float inv_scale;
     shared_ptr<Texture> even;
@@ -52,20 +76,20 @@ private:
 
 class ImageTexture : public Texture {
 private:
-    shared_ptr<Image> image;
+    shared_ptr<MipMap> mipmap;
 public:
-    ImageTexture(const char* filename) : image(make_shared<Image>(filename)) {}
+    ImageTexture(const char* filename) : ImageTexture(make_shared<Image>(filename)) {}
+    // the pixels are converted into a mip pyramid (paged out when large), the texture does not keep 'image'
+    // and the caller can release it right away
+    ImageTexture(shared_ptr<Image> image) : mipmap(make_shared<MipMap>(*image)) {}
 
     Color3f value(float u, float v, const Point3f& p) const override {
-        if (image->get_height() <= 0)   return Color3f(0.f, 1.f, 1.f);
-
-        u = Interval(0.f, 1.f).clamp(u);
-        v = 1.f - Interval(0.f, 1.f).clamp(v);
-        auto i = static_cast<int>(u * image->get_width());
-        auto j = static_cast<int>(v * image->get_height());
-        Color pixel = image->get(i, j);
+        return value(u, v, p, 0.f);
+    }
 
-        return color2Vec(pixel).cutVec3();
+    Color3f value(float u, float v, const Point3f& p, float footprint) const override {
+        if (!mipmap->valid())   return Color3f(0.f, 1.f, 1.f);
+        return mipmap->lookup(u, v, footprint);
     }
 };
 
@@ -79,4 +103,16 @@ public:
     Color3f value(float u, float v, const Point3f& p) const {
         return Color3f(1.f, 1.f, 1.f) * 0.5f * (1.f + std::sin(scale * p.z + 10 * noise.turb(p, 7)));
     }
+
+    bool position_only() const override { return true; }
+
+    void values(const Point3f* points, Color3f* out, int count) const override {
+        float turb[64];
+        for (int first = 0; first < count; first += 64) {
+            int n = std::min(64, count - first);
+            noise.turb(points + first, turb, n, 7);
+            for (int i = 0; i < n; ++i)
+                out[first + i] = Color3f(1.f, 1.f, 1.f) * 0.5f * (1.f + std::sin(scale * points[first + i].z + 10 * turb[i]));
+        }
+    }
 };
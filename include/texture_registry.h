@@ -0,0 +1,43 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "texture.h"
+
+// 进程内共享的图像纹理表：同一文件只解码一次、只构建一份 mip 金字塔，
+// 所有场景与材质拿到的是同一个只读的 ImageTexture。
+class TextureRegistry {
+public:
+    // only the mip pyramid stays resident, the decoded pixels are released once it is built
+    struct Entry {
+        shared_ptr<ImageTexture> texture;
+    };
+
+    static TextureRegistry& instance();
+
+    // decode every path that is not loaded yet, one file per thread (0: all hardware threads)
+    void preload(const std::vector<std::string>& paths, int threads = 0);
+
+    // the entry for 'path', decoded on first use; 'pixels' supplies pixels that are already decoded
+    // (the scene cache) and is only used if the path is not loaded yet
+    Entry get(const std::string& path, shared_ptr<Image> pixels = nullptr);
+
+    // drop the textures no scene refers to any more
+    void release_unused();
+
+    size_t size();
+
+    // lexically simplified path used as the key, "a/./b/../c" and "a/c" name the same file
+    static std::string normalize(const std::string& path);
+
+private:
+    std::mutex mutex;
+    std::map<std::string, Entry> entries;
+
+    static Entry decode(const std::string& path, shared_ptr<Image> pixels);
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+// 仿射变换，按行存放的 3x4 矩阵 [A | t]，作用于点为 A p + t，作用于向量为 A v。
+class Transform {
+public:
+    float m[3][4];
+
+    Transform() {
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = i == j ? 1.f : 0.f;
+    }
+
+    static Transform translate(const Vec3f& offset) {
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+            t.m[i][3] = offset[i];
+        return t;
+    }
+
+    static Transform scale(const Vec3f& s) {
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+            t.m[i][i] = s[i];
+        return t;
+    }
+
+    // counterclockwise by 'degrees' looking down 'axis' towards the origin, rotate(y, a) turns x towards -z
+    // like Quad::rotate_y
+    static Transform rotate(const Vec3f& axis, float degrees) {
+        Vec3f a = axis.unit();
+        float theta = degrees_to_radians(degrees);
+        float c = std::cos(theta), s = std::sin(theta), k = 1.f - c;
+        Transform t;
+        t.m[0][0] = a.x*a.x*k + c;      t.m[0][1] = a.x*a.y*k - a.z*s;  t.m[0][2] = a.x*a.z*k + a.y*s;
+        t.m[1][0] = a.y*a.x*k + a.z*s;  t.m[1][1] = a.y*a.y*k + c;      t.m[1][2] = a.y*a.z*k - a.x*s;
+        t.m[2][0] = a.z*a.x*k - a.y*s;  t.m[2][1] = a.z*a.y*k + a.x*s;  t.m[2][2] = a.z*a.z*k + c;
+        return t;
+    }
+
+    // element-wise, not a rotation for two rotations in general; keep the angle between 'a' and 'b' small
+    static Transform lerp(const Transform& a, const Transform& b, float t) {
+        Transform r;
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 4; ++j)
+                r.m[i][j] = a.m[i][j] + t * (b.m[i][j] - a.m[i][j]);
+        return r;
+    }
+
+    // 'b' is applied first
+    Transform operator*(const Transform& b) const {
+        Transform r;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                float sum = j == 3 ? m[i][3] : 0.f;
+                for (int k = 0; k < 3; ++k)
+                    sum += m[i][k] * b.m[k][j];
+                r.m[i][j] = sum;
+            }
+        }
+        return r;
+    }
+
+    float determinant() const {
+        return m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+             - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+             + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+    }
+
+    // the caller checks that the determinant is not zero
+    Transform inverse() const {
+        float inv_det = 1.f / determinant();
+        Transform r;
+        r.m[0][0] = (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        r.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+        r.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        r.m[1][0] = (m[1][2]*m[2][0] - m[1][0]*m[2][2]) * inv_det;
+        r.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        r.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+        r.m[2][0] = (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        r.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+        r.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+        for (int i = 0; i < 3; ++i)
+            r.m[i][3] = -(r.m[i][0]*m[0][3] + r.m[i][1]*m[1][3] + r.m[i][2]*m[2][3]);
+        return r;
+    }
+
+    Point3f point(const Point3f& p) const {
+        return Point3f(m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z + m[0][3],
+                       m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z + m[1][3],
+                       m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z + m[2][3]);
+    }
+
+    Vec3f vector(const Vec3f& v) const {
+        return Vec3f(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+                     m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+                     m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z);
+    }
+
+    // transpose of the linear part; normals are mapped by the transpose of the inverse transform
+    Vec3f transposed_vector(const Vec3f& v) const {
+        return Vec3f(m[0][0]*v.x + m[1][0]*v.y + m[2][0]*v.z,
+                     m[0][1]*v.x + m[1][1]*v.y + m[2][1]*v.z,
+                     m[0][2]*v.x + m[1][2]*v.y + m[2][2]*v.z);
+    }
+
+    // bounds of the transformed box, per output axis the smaller and larger of each term (Arvo)
+    aabb box(const aabb& b) const {
+        Interval axes[3];
+        for (int i = 0; i < 3; ++i) {
+            float lo = m[i][3], hi = m[i][3];
+            for (int j = 0; j < 3; ++j) {
+                float e = m[i][j] * b.axis_interval(j).min;
+                float f = m[i][j] * b.axis_interval(j).max;
+                lo += std::min(e, f);
+                hi += std::max(e, f);
+            }
+            axes[i] = Interval(lo, hi);
+        }
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+};
+
+#endif
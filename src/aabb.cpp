@@ -1,4 +1,7 @@
 #include "aabb.h"
 
-const aabb aabb::empty = aabb(Interval::empty, Interval::empty, Interval::empty);
-const aabb aabb::universe = aabb(Interval::universe, Interval::universe, Interval::universe);
\ No newline at end of file
+// not built from Interval::empty/universe: those live in another translation unit and may not be
+// initialized yet, which made aabb::empty a padded box around the origin
+const aabb aabb::empty = aabb(Interval(), Interval(), Interval());
+const aabb aabb::universe = aabb(Interval(-INFINITY, INFINITY), Interval(-INFINITY, INFINITY),
+                                 Interval(-INFINITY, INFINITY));
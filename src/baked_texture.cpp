@@ -0,0 +1,101 @@
+#include "baked_texture.h"
+#include "parallel.h"
+
+#include <random>
+
+namespace {
+
+// random points the error is measured on, fixed so that a scene always bakes to the same grid
+const int error_samples = 4096;
+const unsigned error_seed = 0x2545F491u;
+
+// cells along the longest axis of the first grid tried
+const int first_resolution = 8;
+
+}
+
+Color3f BakedTexture::value(float u, float v, const Point3f& p) const {
+    if (grid.empty())
+        return source->value(u, v, p);
+
+    float g[3];
+    int i[3];
+    float f[3];
+    for (int a = 0; a < 3; ++a) {
+        g[a] = (p[a] - origin[a]) * inv_cell;
+        if (!(g[a] >= 0.f && g[a] <= float(dims[a] - 1)))      // outside the bounds or NaN
+            return source->value(u, v, p);
+        i[a] = std::min(int(g[a]), dims[a] - 2);
+        f[a] = g[a] - float(i[a]);
+    }
+
+    size_t sx = 1, sy = size_t(dims[0]), sz = size_t(dims[0]) * dims[1];
+    const Color3f* c = &grid[i[2] * sz + i[1] * sy + i[0]];
+    Color3f c00 = c[0] + f[0] * (c[sx] - c[0]);
+    Color3f c10 = c[sy] + f[0] * (c[sy + sx] - c[sy]);
+    Color3f c01 = c[sz] + f[0] * (c[sz + sx] - c[sz]);
+    Color3f c11 = c[sz + sy] + f[0] * (c[sz + sy + sx] - c[sz + sy]);
+    Color3f c0 = c00 + f[1] * (c10 - c00);
+    Color3f c1 = c01 + f[1] * (c11 - c01);
+    return c0 + f[2] * (c1 - c0);
+}
+
+void BakedTexture::sample_grid(int threads) {
+    float cell = 1.f / inv_cell;
+    // one row of vertices along x per task, evaluated with the batch interface of the source
+    parallel_for(dims[1] * dims[2], threads, [&](int row) {
+        int y = row % dims[1], z = row / dims[1];
+        std::vector<Point3f> points(dims[0]);
+        for (int x = 0; x < dims[0]; ++x)
+            points[x] = Point3f(origin.x + x * cell, origin.y + y * cell, origin.z + z * cell);
+        source->values(points.data(), &grid[size_t(row) * dims[0]], dims[0]);
+    });
+}
+
+bool BakedTexture::bake(const aabb& bounds, size_t max_bytes, int threads) {
+    grid.clear();
+    if (!source->position_only())
+        return false;
+
+    float extent = std::max(bounds.x.size(), std::max(bounds.y.size(), bounds.z.size()));
+    if (!(extent > 0.f) || !std::isfinite(extent))
+        return false;
+    origin = Point3f(bounds.x.min, bounds.y.min, bounds.z.min);
+
+    std::vector<Point3f> test(error_samples);
+    std::vector<Color3f> expected(error_samples);
+    std::mt19937 rng(error_seed);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    for (auto& p : test)
+        for (int a = 0; a < 3; ++a)
+            p[a] = bounds.axis_interval(a).min + unit(rng) * bounds.axis_interval(a).size();
+    source->values(test.data(), expected.data(), error_samples);
+
+    // every step has about twice the vertices of the previous one, so the grid is at most twice as large
+    // as needed and baking costs about twice the last step
+    for (int n = first_resolution; ; n = int(std::ceil(n * 1.26f))) {
+        float cell = extent / n;
+        size_t count = 1;
+        for (int a = 0; a < 3; ++a) {
+            dims[a] = std::max(2, int(std::ceil(bounds.axis_interval(a).size() / cell)) + 1);
+            count *= size_t(dims[a]);
+        }
+        if (count > max_bytes / sizeof(Color3f)) {
+            grid.clear();
+            return false;
+        }
+
+        inv_cell = 1.f / cell;
+        grid.assign(count, Color3f());
+        sample_grid(threads);
+
+        double sum = 0.0;
+        for (int i = 0; i < error_samples; ++i) {
+            Color3f d = value(0.f, 0.f, test[i]) - expected[i];
+            sum += (d.x * d.x + d.y * d.y + d.z * d.z) / 3.0;
+        }
+        rms_error = float(std::sqrt(sum / error_samples));
+        if (rms_error <= tolerance)
+            return true;
+    }
+}
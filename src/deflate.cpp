@@ -0,0 +1,235 @@
+#include "deflate.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+const size_t chunk_size = 256 * 1024;
+const int window_size = 32768;
+const int hash_bits = 15;
+const int min_match = 3;
+const int max_match = 258;
+
+const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                             35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                              3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                           513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const int dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                            8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// deflate writes bits LSB first, Huffman codes MSB first
+class BitWriter {
+public:
+    std::vector<unsigned char> bytes;
+
+    void put(uint32_t bits, int count) {
+        buffer |= bits << fill;
+        fill += count;
+        while (fill >= 8) {
+            bytes.push_back((unsigned char)(buffer & 0xff));
+            buffer >>= 8;
+            fill -= 8;
+        }
+    }
+
+    void align() {
+        if (fill > 0) put(0, 8 - fill);
+    }
+
+private:
+    uint32_t buffer = 0;
+    int fill = 0;
+};
+
+uint32_t reverse_bits(uint32_t code, int length) {
+    uint32_t r = 0;
+    for (int i = 0; i < length; ++i, code >>= 1)
+        r = (r << 1) | (code & 1);
+    return r;
+}
+
+// the fixed literal/length code of RFC 1951 section 3.2.6, already bit reversed
+struct FixedCodes {
+    uint16_t code[288];
+    uint8_t length[288];
+    uint16_t dist_code[30];
+
+    FixedCodes() {
+        for (int s = 0; s < 288; ++s) {
+            uint32_t c;
+            int n;
+            if (s < 144)      { c = 0x30 + s;          n = 8; }
+            else if (s < 256) { c = 0x190 + s - 144;   n = 9; }
+            else if (s < 280) { c = s - 256;           n = 7; }
+            else              { c = 0xc0 + s - 280;    n = 8; }
+            code[s] = uint16_t(reverse_bits(c, n));
+            length[s] = uint8_t(n);
+        }
+        for (int d = 0; d < 30; ++d)
+            dist_code[d] = uint16_t(reverse_bits(d, 5));
+    }
+};
+
+const FixedCodes& fixed_codes() {
+    static const FixedCodes codes;
+    return codes;
+}
+
+void put_symbol(BitWriter& out, int symbol) {
+    const FixedCodes& codes = fixed_codes();
+    out.put(codes.code[symbol], codes.length[symbol]);
+}
+
+void put_match(BitWriter& out, int length, int distance) {
+    int l = int(std::upper_bound(length_base, length_base + 29, length) - length_base) - 1;
+    put_symbol(out, 257 + l);
+    if (length_extra[l]) out.put(length - length_base[l], length_extra[l]);
+    int d = int(std::upper_bound(dist_base, dist_base + 30, distance) - dist_base) - 1;
+    out.put(fixed_codes().dist_code[d], 5);
+    if (dist_extra[d]) out.put(distance - dist_base[d], dist_extra[d]);
+}
+
+inline uint32_t hash3(const unsigned char* p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+// one fixed-Huffman block covering the whole chunk
+void compress_chunk(const unsigned char* data, size_t size, int max_chain, bool final, BitWriter& out) {
+    out.put(final ? 1 : 0, 1);
+    out.put(1, 2);
+
+    std::vector<int> head(1 << hash_bits, -1);
+    std::vector<int> prev(size);
+    auto insert = [&](size_t pos) {
+        if (pos + min_match > size) return;
+        uint32_t h = hash3(data + pos);
+        prev[pos] = head[h];
+        head[h] = int(pos);
+    };
+
+    size_t i = 0;
+    while (i < size) {
+        int best_length = 0, best_distance = 0;
+        if (i + min_match <= size) {
+            int limit = int(std::min<size_t>(max_match, size - i));
+            int candidate = head[hash3(data + i)];
+            for (int chain = max_chain; candidate >= 0 && chain > 0; --chain) {
+                int distance = int(i) - candidate;
+                if (distance > window_size) break;
+                const unsigned char* a = data + candidate;
+                const unsigned char* b = data + i;
+                if (a[best_length] == b[best_length]) {      // cannot beat the best match otherwise
+                    int length = 0;
+                    while (length < limit && a[length] == b[length]) ++length;
+                    if (length > best_length) {
+                        best_length = length;
+                        best_distance = distance;
+                        if (length == limit) break;
+                    }
+                }
+                candidate = prev[candidate];
+            }
+        }
+        if (best_length >= min_match) {
+            put_match(out, best_length, best_distance);
+            for (int k = 0; k < best_length; ++k)
+                insert(i + k);
+            i += best_length;
+        } else {
+            put_symbol(out, data[i]);
+            insert(i);
+            ++i;
+        }
+    }
+    put_symbol(out, 256);
+    if (!final) {
+        // sync flush: an empty stored block leaves the stream byte aligned
+        out.put(0, 3);
+        out.align();
+        out.put(0x0000, 16);
+        out.put(0xffff, 16);
+    }
+    out.align();
+}
+
+void store_chunk(const unsigned char* data, size_t size, bool final, BitWriter& out) {
+    size_t pos = 0;
+    do {
+        size_t n = std::min<size_t>(65535, size - pos);
+        bool last = final && pos + n == size;
+        out.put(last ? 1 : 0, 1);
+        out.put(0, 2);
+        out.align();
+        out.put(uint32_t(n), 16);
+        out.put(uint32_t(~n & 0xffff), 16);
+        out.bytes.insert(out.bytes.end(), data + pos, data + pos + n);
+        pos += n;
+    } while (pos < size);
+}
+
+uint32_t adler32(const unsigned char* data, size_t size) {
+    const uint32_t base = 65521;
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        size_t n = std::min<size_t>(size, 5552);     // largest n that cannot overflow b
+        size -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= base;
+        b %= base;
+    }
+    return (b << 16) | a;
+}
+
+// checksum of the concatenation from the checksums of both parts (as zlib's adler32_combine)
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t length2) {
+    const uint32_t base = 65521;
+    uint32_t rem = uint32_t(length2 % base);
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = uint32_t((uint64_t(rem) * sum1) % base);
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+    return sum1 | (sum2 << 16);
+}
+
+}   // namespace
+
+std::vector<unsigned char> zlib_compress(const unsigned char* data, size_t size, int level, int threads) {
+    static const int chain_lengths[10] = {0, 4, 8, 16, 24, 32, 48, 96, 192, 512};
+    level = std::max(0, std::min(9, level));
+    int chunk_count = std::max<int>(1, int((size + chunk_size - 1) / chunk_size));
+
+    std::vector<BitWriter> chunks(chunk_count);
+    std::vector<uint32_t> checksums(chunk_count);
+    parallel_for(chunk_count, threads, [&](int c) {
+        size_t begin = size_t(c) * chunk_size;
+        size_t n = std::min(chunk_size, size - std::min(size, begin));
+        bool final = c == chunk_count - 1;
+        if (level == 0)
+            store_chunk(data + begin, n, final, chunks[c]);
+        else
+            compress_chunk(data + begin, n, chain_lengths[level], final, chunks[c]);
+        checksums[c] = adler32(data + begin, n);
+    });
+
+    std::vector<unsigned char> out = {0x78, 0x9c};
+    uint32_t checksum = 1;
+    for (int c = 0; c < chunk_count; ++c) {
+        out.insert(out.end(), chunks[c].bytes.begin(), chunks[c].bytes.end());
+        size_t begin = size_t(c) * chunk_size;
+        checksum = adler32_combine(checksum, checksums[c], std::min(chunk_size, size - std::min(size, begin)));
+    }
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back((unsigned char)(checksum >> shift));
+    return out;
+}
@@ -0,0 +1,142 @@
+#include "denoise.h"
+#include "parallel.h"
+#include <cmath>
+
+namespace {
+
+const float albedo_epsilon = 1e-3f;
+
+inline float luminance(const float* c) {
+    return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+}
+
+// 3x3 gaussian of the variance channel, steadier than the single pixel estimate
+float filtered_variance(const FloatImage& image, int x, int y) {
+    static const float kernel[2][2] = {{1.f / 4, 1.f / 8}, {1.f / 8, 1.f / 16}};
+    int width = image.get_width(), height = image.get_height();
+    float sum = 0.f, weight_sum = 0.f;
+    for (int dy = -1; dy <= 1; ++dy) {
+        int qy = y + dy;
+        if (qy < 0 || qy >= height) continue;
+        for (int dx = -1; dx <= 1; ++dx) {
+            int qx = x + dx;
+            if (qx < 0 || qx >= width) continue;
+            float w = kernel[std::abs(dx)][std::abs(dy)];
+            sum += w * image.pixel(qx, qy)[3];
+            weight_sum += w;
+        }
+    }
+    return sum / weight_sum;
+}
+
+}   // namespace
+
+void denoise(FloatImage& color, const AOVBuffers& aovs, const DenoiseSettings& settings, int threads) {
+    int width = color.get_width();
+    int height = color.get_height();
+    const FloatImage* albedo = aovs.enabled(AOVBuffers::ALBEDO) ? &aovs.albedo : nullptr;
+    const FloatImage* normal = aovs.enabled(AOVBuffers::NORMAL) ? &aovs.normal : nullptr;
+    const FloatImage* depth = aovs.enabled(AOVBuffers::DEPTH) ? &aovs.depth : nullptr;
+
+    // demodulate: filter the illumination instead of the textured color, channel 3 holds its variance
+    FloatImage src(width, height, 4), dst(width, height, 4);
+    parallel_for(height, threads, [&](int y) {
+        for (int x = 0; x < width; ++x) {
+            const float* c = color.pixel(x, y);
+            float* out = src.pixel(x, y);
+            for (int k = 0; k < 3; ++k)
+                out[k] = albedo ? c[k] / std::max(albedo->pixel(x, y)[k], albedo_epsilon) : c[k];
+        }
+    });
+
+    // without per-sample moments the variance is estimated from the 7x7 neighborhood of every pixel
+    parallel_for(height, threads, [&](int y) {
+        for (int x = 0; x < width; ++x) {
+            float sum = 0.f, sum2 = 0.f;
+            int n = 0;
+            for (int qy = std::max(0, y - 3); qy <= std::min(height - 1, y + 3); ++qy) {
+                for (int qx = std::max(0, x - 3); qx <= std::min(width - 1, x + 3); ++qx) {
+                    float l = luminance(src.pixel(qx, qy));
+                    sum += l;
+                    sum2 += l * l;
+                    ++n;
+                }
+            }
+            float mean = sum / n;
+            src.pixel(x, y)[3] = std::max(0.f, sum2 / n - mean * mean);
+        }
+    });
+
+    static const float kernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+    float inv_sigma_normal = 1.f / settings.sigma_normal;
+    for (int it = 0; it < settings.iterations; ++it) {
+        int step = 1 << it;
+
+        parallel_for(height, threads, [&](int y) {
+            for (int x = 0; x < width; ++x) {
+                const float* cp = src.pixel(x, y);
+                float lum_p = luminance(cp);
+                float color_scale = 1.f / (settings.sigma_color * std::sqrt(filtered_variance(src, x, y)) + 1e-4f);
+                const float* np = normal ? normal->pixel(x, y) : nullptr;
+                float zp = depth ? depth->pixel(x, y)[0] : 0.f;
+                bool zp_inf = std::isinf(zp);
+                float depth_scale = 1.f / (settings.sigma_depth * std::max(zp, 1e-4f) * step);
+
+                float sum[4] = {0.f, 0.f, 0.f, 0.f};
+                float weight_sum = 0.f;
+                for (int dy = -2; dy <= 2; ++dy) {
+                    int qy = y + dy * step;
+                    if (qy < 0 || qy >= height) continue;
+                    for (int dx = -2; dx <= 2; ++dx) {
+                        int qx = x + dx * step;
+                        if (qx < 0 || qx >= width) continue;
+                        const float* cq = src.pixel(qx, qy);
+
+                        float exponent = std::fabs(lum_p - luminance(cq)) * color_scale;
+                        if (np) {
+                            const float* nq = normal->pixel(qx, qy);
+                            float cos_pq = np[0] * nq[0] + np[1] * nq[1] + np[2] * nq[2];
+                            exponent += std::max(0.f, 1.f - cos_pq) * inv_sigma_normal;
+                        }
+                        if (depth) {
+                            float zq = depth->pixel(qx, qy)[0];
+                            bool zq_inf = std::isinf(zq);
+                            if (zp_inf != zq_inf) continue;
+                            if (!zp_inf)
+                                exponent += std::fabs(zp - zq) * depth_scale;
+                        }
+
+                        // exp(-16) is below 1e-7, skipping it also keeps denormals out of the sums
+                        if (exponent > 16.f) continue;
+                        float w = kernel[dx + 2] * kernel[dy + 2] * std::exp(-exponent);
+                        sum[0] += w * cq[0];
+                        sum[1] += w * cq[1];
+                        sum[2] += w * cq[2];
+                        sum[3] += w * w * cq[3];
+                        weight_sum += w;
+                    }
+                }
+                float* out = dst.pixel(x, y);
+                if (weight_sum > 0.f) {
+                    for (int k = 0; k < 3; ++k)
+                        out[k] = sum[k] / weight_sum;
+                    out[3] = sum[3] / (weight_sum * weight_sum);
+                } else {
+                    for (int k = 0; k < 4; ++k)
+                        out[k] = cp[k];
+                }
+            }
+        });
+        std::swap(src, dst);
+    }
+
+    // remodulate
+    parallel_for(height, threads, [&](int y) {
+        for (int x = 0; x < width; ++x) {
+            const float* f = src.pixel(x, y);
+            float* c = color.pixel(x, y);
+            for (int k = 0; k < 3; ++k)
+                c[k] = albedo ? f[k] * std::max(albedo->pixel(x, y)[k], albedo_epsilon) : f[k];
+        }
+    });
+}
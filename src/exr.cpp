@@ -0,0 +1,214 @@
+#include "exr.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// 文件布局参见 OpenEXR 的 "OpenEXR File Layout" 文档：
+// magic | version | header attributes | 0 | offset table | scanline chunks
+
+namespace {
+
+typedef std::vector<unsigned char> Bytes;
+
+void put_u8(Bytes &out, unsigned char v) { out.push_back(v); }
+
+void put_u16(Bytes &out, uint16_t v) {
+	out.push_back((unsigned char)(v & 0xff));
+	out.push_back((unsigned char)(v >> 8));
+}
+
+void put_u32(Bytes &out, uint32_t v) {
+	for (int i = 0; i < 4; i++) out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+void put_u64(Bytes &out, uint64_t v) {
+	for (int i = 0; i < 8; i++) out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+void put_float(Bytes &out, float f) {
+	uint32_t v;
+	memcpy(&v, &f, 4);
+	put_u32(out, v);
+}
+
+void put_string(Bytes &out, const std::string &s) {
+	out.insert(out.end(), s.begin(), s.end());
+	out.push_back(0);
+}
+
+void put_attribute(Bytes &out, const char *name, const char *type, const Bytes &value) {
+	put_string(out, name);
+	put_string(out, type);
+	put_u32(out, uint32_t(value.size()));
+	out.insert(out.end(), value.begin(), value.end());
+}
+
+// IEEE half with round-to-nearest-even, overflow goes to infinity
+uint16_t float_to_half(float f) {
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t abs = x & 0x7fffffff;
+	if (abs >= 0x7f800000)			// inf / nan, keep nan quiet
+		return uint16_t(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 | ((abs >> 13) & 0x3ff) : 0));
+	if (abs >= 0x477ff000)			// rounds to >= 65536
+		return uint16_t(sign | 0x7c00);
+	if (abs < 0x38800000) {			// half subnormal or zero
+		if (abs < 0x33000000) return uint16_t(sign);
+		uint32_t m = (abs & 0x7fffff) | 0x800000;
+		int shift = 126 - int(abs >> 23);
+		uint32_t r = m >> shift;
+		uint32_t rem = m & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rem > halfway || (rem == halfway && (r & 1))) r++;
+		return uint16_t(sign | r);
+	}
+	uint32_t r = (abs - 0x38000000) >> 13;
+	uint32_t rem = abs & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (r & 1))) r++;	// a carry rolls into the exponent
+	return uint16_t(sign | r);
+}
+
+// OpenEXR RLE: split even/odd bytes, delta encode, then run-length encode.
+// returns an empty buffer when compression does not pay off
+Bytes rle_compress(const Bytes &raw) {
+	const int min_run = 3, max_run = 127;
+	size_t size = raw.size();
+	Bytes tmp(size);
+	size_t half = (size + 1) / 2;
+	for (size_t i = 0; i < size; i++)
+		tmp[(i & 1) ? half + i / 2 : i / 2] = raw[i];
+	int p = size ? tmp[0] : 0;
+	for (size_t i = 1; i < size; i++) {
+		int d = int(tmp[i]) - p + (128 + 256);
+		p = tmp[i];
+		tmp[i] = (unsigned char)d;
+	}
+
+	Bytes out;
+	out.reserve(size);
+	const unsigned char *in = tmp.data(), *end = tmp.data() + size;
+	const unsigned char *run_start = in, *run_end = in + 1;
+	while (run_start < end) {
+		while (run_end < end && *run_start == *run_end && run_end - run_start - 1 < max_run)
+			++run_end;
+		if (run_end - run_start >= min_run) {
+			out.push_back((unsigned char)((run_end - run_start) - 1));
+			out.push_back(*run_start);
+			run_start = run_end;
+		} else {
+			while (run_end < end &&
+				   ((run_end + 1 >= end || *run_end != *(run_end + 1)) ||
+					(run_end + 2 >= end || *(run_end + 1) != *(run_end + 2))) &&
+				   run_end - run_start < max_run)
+				++run_end;
+			out.push_back((unsigned char)(run_start - run_end));
+			while (run_start < run_end) out.push_back(*run_start++);
+		}
+		if (out.size() >= size) return Bytes();
+		++run_end;
+	}
+	return out;
+}
+
+} // namespace
+
+bool write_exr(const char *filename, std::vector<ExrChannel> channels,
+			   ExrCompression compression, ExrPixelType pixel_type, int threads) {
+	if (channels.empty()) return false;
+	int width = channels[0].image->get_width();
+	int height = channels[0].image->get_height();
+	for (const auto &c : channels) {
+		if (c.image->get_width() != width || c.image->get_height() != height ||
+			c.component < 0 || c.component >= c.image->get_channels())
+			return false;
+	}
+	// readers expect the channel list sorted by name
+	std::sort(channels.begin(), channels.end(),
+			  [](const ExrChannel &a, const ExrChannel &b) { return a.name < b.name; });
+
+	Bytes header;
+	put_u32(header, 20000630);
+	put_u32(header, 2);				// single-part scanline file
+
+	Bytes chlist;
+	for (const auto &c : channels) {
+		put_string(chlist, c.name);
+		put_u32(chlist, uint32_t(pixel_type));
+		put_u32(chlist, 0);			// pLinear + reserved
+		put_u32(chlist, 1);			// x sampling
+		put_u32(chlist, 1);			// y sampling
+	}
+	put_u8(chlist, 0);
+	put_attribute(header, "channels", "chlist", chlist);
+	put_attribute(header, "compression", "compression", Bytes(1, (unsigned char)compression));
+	Bytes window;
+	put_u32(window, 0);
+	put_u32(window, 0);
+	put_u32(window, uint32_t(width - 1));
+	put_u32(window, uint32_t(height - 1));
+	put_attribute(header, "dataWindow", "box2i", window);
+	put_attribute(header, "displayWindow", "box2i", window);
+	put_attribute(header, "lineOrder", "lineOrder", Bytes(1, 0));	// increasing y
+	Bytes one;
+	put_float(one, 1.f);
+	put_attribute(header, "pixelAspectRatio", "float", one);
+	Bytes center;
+	put_float(center, 0.f);
+	put_float(center, 0.f);
+	put_attribute(header, "screenWindowCenter", "v2f", center);
+	put_attribute(header, "screenWindowWidth", "float", one);
+	put_u8(header, 0);
+
+	// 每条扫描线一个块，各块独立压缩
+	std::vector<Bytes> chunks(height);
+	parallel_for(height, threads, [&](int y) {
+		Bytes raw;
+		raw.reserve(size_t(width) * channels.size() * (pixel_type == ExrPixelType::HALF ? 2 : 4));
+		for (const auto &c : channels) {
+			for (int x = 0; x < width; x++) {
+				float v = c.image->pixel(x, y)[c.component];
+				if (pixel_type == ExrPixelType::HALF) put_u16(raw, float_to_half(v));
+				else put_float(raw, v);
+			}
+		}
+		Bytes packed;
+		if (compression == ExrCompression::RLE) packed = rle_compress(raw);
+		const Bytes &data = packed.empty() ? raw : packed;
+		Bytes &chunk = chunks[y];
+		chunk.reserve(8 + data.size());
+		put_u32(chunk, uint32_t(y));
+		put_u32(chunk, uint32_t(data.size()));
+		chunk.insert(chunk.end(), data.begin(), data.end());
+	});
+
+	Bytes offsets;
+	uint64_t offset = header.size() + uint64_t(height) * 8;
+	for (const auto &chunk : chunks) {
+		put_u64(offsets, offset);
+		offset += chunk.size();
+	}
+
+	FILE *out = fopen(filename, "wb");
+	if (!out) return false;
+	bool ok = fwrite(header.data(), 1, header.size(), out) == header.size() &&
+			  fwrite(offsets.data(), 1, offsets.size(), out) == offsets.size();
+	for (size_t i = 0; ok && i < chunks.size(); i++)
+		ok = fwrite(chunks[i].data(), 1, chunks[i].size(), out) == chunks[i].size();
+	return (fclose(out) == 0) && ok;
+}
+
+bool write_exr(const char *filename, const FloatImage &image,
+			   ExrCompression compression, ExrPixelType pixel_type, int threads) {
+	static const char *names[] = {"R", "G", "B", "A"};
+	std::vector<ExrChannel> channels;
+	if (image.get_channels() == 1) {
+		channels.push_back(ExrChannel{"Y", &image, 0});
+	} else {
+		for (int c = 0; c < std::min(4, image.get_channels()); c++)
+			channels.push_back(ExrChannel{names[c], &image, c});
+	}
+	return write_exr(filename, channels, compression, pixel_type, threads);
+}
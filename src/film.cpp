@@ -0,0 +1,85 @@
+#include "film.h"
+#include "parallel.h"
+
+Film::Film(int width, int height, int tile_size, shared_ptr<Filter> filter)
+    : width(width), height(height), tile_size(tile_size) {
+    if (!filter)
+        filter = make_shared<BoxFilter>();
+    radius = filter->radius;
+    grow = int(std::ceil(radius));
+    table_scale = table_size / radius;
+    for (int i = 0; i < table_size; ++i)
+        table[i] = filter->evaluate_1d((i + 0.5f) / table_scale);
+
+    tiles_x = (width + tile_size - 1) / tile_size;
+    tiles_y = (height + tile_size - 1) / tile_size;
+    tiles.resize(tiles_x * tiles_y);
+    done.reset(new std::atomic<bool>[tiles.size()]);
+    for (int index = 0; index < int(tiles.size()); ++index) {
+        FilmTile& tile = tiles[index];
+        int tx = (index % tiles_x) * tile_size;
+        int ty = (index / tiles_x) * tile_size;
+        tile.x0 = std::max(0, tx - grow);
+        tile.y0 = std::max(0, ty - grow);
+        tile.width = std::min(width, tx + tile_size + grow) - tile.x0;
+        tile.height = std::min(height, ty + tile_size + grow) - tile.y0;
+        done[index].store(false);
+    }
+}
+
+FilmTile& Film::begin_tile(int index) {
+    FilmTile& tile = tiles[index];
+    tile.pixels.assign(size_t(tile.width) * tile.height, Vec4f());
+    return tile;
+}
+
+void Film::add_sample(FilmTile& tile, int i, int j, float fx, float fy, const Color3f& L) const {
+    const float below_one = 0.99999994f;
+    fx = std::min(fx, below_one);
+    fy = std::min(fy, below_one);
+    // pixels whose center lies in (p - radius, p + radius]; a box of radius 0.5 touches exactly one pixel
+    int px0 = std::max(tile.x0, i + int(std::floor(fx - radius - 0.5f)) + 1);
+    int px1 = std::min(tile.x0 + tile.width - 1, i + int(std::floor(fx + radius - 0.5f)));
+    int py0 = std::max(tile.y0, j + int(std::floor(fy - radius - 0.5f)) + 1);
+    int py1 = std::min(tile.y0 + tile.height - 1, j + int(std::floor(fy + radius - 0.5f)));
+    for (int py = py0; py <= py1; ++py) {
+        float wy = weight(float(py - j) + 0.5f - fy);
+        Vec4f* row = tile.pixels.data() + size_t(py - tile.y0) * tile.width;
+        for (int px = px0; px <= px1; ++px) {
+            float w = wy * weight(float(px - i) + 0.5f - fx);
+            Vec4f& p = row[px - tile.x0];
+            p.x += w * L.x;
+            p.y += w * L.y;
+            p.z += w * L.z;
+            p.w += w;
+        }
+    }
+}
+
+void Film::develop(FloatImage& image, int threads, bool finished_only) const {
+    parallel_for(height, threads, [&](int y) {
+        std::vector<Vec4f> sum(width);
+        int ty0 = std::max(0, (y - grow) / tile_size);
+        int ty1 = std::min(tiles_y - 1, (y + grow) / tile_size);
+        for (int index = ty0 * tiles_x; index < (ty1 + 1) * tiles_x; ++index) {
+            if (finished_only && !done[index].load(std::memory_order_acquire))
+                continue;
+            const FilmTile& tile = tiles[index];
+            if (y < tile.y0 || y >= tile.y0 + tile.height || tile.pixels.empty())
+                continue;
+            const Vec4f* row = &tile.pixels[size_t(y - tile.y0) * tile.width];
+            for (int x = 0; x < tile.width; ++x) {
+                Vec4f& s = sum[tile.x0 + x];
+                s.x += row[x].x;
+                s.y += row[x].y;
+                s.z += row[x].z;
+                s.w += row[x].w;
+            }
+        }
+        for (int x = 0; x < width; ++x) {
+            const Vec4f& s = sum[x];
+            float inv = s.w != 0.f ? 1.f / s.w : 0.f;
+            image.set(x, y, Vec4f(s.x * inv, s.y * inv, s.z * inv, 1.f));
+        }
+    });
+}
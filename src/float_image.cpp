@@ -0,0 +1,117 @@
+#include "float_image.h"
+#include "parallel.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+FloatImage::FloatImage(int w, int h, int channels)
+	: width(w), height(h), channels(channels), data(size_t(w) * h * channels, 0.f) {
+}
+
+Vec4f FloatImage::get(int x, int y) const {
+	Vec4f c(0.f, 0.f, 0.f, 1.f);
+	const float *p = pixel(x, y);
+	for (int i = 0; i < channels && i < 4; i++) c[i] = p[i];
+	return c;
+}
+
+void FloatImage::set(int x, int y, const Vec4f &c) {
+	float *p = pixel(x, y);
+	for (int i = 0; i < channels && i < 4; i++) p[i] = c[i];
+}
+
+void FloatImage::clear() {
+	std::fill(data.begin(), data.end(), 0.f);
+}
+
+static bool little_endian() {
+	unsigned int one = 1;
+	return *reinterpret_cast<unsigned char *>(&one) == 1;
+}
+
+bool FloatImage::write_pfm(const char *filename) const {
+	FILE *out = fopen(filename, "wb");
+	if (!out) return false;
+	int out_channels = channels == 1 ? 1 : 3;
+	// negative scale marks little-endian data
+	fprintf(out, "%s\n%d %d\n%s\n", out_channels == 1 ? "Pf" : "PF", width, height,
+			little_endian() ? "-1.0" : "1.0");
+	std::vector<float> line(size_t(width) * out_channels);
+	bool ok = true;
+	// PFM stores the bottom row first
+	for (int y = height - 1; y >= 0 && ok; y--) {
+		for (int x = 0; x < width; x++) {
+			const float *p = pixel(x, y);
+			for (int c = 0; c < out_channels; c++)
+				line[size_t(x) * out_channels + c] = c < channels ? p[c] : 0.f;
+		}
+		ok = fwrite(line.data(), sizeof(float), line.size(), out) == line.size();
+	}
+	return (fclose(out) == 0) && ok;
+}
+
+bool FloatImage::read_pfm(const char *filename) {
+	FILE *in = fopen(filename, "rb");
+	if (!in) return false;
+	char magic[3] = {0};
+	int w = 0, h = 0;
+	float scale = 0.f;
+	bool ok = fscanf(in, "%2s %d %d %f", magic, &w, &h, &scale) == 4 && fgetc(in) != EOF &&
+			  (!strcmp(magic, "PF") || !strcmp(magic, "Pf")) && w > 0 && h > 0 && scale != 0.f;
+	if (ok) {
+		int file_channels = magic[1] == 'F' ? 3 : 1;
+		bool swap = (scale < 0.f) != little_endian();
+		FloatImage img(w, h, file_channels == 3 ? 4 : 1);
+		std::vector<float> line(size_t(w) * file_channels);
+		for (int y = h - 1; y >= 0 && ok; y--) {
+			ok = fread(line.data(), sizeof(float), line.size(), in) == line.size();
+			for (size_t i = 0; ok && swap && i < line.size(); i++) {
+				unsigned char *b = reinterpret_cast<unsigned char *>(&line[i]);
+				std::swap(b[0], b[3]);
+				std::swap(b[1], b[2]);
+			}
+			for (int x = 0; ok && x < w; x++) {
+				const float *p = &line[size_t(x) * file_channels];
+				img.set(x, y, file_channels == 3 ? Vec4f(p[0], p[1], p[2], 1.f) : Vec4f(p[0], 0.f, 0.f, 1.f));
+			}
+		}
+		if (ok) *this = img;
+	}
+	fclose(in);
+	return ok;
+}
+
+static inline float tonemap_channel(float c, const ToneMapSettings &settings, float scale) {
+	if (!(c > 0.f)) return 0.f;		// also maps NaN to black
+	c *= scale;
+	switch (settings.op) {
+		case ToneMapSettings::CLAMP: break;
+		case ToneMapSettings::REINHARD: c = c / (1.f + c); break;
+		case ToneMapSettings::ACES: c = (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f); break;
+	}
+	if (c >= 1.f) return 1.f;
+	return settings.gamma == 2.f ? sqrtf(c) : powf(c, 1.f / settings.gamma);
+}
+
+void tonemap(const FloatImage &hdr, Image &ldr, const ToneMapSettings &settings, int threads) {
+	int width = std::min(hdr.get_width(), ldr.get_width());
+	int height = std::min(hdr.get_height(), ldr.get_height());
+	int channels = hdr.get_channels();
+	int bytespp = ldr.get_bytespp();
+	unsigned char *out = ldr.buffer();
+	float scale = exp2f(settings.exposure);
+
+	parallel_for(height, threads, [&](int y) {
+		unsigned char *dst = out + size_t(y) * ldr.get_width() * bytespp;
+		for (int x = 0; x < width; x++) {
+			const float *p = hdr.pixel(x, y);
+			for (int c = 0; c < bytespp; c++) {
+				float v;
+				if (c == 3) v = channels > 3 ? std::max(0.f, std::min(1.f, p[3])) : 1.f;
+				else v = tonemap_channel(c < channels ? p[c] : 0.f, settings, scale);
+				dst[c] = (unsigned char)(v * 255 + .5f);
+			}
+			dst += bytespp;
+		}
+	});
+}
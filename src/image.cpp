@@ -1,15 +1,22 @@
 #include "image.h"
+#include "image_io.h"
+#include <cstring>
 #include <iostream>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+// stb_image_write callback collecting the encoded file in memory, written out with write_file_atomic
+static void append_bytes(void *context, void *bytes, int size) {
+	std::vector<unsigned char> &out = *static_cast<std::vector<unsigned char> *>(context);
+	out.insert(out.end(), static_cast<unsigned char *>(bytes), static_cast<unsigned char *>(bytes) + size);
+}
 
-Image::Image() : data(NULL), width(0), height(0), bytespp(0) {
+Image::Image() : data(NULL), width(0), height(0), bytespp(0), owns_data(true) {
 }
 
-Image::Image(const char *filename) {
+Image::Image(const char *filename) : owns_data(true) {
     data = stbi_load(filename, &width, &height, &bytespp, 0);
     if (!data) {
         std::cerr << "Failed to load texture: " << stbi_failure_reason() << std::endl;
@@ -17,13 +24,17 @@ Image::Image(const char *filename) {
     }
 }
 
-Image::Image(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
+Image::Image(int w, int h, int bpp, unsigned char *pixels) : data(pixels), width(w), height(h), bytespp(bpp), owns_data(false) {
+}
+
+Image::Image(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), owns_data(true) {
 	unsigned long nbytes = width*height*bytespp;
 	data = new unsigned char[nbytes];
 	memset(data, 0, nbytes);
 }
 
 Image::Image(const Image &img) {
+	owns_data = true;
 	width = img.width;
 	height = img.height;
 	bytespp = img.bytespp;
@@ -33,7 +44,7 @@ Image::Image(const Image &img) {
 }
 
 Image::~Image() {
-	if (data) stbi_image_free(data);
+	if (data && owns_data) stbi_image_free(data);
 }
 
 void Image::read_file(const char *filename) {
@@ -45,7 +56,25 @@ void Image::read_file(const char *filename) {
 }
 
 void Image::write_png_file(const char *filename) {
-    stbi_write_png(filename, width, height, bytespp, data, 0);
+    write_file(filename, "png");
+}
+
+bool Image::write_file(const char *filename, const char *format, const ImageWriteOptions &options) {
+	if (!data) return false;
+	if (!strcmp(format, "png"))
+		return write_file_atomic(filename, encode_png(data, width, height, bytespp, options.png_level, options.threads));
+	if (!strcmp(format, "qoi")) return write_file_atomic(filename, encode_qoi(data, width, height, bytespp));
+	std::vector<unsigned char> bytes;
+	int ok;
+	if (!strcmp(format, "jpg"))
+		ok = stbi_write_jpg_to_func(append_bytes, &bytes, width, height, bytespp, data, options.jpeg_quality);
+	else if (!strcmp(format, "bmp"))
+		ok = stbi_write_bmp_to_func(append_bytes, &bytes, width, height, bytespp, data);
+	else if (!strcmp(format, "tga"))
+		ok = stbi_write_tga_to_func(append_bytes, &bytes, width, height, bytespp, data);
+	else
+		return false;
+	return ok && write_file_atomic(filename, bytes);
 }
 
 Color Image::get(int x, int y) {
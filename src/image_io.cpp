@@ -0,0 +1,188 @@
+#include "image_io.h"
+#include "deflate.h"
+#include "parallel.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+void put_be32(std::vector<unsigned char>& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back((unsigned char)(v >> shift));
+}
+
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool table_ready = [] {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)table_ready;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void put_png_chunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size) {
+    put_be32(out, uint32_t(size));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    put_be32(out, crc32(&out[start], size + 4));
+}
+
+inline int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// filter one row into 'out' (filter byte + stride bytes), trying all five filters
+void filter_row(const unsigned char* row, const unsigned char* above, int stride, int bpp, unsigned char* out) {
+    std::vector<unsigned char> candidate(stride);
+    int best_sum = -1;
+    for (int filter = 0; filter < 5; ++filter) {
+        int sum = 0;
+        for (int i = 0; i < stride; ++i) {
+            int a = i >= bpp ? row[i - bpp] : 0;
+            int b = above ? above[i] : 0;
+            int c = above && i >= bpp ? above[i - bpp] : 0;
+            int predicted = 0;
+            switch (filter) {
+                case 1: predicted = a; break;
+                case 2: predicted = b; break;
+                case 3: predicted = (a + b) >> 1; break;
+                case 4: predicted = paeth(a, b, c); break;
+            }
+            unsigned char v = (unsigned char)(row[i] - predicted);
+            candidate[i] = v;
+            sum += std::abs((signed char)v);
+        }
+        if (best_sum < 0 || sum < best_sum) {
+            best_sum = sum;
+            out[0] = (unsigned char)filter;
+            std::copy(candidate.begin(), candidate.end(), out + 1);
+        }
+    }
+}
+
+}   // namespace
+
+std::vector<unsigned char> encode_png(const unsigned char* pixels, int width, int height, int channels,
+                                      int level, int threads) {
+    static const unsigned char color_types[5] = {0, 0, 4, 2, 6};
+    int stride = width * channels;
+    std::vector<unsigned char> filtered(size_t(stride + 1) * height);
+    parallel_for(height, threads, [&](int y) {
+        const unsigned char* row = pixels + size_t(y) * stride;
+        filter_row(row, y > 0 ? row - stride : nullptr, stride, channels, &filtered[size_t(y) * (stride + 1)]);
+    });
+    std::vector<unsigned char> zlib = zlib_compress(filtered.data(), filtered.size(), level, threads);
+
+    std::vector<unsigned char> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    std::vector<unsigned char> header;
+    put_be32(header, uint32_t(width));
+    put_be32(header, uint32_t(height));
+    header.push_back(8);                       // bit depth
+    header.push_back(color_types[channels]);
+    header.push_back(0);                       // deflate
+    header.push_back(0);                       // adaptive filtering
+    header.push_back(0);                       // no interlace
+    put_png_chunk(out, "IHDR", header.data(), header.size());
+    put_png_chunk(out, "IDAT", zlib.data(), zlib.size());
+    put_png_chunk(out, "IEND", nullptr, 0);
+    return out;
+}
+
+std::vector<unsigned char> encode_qoi(const unsigned char* pixels, int width, int height, int channels) {
+    int out_channels = channels == 2 || channels == 4 ? 4 : 3;
+    std::vector<unsigned char> out = {'q', 'o', 'i', 'f'};
+    put_be32(out, uint32_t(width));
+    put_be32(out, uint32_t(height));
+    out.push_back((unsigned char)out_channels);
+    out.push_back(0);                          // sRGB with linear alpha
+    out.reserve(14 + size_t(width) * height * (out_channels + 1) + 8);
+
+    struct Rgba { unsigned char r, g, b, a; };
+    Rgba index[64] = {};
+    Rgba previous = {0, 0, 0, 255};
+    int run = 0;
+    size_t count = size_t(width) * height;
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char* p = pixels + i * channels;
+        Rgba px;
+        if (channels >= 3) px = Rgba{p[0], p[1], p[2], channels == 4 ? p[3] : (unsigned char)255};
+        else px = Rgba{p[0], p[0], p[0], channels == 2 ? p[1] : (unsigned char)255};
+
+        bool same = px.r == previous.r && px.g == previous.g && px.b == previous.b && px.a == previous.a;
+        if (same) {
+            if (++run == 62 || i + 1 == count) {
+                out.push_back((unsigned char)(0xc0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back((unsigned char)(0xc0 | (run - 1)));
+            run = 0;
+        }
+        int slot = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+        const Rgba& cached = index[slot];
+        if (cached.r == px.r && cached.g == px.g && cached.b == px.b && cached.a == px.a) {
+            out.push_back((unsigned char)slot);
+        } else {
+            index[slot] = px;
+            if (px.a == previous.a) {
+                int vr = (signed char)(px.r - previous.r);
+                int vg = (signed char)(px.g - previous.g);
+                int vb = (signed char)(px.b - previous.b);
+                int vg_r = vr - vg, vg_b = vb - vg;
+                if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1) {
+                    out.push_back((unsigned char)(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)));
+                } else if (vg >= -32 && vg <= 31 && vg_r >= -8 && vg_r <= 7 && vg_b >= -8 && vg_b <= 7) {
+                    out.push_back((unsigned char)(0x80 | (vg + 32)));
+                    out.push_back((unsigned char)((vg_r + 8) << 4 | (vg_b + 8)));
+                } else {
+                    out.push_back(0xfe);
+                    out.push_back(px.r);
+                    out.push_back(px.g);
+                    out.push_back(px.b);
+                }
+            } else {
+                out.push_back(0xff);
+                out.push_back(px.r);
+                out.push_back(px.g);
+                out.push_back(px.b);
+                out.push_back(px.a);
+            }
+        }
+        previous = px;
+    }
+    static const unsigned char end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.insert(out.end(), end_marker, end_marker + 8);
+    return out;
+}
+
+bool write_file_atomic(const char* filename, const std::vector<unsigned char>& bytes) {
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) return false;
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size();
+    ok = (fclose(out) == 0) && ok;
+    if (ok) {
+        // rename() does not replace an existing file on Windows
+        remove(filename);
+        ok = rename(tmp.c_str(), filename) == 0;
+    }
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
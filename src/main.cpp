@@ -1,351 +1,526 @@
 #include "rtweekend.h"
-#include "hittable_list.h"
 #include "raytracer.h"
-#include "Sphere.h"
 #include "image.h"
-#include "material.h"
-#include "bvh.h"
-#include "Quad.h"
-#include "mesh.h"
-#include "constant_medium.h"
+#include "float_image.h"
+#include "exr.h"
+#include "denoise.h"
+#include "filter.h"
+#include "mipmap.h"
+#include "scene.h"
+#include "scene_cache.h"
+#include <algorithm>
 #include <chrono>
-
-void bouncing_spheres() {
-    auto image = make_shared<Image>(1200, 675, Image::RGB);
-    HittableList world;
-
-    auto checker = make_shared<CheckerTexture>(0.32f, Color3f(.2f, .3f, .1f), Color3f(.9f, .9f, .9f));
-    auto ground_material = make_shared<Lambertian>(checker);
-    world.add(make_shared<Sphere>(Point3f(0.f, -1000.f, 0.f), 1000.f, ground_material));
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_float();
-            Point3f center(a + 0.9f*random_float(), 0.2f, b + 0.9f*random_float());
-            if ((center - Point3f(4.f, 0.2f, 0.f)).norm() > 0.9f) {
-                shared_ptr<Material> sphere_material;
-                if (choose_mat < 0.8f) {
-                    // diffuse
-                    auto albedo = random_vector() * random_vector();
-                    sphere_material = make_shared<Lambertian>(albedo);
-                    auto center2 = center + Vec3f(0.f, random_float(0.f, 0.5f), 0.f);
-                    world.add(make_shared<Sphere>(center, center2, 0.2f, sphere_material));
-                } else if (choose_mat < 0.95f) {
-                    // metal
-                    auto albedo = random_vector(0.5f, 1.f);
-                    auto fuzz = random_float(0.f, 0.5f);
-                    sphere_material = make_shared<Metal>(albedo, fuzz);
-                    world.add(make_shared<Sphere>(center, 0.2f, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<Dielectric>(1.5f);
-                    world.add(make_shared<Sphere>(center, 0.2f, sphere_material));
-                }
-            }
-        }
-    }
-    auto material1 = make_shared<Dielectric>(1.5f);
-    world.add(make_shared<Sphere>(Point3f(0.f, 1.f, 0.f), 1.0f, material1));
-    auto material2 = make_shared<Lambertian>(Color3f(0.4f, 0.2f, 0.1f));
-    world.add(make_shared<Sphere>(Point3f(-4.f, 1.f, 0.f), 1.0f, material2));
-    auto material3 = make_shared<Metal>(Color3f(0.7f, 0.6f, 0.5f), 0.0f);
-    world.add(make_shared<Sphere>(Point3f(4.f, 1.f, 0.f), 1.0f, material3));
-    
-    auto empty_material = make_shared<Material>();
-    HittableList highlight;
-
-    RayTracer raytracer(image);
-    raytracer.samples_per_pixel = 30;
-    raytracer.max_depth = 10;
-
-    raytracer.fovY = 20.f;
-    raytracer.eye = Point3f(13.f, 2.f, 3.f);
-    raytracer.lookat = Point3f(0.f, 0.f, 0.f);
-    
-    raytracer.defocus_angle = 0.f;
-
-    auto start = std::chrono::steady_clock::now();
-    raytracer.render(BVHNode(world), highlight);
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration<double>(end - start).count();
-    std::cout << "Raytracing time consumption: " << duration << " secs" << std::endl;
-
-    image->write_png_file("rst.png");
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+struct Options {
+    std::string scene_file = "../scenes/cornell_box.scene";
+    std::string cache_file;
+    std::string output = "rst.png";
+    std::string format;             // empty: derived from the output extension
+    std::string preview;            // progressive snapshots while rendering
+    double preview_interval = 1.0;
+    ImageWriteOptions write_options;
+    std::string hdr_output;         // extra .exr or .pfm written next to the tone mapped image
+    std::string retonemap;          // tone map this PFM instead of rendering
+    int aov_flags = 0;
+    std::string aov_output;         // empty: <output stem>_aov.exr
+    std::string pixel_filter = "box";
+    float filter_radius = 0.f;      // 0: the filter's default radius
+    TextureOptions texture;
+    LinearBVH::NodeFormat bvh_nodes = LinearBVH::FLOAT_NODES;
+    LinearBVH::NodeLayout bvh_layout = LinearBVH::DEPTH_FIRST;
+    bool denoise = false;
+    DenoiseSettings denoise_settings;
+    ToneMapSettings tonemap;
+    ExrCompression exr_compression = ExrCompression::RLE;
+    ExrPixelType exr_pixel_type = ExrPixelType::FLOAT;
+    int width = 0;                  // 0: keep the value from the scene file
+    int height = 0;
+    int spp = 0;
+    int depth = 0;
+    int threads = 0;
+    unsigned int seed = 0;
+    int repeat = 1;
+    int first_frame = -1;           // -1: the frames of the scene file
+    int last_frame = -1;
+    bool write_output = true;
+    bool json = false;
+    bool stats = false;
+    std::string stats_json;
+};
+
+static void usage(const char* prog) {
+    std::cerr <<
+        "usage: " << prog << " [options] [scene]\n"
+        "  scene               scene file (default ../scenes/cornell_box.scene)\n"
+        "  --width N           image width, height follows the scene aspect unless given\n"
+        "  --height N          image height\n"
+        "  --spp N             samples per pixel\n"
+        "  --depth N           maximum path depth\n"
+        "  --threads N         render threads, 0 uses every hardware thread (default)\n"
+        "  --seed N            random seed (default 0)\n"
+        "  -o, --output PATH   output image (default rst.png)\n"
+        "  --format FMT        png, jpg, bmp, tga, qoi, exr or pfm (default: output extension)\n"
+        "  --png-level N       PNG compression 0 (none) to 9 (default 6), compressed in parallel\n"
+        "  --jpeg-quality N    JPEG quality 1 to 100 (default 90)\n"
+        "  --preview PATH      rewrite PATH with the finished tiles while rendering (.qoi or .jpg are fastest)\n"
+        "  --preview-interval S  seconds between preview writes (default 1)\n"
+        "  --hdr PATH          also write the linear framebuffer as .exr or .pfm\n"
+        "  --exposure EV       exposure adjustment in stops before tone mapping (default 0)\n"
+        "  --tonemap OP        clamp, reinhard or aces (default clamp)\n"
+        "  --gamma G           display gamma (default 2)\n"
+        "  --exr-compression C none or rle (default rle)\n"
+        "  --exr-half          store EXR channels as half floats\n"
+        "  --retonemap PATH    tone map an existing .pfm to the output instead of rendering\n"
+        "  --pixel-filter F    reconstruction filter: box (default), gaussian, mitchell or blackman-harris\n"
+        "  --filter-radius R   filter radius in pixels (defaults: box 0.5, gaussian 1.5, others 2)\n"
+        "  --texture-filter F  image texture filtering: nearest, bilinear or trilinear (default, mip level from ray cones)\n"
+        "  --texture-cache-mb N  memory for pages of streamed textures (default 256)\n"
+        "  --texture-stream-mb N  textures whose mip pyramid exceeds N MB are paged from disk (default 256)\n"
+        "  --bake-mb N         largest grid of a texture marked 'bake' in the scene, 0 disables baking (default 256)\n"
+        "  --bvh-nodes F       BVH node bounds as float (default), 16 or 8 bit integers relative to the parent node\n"
+        "  --bvh-layout L      BVH node order: dfs (default) or treelets, page sized blocks of the likeliest nodes\n"
+        "  --aov LIST          also render albedo,normal,depth,id,samples (or all) into a layered EXR\n"
+        "  --aov-output PATH   AOV file (default <output stem>_aov.exr)\n"
+        "  --denoise           filter the image guided by albedo, normal and depth AOVs\n"
+        "  --denoise-iterations N  a-trous passes, the filter spans about 2^(N+2) pixels (default 5)\n"
+        "  --cache PATH        binary scene cache, written when missing or stale\n"
+        "  --repeat N          render N times and report the best and mean time\n"
+        "  --frames A[:B]      render frames A to B of an animated scene (default: the scene's frames),\n"
+        "                      a run of '#' in output paths becomes the frame number, else _NNNN is appended\n"
+        "  --no-output         do not write the image\n"
+        "  --json              print a machine-readable summary on stdout\n"
+        "  --stats             print render statistics\n"
+        "  --stats-json PATH   write render statistics as JSON\n";
 }
 
-void checkered_spheres() {
-    auto image = make_shared<Image>(400, 225, Image::RGB);
-    HittableList world;   
-    
-    auto checker = make_shared<CheckerTexture>(0.32f, Color3f(.2f, .3f, .1f), Color3f(.9f, .9f, .9f));
-
-    // world.add(make_shared<Sphere>(Point3f(0.f, -10.f, 0.f), 10.f, make_shared<Lambertian>(checker)));
-    // world.add(make_shared<Sphere>(Point3f(0.f, 10.f, 0.f), 10.f, make_shared<Lambertian>(checker)));
-    world.add(make_shared<Sphere>(Point3f(0.f, 0.f, 0.f), 5.f, make_shared<Lambertian>(checker)));
-    auto empty_material = make_shared<Material>();
-    HittableList highlight;
-
-    RayTracer raytracer(image);
-    raytracer.samples_per_pixel = 30;
-    raytracer.max_depth = 10;
-
-    raytracer.fovY = 20.f;
-    raytracer.eye = Point3f(13.f, 2.f, 3.f);
-    raytracer.lookat = Point3f(0.f, 0.f, 0.f);
-    
-    raytracer.defocus_angle = 0.f;
-
-    auto start = std::chrono::steady_clock::now();
-    raytracer.render(BVHNode(world), highlight);
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration<double>(end - start).count();
-    std::cout << "Raytracing time consumption: " << duration << " secs" << std::endl;
-
-    image->write_png_file("rst.png");
+static bool parse_float(const char* s, float min, float max, float& out) {
+    char* end = nullptr;
+    out = strtof(s, &end);
+    return *s && !*end && out >= min && out <= max;
 }
 
-void earth() {
-    auto image = make_shared<Image>(400, 225, Image::RGB);
-    HittableList world;  
-
-    auto earth_texture = make_shared<ImageTexture>("../images/earthmap.jpg");
-    auto earth_surface = make_shared<Lambertian>(earth_texture);
-    auto globe = make_shared<Sphere>(Point3f(0.f,0.f,0.f), 2.f, earth_surface);
-    world.add(globe);
-    auto empty_material = make_shared<Material>();
-    HittableList highlight;
-
-    RayTracer raytracer(image);
-    raytracer.samples_per_pixel = 30;
-    raytracer.max_depth = 10;
-
-    raytracer.fovY = 20.f;
-    raytracer.eye = Point3f(0.f, 0.f, 12.f);
-    raytracer.lookat = Point3f(0.f, 0.f, 0.f);
-    
-    raytracer.defocus_angle = 0.f;
-
-    auto start = std::chrono::steady_clock::now();
-    raytracer.render(BVHNode(world), highlight);
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration<double>(end - start).count();
-    std::cout << "Raytracing time consumption: " << duration << " secs" << std::endl;
-
-    image->write_png_file("rst.png");
+static std::string extension_format(const std::string& path) {
+    auto dot = path.find_last_of('.');
+    std::string format = dot == std::string::npos ? "png" : path.substr(dot + 1);
+    return format == "jpeg" ? "jpg" : format;
 }
 
-void perlin_spheres() {
-    auto image = make_shared<Image>(400, 225, Image::RGB);
-    HittableList world;
-    
-    auto pertext = make_shared<NoiseTexture>(4.f);
-    world.add(make_shared<Sphere>(Point3f(0.f, -1000.f, 0.f), 1000.f, make_shared<Lambertian>(pertext)));
-    world.add(make_shared<Sphere>(Point3f(0.f, 2.f, 0.f), 2.f, make_shared<Lambertian>(pertext)));
-
-    auto empty_material = make_shared<Material>();
-    HittableList highlight;
-    RayTracer raytracer(image);
-    raytracer.samples_per_pixel = 30;
-    raytracer.max_depth = 10;
-
-    raytracer.fovY = 20.f;
-    raytracer.eye = Point3f(13.f, 2.f, 3.f);
-    raytracer.lookat = Point3f(0.f, 0.f, 0.f);
-    
-    raytracer.defocus_angle = 0.f;
-
-    auto start = std::chrono::steady_clock::now();
-    raytracer.render(BVHNode(world), highlight);
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration<double>(end - start).count();
-    std::cout << "Raytracing time consumption: " << duration << " secs" << std::endl;
-
-    image->write_png_file("rst.png");
+static bool hdr_format(const std::string& format) {
+    return format == "exr" || format == "pfm";
 }
 
-
-void quad_mesh() {
-    auto image = make_shared<Image>(400, 400, Image::RGB);
-    HittableList world;
-
-    auto left_red = make_shared<Lambertian>(Color3f(1.0, 0.2, 0.2));
-    auto back_green = make_shared<Lambertian>(Color3f(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<Lambertian>(Color3f(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<Lambertian>(Color3f(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<Lambertian>(Color3f(0.2, 0.8, 0.8));
-
-    world.add(make_shared<Quad>(Point3f(-3,-2, 5), Vec3f(0, 0,-4), Vec3f(0, 4, 0), left_red));
-    world.add(make_shared<Mesh>(Point3f(-2,-2, 0), Vec3f(4, 0, 0), Vec3f(0, 4, 0), back_green));
-    world.add(make_shared<Quad>(Point3f( 3,-2, 1), Vec3f(0, 0, 4), Vec3f(0, 4, 0), right_blue));
-    world.add(make_shared<Quad>(Point3f(-2, 3, 1), Vec3f(4, 0, 0), Vec3f(0, 0, 4), upper_orange));
-    world.add(make_shared<Mesh>(Point3f(-2,-3, 5), Vec3f(4, 0, 0), Vec3f(0, 0,-4), lower_teal));
-
-    auto empty_material = make_shared<Material>();
-    HittableList highlight;
-
-    RayTracer raytracer(image);
-    raytracer.samples_per_pixel = 30;
-    raytracer.max_depth = 10;
-
-    raytracer.fovY = 80.f;
-    raytracer.eye = Point3f(0.f, 0.f, 9.f);
-    raytracer.lookat = Point3f(0.f, 0.f, 0.f);
-    
-    raytracer.defocus_angle = 0.f;
-
-    auto start = std::chrono::steady_clock::now();
-    raytracer.render(BVHNode(world), highlight);
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration<double>(end - start).count();
-    std::cout << "Raytracing time consumption: " << duration << " secs" << std::endl;
-
-    image->write_png_file("rst.png");
+static bool ldr_format(const std::string& format) {
+    return format == "png" || format == "jpg" || format == "bmp" || format == "tga" || format == "qoi";
 }
 
-void cornell_box() {
-    auto image = make_shared<Image>(600, 600, Image::RGB);
-
-    HittableList world;
-    auto red = make_shared<Lambertian>(Color3f(.65f, .05f, .05f));
-    auto white = make_shared<Lambertian>(Color3f(.73f, .73f, .73f));
-    auto green = make_shared<Lambertian>(Color3f(.12f, .45f, .15f));
-    auto light = make_shared<DiffuseLight>(Color3f(15.f, 15.f, 15.f));
+static bool parse_int(const char* s, long min, long max, long& out) {
+    char* end = nullptr;
+    out = strtol(s, &end, 10);
+    return *s && !*end && out >= min && out <= max;
+}
 
-    world.add(make_shared<Quad>(Point3f(555,0,0), Vec3f(0,0,555), Vec3f(0,555,0), green));
-    world.add(make_shared<Quad>(Point3f(0,0,555), Vec3f(0,0,-555), Vec3f(0,555,0), red));
-    world.add(make_shared<Quad>(Point3f(0,555,0), Vec3f(555,0,0), Vec3f(0,0,555), white));
-    world.add(make_shared<Quad>(Point3f(0,0,555), Vec3f(555,0,0), Vec3f(0,0,-555), white));
-    world.add(make_shared<Quad>(Point3f(555,0,555), Vec3f(-555,0,0), Vec3f(0,555,0), white));
-    // Light
-    world.add(make_shared<Quad>(Point3f(213,554,227), Vec3f(130,0,0), Vec3f(0,0,105), light));
+// returns false on malformed arguments
+static bool parse_options(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            usage(argv[0]);
+            exit(0);
+        }
+        if (arg == "--no-output") { opt.write_output = false; continue; }
+        if (arg == "--json") { opt.json = true; continue; }
+        if (arg == "--stats") { opt.stats = true; continue; }
+        if (arg == "--exr-half") { opt.exr_pixel_type = ExrPixelType::HALF; continue; }
+        if (arg == "--denoise") { opt.denoise = true; continue; }
+        if (arg[0] != '-') { opt.scene_file = arg; continue; }
+
+        static const char* value_options[] = {"--width", "--height", "--spp", "--depth", "--threads", "--seed",
+                                              "--repeat", "-o", "--output", "--format", "--cache", "--png-level",
+                                              "--jpeg-quality", "--preview", "--preview-interval",
+                                              "--stats-json", "--hdr", "--exposure", "--tonemap", "--gamma",
+                                              "--exr-compression", "--retonemap", "--aov", "--aov-output",
+                                              "--denoise-iterations", "--pixel-filter", "--filter-radius",
+                                              "--texture-filter", "--texture-cache-mb", "--texture-stream-mb",
+                                              "--bake-mb", "--frames", "--bvh-nodes", "--bvh-layout"};
+        if (std::find(std::begin(value_options), std::end(value_options), arg) == std::end(value_options)) {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        long n = 0;
+        bool ok = true;
+        if (arg == "--width")               { ok = parse_int(value, 1, 1 << 16, n); opt.width = int(n); }
+        else if (arg == "--height")         { ok = parse_int(value, 1, 1 << 16, n); opt.height = int(n); }
+        else if (arg == "--spp")            { ok = parse_int(value, 1, 1 << 24, n); opt.spp = int(n); }
+        else if (arg == "--depth")          { ok = parse_int(value, 1, 1 << 16, n); opt.depth = int(n); }
+        else if (arg == "--threads")        { ok = parse_int(value, 0, 1 << 12, n); opt.threads = int(n); }
+        else if (arg == "--seed")           { ok = parse_int(value, 0, 0xFFFFFFFFL, n); opt.seed = (unsigned int)n; }
+        else if (arg == "--repeat")         { ok = parse_int(value, 1, 1 << 16, n); opt.repeat = int(n); }
+        else if (arg == "--frames") {
+            std::string range = value;
+            auto colon = range.find(':');
+            long last = 0;
+            ok = parse_int(range.substr(0, colon).c_str(), 0, 1 << 24, n) &&
+                 (colon == std::string::npos || parse_int(range.substr(colon + 1).c_str(), n, 1 << 24, last));
+            opt.first_frame = int(n);
+            opt.last_frame = colon == std::string::npos ? int(n) : int(last);
+        }
+        else if (arg == "--denoise-iterations") {
+            ok = parse_int(value, 1, 10, n);
+            opt.denoise_settings.iterations = int(n);
+        }
+        else if (arg == "-o" || arg == "--output") opt.output = value;
+        else if (arg == "--format")         opt.format = value;
+        else if (arg == "--png-level")      { ok = parse_int(value, 0, 9, n); opt.write_options.png_level = int(n); }
+        else if (arg == "--jpeg-quality")   { ok = parse_int(value, 1, 100, n); opt.write_options.jpeg_quality = int(n); }
+        else if (arg == "--preview")        opt.preview = value;
+        else if (arg == "--preview-interval") {
+            float secs = 0.f;
+            ok = parse_float(value, 0.f, 3600.f, secs);
+            opt.preview_interval = secs;
+        }
+        else if (arg == "--cache")          opt.cache_file = value;
+        else if (arg == "--stats-json")     opt.stats_json = value;
+        else if (arg == "--hdr")            opt.hdr_output = value;
+        else if (arg == "--retonemap")      opt.retonemap = value;
+        else if (arg == "--aov-output")     opt.aov_output = value;
+        else if (arg == "--pixel-filter")   { opt.pixel_filter = value; ok = make_filter(opt.pixel_filter) != nullptr; }
+        else if (arg == "--filter-radius")  ok = parse_float(value, 0.5f, 8.f, opt.filter_radius);
+        else if (arg == "--texture-cache-mb")  { ok = parse_int(value, 0, 1 << 20, n); opt.texture.cache_bytes = size_t(n) << 20; }
+        else if (arg == "--texture-stream-mb") { ok = parse_int(value, 0, 1 << 20, n); opt.texture.stream_bytes = size_t(n) << 20; }
+        else if (arg == "--bake-mb")        { ok = parse_int(value, 0, 1 << 20, n); opt.texture.bake_bytes = size_t(n) << 20; }
+        else if (arg == "--aov")            { opt.aov_flags = parse_aov_flags(value); ok = opt.aov_flags >= 0; }
+        else if (arg == "--exposure")       ok = parse_float(value, -64.f, 64.f, opt.tonemap.exposure);
+        else if (arg == "--gamma")          ok = parse_float(value, 0.1f, 10.f, opt.tonemap.gamma);
+        else if (arg == "--tonemap") {
+            std::string op = value;
+            if (op == "clamp") opt.tonemap.op = ToneMapSettings::CLAMP;
+            else if (op == "reinhard") opt.tonemap.op = ToneMapSettings::REINHARD;
+            else if (op == "aces") opt.tonemap.op = ToneMapSettings::ACES;
+            else ok = false;
+        } else if (arg == "--texture-filter") {
+            std::string f = value;
+            if (f == "nearest") opt.texture.filter = TextureOptions::NEAREST;
+            else if (f == "bilinear") opt.texture.filter = TextureOptions::BILINEAR;
+            else if (f == "trilinear") opt.texture.filter = TextureOptions::TRILINEAR;
+            else ok = false;
+        } else if (arg == "--bvh-nodes") {
+            std::string f = value;
+            if (f == "float") opt.bvh_nodes = LinearBVH::FLOAT_NODES;
+            else if (f == "16") opt.bvh_nodes = LinearBVH::QUANTIZED_16;
+            else if (f == "8") opt.bvh_nodes = LinearBVH::QUANTIZED_8;
+            else ok = false;
+        } else if (arg == "--bvh-layout") {
+            std::string l = value;
+            if (l == "dfs") opt.bvh_layout = LinearBVH::DEPTH_FIRST;
+            else if (l == "treelets") opt.bvh_layout = LinearBVH::TREELETS;
+            else ok = false;
+        } else if (arg == "--exr-compression") {
+            std::string c = value;
+            if (c == "none") opt.exr_compression = ExrCompression::NONE;
+            else if (c == "rle") opt.exr_compression = ExrCompression::RLE;
+            else ok = false;
+        }
+        if (!ok) {
+            std::cerr << "invalid value '" << value << "' for " << arg << std::endl;
+            return false;
+        }
+    }
 
-    // shared_ptr<Material> aluminum = make_shared<Metal>(Color3f(0.8f, 0.85f, 0.88f), 0.0f);
-    shared_ptr<Hittable> box1 = make_shared<Box>(Point3f(0, 0, 0), Point3f(165, 330, 165), white);
-    box1->rotate_y(15);
-    box1->translate(Vec3f(265, 0, 295));
-    world.add(box1);
-    
-    auto glass = make_shared<Dielectric>(1.5);
-    shared_ptr<Hittable> sphere1 = make_shared<Sphere>(Point3f(190, 90, 190), 90, glass);
-    world.add(sphere1);
-    // shared_ptr<Hittable> box2 = make_shared<Box>(Point3f(0, 0, 0), Point3f(165, 165, 165), white);
-    // box2->rotate_y(-18);
-    // box2->translate(Vec3f(130, 0, 65));
-    // world.add(box2);
+    if (opt.format.empty())
+        opt.format = extension_format(opt.output);
+    if (!ldr_format(opt.format) && !hdr_format(opt.format)) {
+        std::cerr << "unsupported output format '" << opt.format << "'" << std::endl;
+        return false;
+    }
+    if (opt.aov_flags != 0 && opt.aov_output.empty()) {
+        auto dot = opt.output.find_last_of('.');
+        auto slash = opt.output.find_last_of("/\\");
+        bool has_ext = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        opt.aov_output = (has_ext ? opt.output.substr(0, dot) : opt.output) + "_aov.exr";
+    }
+    if (!opt.preview.empty() && !ldr_format(extension_format(opt.preview))) {
+        std::cerr << "--preview expects a png, jpg, bmp, tga or qoi path" << std::endl;
+        return false;
+    }
+    opt.write_options.threads = opt.threads;
+    if (!opt.hdr_output.empty() && !hdr_format(extension_format(opt.hdr_output))) {
+        std::cerr << "--hdr expects an .exr or .pfm path" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    // Lights sources
-    auto empty_material = shared_ptr<Material>();
-    HittableList highlights;
-    highlights.add(
-        make_shared<Quad>(Point3f(343, 554, 332), Vec3f(-130, 0, 0), Vec3f(0, 0, -105), empty_material)
-    );
-    highlights.add(sphere1);
-   
-    RayTracer raytracer(image);
-    raytracer.samples_per_pixel = 1000;
-    raytracer.max_depth = 50;
-    raytracer.background = Color3f(0.0f, 0.0f, 0.0f);
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if ((unsigned char)c < 0x20) { char buf[8]; snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+        else out += c;
+    }
+    return out + "\"";
+}
 
-    raytracer.fovY = 40.f;
-    raytracer.eye = Point3f(278.f, 278.f, -800.f);
-    raytracer.lookat = Point3f(278.f, 278.f, 0.f);
-    
-    raytracer.defocus_angle = 0.f;
+// a run of '#' in the file name becomes the zero padded frame number, without one _NNNN is appended to the stem
+static std::string frame_path(const std::string& path, int frame) {
+    auto slash = path.find_last_of("/\\");
+    size_t name = slash == std::string::npos ? 0 : slash + 1;
+    char number[32];
+    auto hash = path.find('#', name);
+    if (hash != std::string::npos) {
+        auto end = path.find_first_not_of('#', hash);
+        if (end == std::string::npos) end = path.size();
+        snprintf(number, sizeof(number), "%0*d", int(end - hash), frame);
+        return path.substr(0, hash) + number + path.substr(end);
+    }
+    snprintf(number, sizeof(number), "_%04d", frame);
+    auto dot = path.find_last_of('.');
+    if (dot == std::string::npos || dot < name)
+        return path + number;
+    return path.substr(0, dot) + number + path.substr(dot);
+}
 
-    auto start = std::chrono::steady_clock::now();
-    raytracer.render(BVHNode(world), highlights);
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration<double>(end - start).count();
-    std::cout << "Raytracing time consumption: " << duration << " secs" << std::endl;
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-    image->write_png_file("rst.png");
+// HDR formats store the framebuffer as is, everything else goes through the tone mapper
+static bool write_image(const FloatImage& hdr, const std::string& path, const std::string& format, const Options& opt) {
+    if (format == "exr")
+        return write_exr(path.c_str(), hdr, opt.exr_compression, opt.exr_pixel_type, opt.threads);
+    if (format == "pfm")
+        return hdr.write_pfm(path.c_str());
+    Image ldr(hdr.get_width(), hdr.get_height(), Image::RGB);
+    tonemap(hdr, ldr, opt.tonemap, opt.threads);
+    return ldr.write_file(path.c_str(), format.c_str(), opt.write_options);
 }
 
-void final_scene() {
-    auto image = make_shared<Image>(800, 800, Image::RGB);
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
 
-    HittableList boxes1;
-    auto ground = make_shared<Lambertian>(Color3f(0.48, 0.83, 0.53));
-    int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++) {
-        for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i*w;
-            auto z0 = -1000.0 + j*w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_float(1,101);
-            auto z1 = z0 + w;
-            boxes1.add(make_shared<Box>(Point3f(x0,y0,z0), Point3f(x1,y1,z1), ground));
+    if (!opt.retonemap.empty()) {
+        FloatImage hdr;
+        if (!hdr.read_pfm(opt.retonemap.c_str())) {
+            std::cerr << "failed to read '" << opt.retonemap << "'" << std::endl;
+            return 1;
+        }
+        if (!write_image(hdr, opt.output, opt.format, opt)) {
+            std::cerr << "failed to write '" << opt.output << "'" << std::endl;
+            return 1;
         }
+        return 0;
     }
 
-    HittableList world;
-    world.add(make_shared<BVHNode>(boxes1));
-    auto light = make_shared<DiffuseLight>(Color3f(7, 7, 7));
-    world.add(make_shared<Quad>(Point3f(123,554,147), Vec3f(300,0,0), Vec3f(0,0,265), light));
-    auto center1 = Point3f(400, 400, 200);
-    auto center2 = center1 + Vec3f(30,0,0);
-    auto sphere_material = make_shared<Lambertian>(Color3f(0.7, 0.3, 0.1));
-    world.add(make_shared<Sphere>(center1, center2, 50, sphere_material));
-    world.add(make_shared<Sphere>(Point3f(260, 150, 45), 50, make_shared<Dielectric>(1.5)));
-    world.add(make_shared<Sphere>(
-        Point3f(0, 150, 145), 50, make_shared<Metal>(Color3f(0.8, 0.8, 0.9), 1.0)
-    ));
-    auto boundary = make_shared<Sphere>(Point3f(360,150,145), 70, make_shared<Dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<ConstantMedium>(boundary, 0.2f, Color3f(0.2, 0.4, 0.9)));
-    boundary = make_shared<Sphere>(Point3f(0,0,0), 5000, make_shared<Dielectric>(1.5));
-    world.add(make_shared<ConstantMedium>(boundary, .0001f, Color3f(1,1,1)));
-    auto emat = make_shared<Lambertian>(make_shared<ImageTexture>("../images/earthmap.jpg"));
-    world.add(make_shared<Sphere>(Point3f(400,200,400), 100, emat));
-    auto pertext = make_shared<NoiseTexture>(0.2);
-    world.add(make_shared<Sphere>(Point3f(220,280,300), 80, make_shared<Lambertian>(pertext)));
-    HittableList boxes2;
-    auto white = make_shared<Lambertian>(Color3f(.73, .73, .73));
-    int ns = 1000;
-
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<Sphere>(random_vector(0, 165), 10.f, white));
+    // procedural textures draw random numbers while the scene is built
+    seed_random(opt.seed);
+    texture_options() = opt.texture;
+    TextureCache::instance().set_capacity(opt.texture.cache_bytes);
+
+    auto load_start = std::chrono::steady_clock::now();
+    SceneDesc desc;
+    Scene scene;
+    bool cache_hit = false;
+    try {
+        cache_hit = !opt.cache_file.empty() && load_scene_cache(opt.cache_file, opt.scene_file, desc, scene);
+        if (!cache_hit) {
+            desc = parse_scene_file(opt.scene_file);
+            scene = build_scene(desc);
+            if (!opt.cache_file.empty())
+                write_scene_cache(opt.cache_file, opt.scene_file, desc, scene);
+        }
+    } catch (const SceneError& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
+    // after the cache is written, it holds float nodes
+    // node formats and layouts only apply to the BVHs, kd-trees and grids are used as built
+    size_t bvh_bytes = 0;
+    for (auto& accel : scene.prototypes) {
+        if (auto bvh = std::dynamic_pointer_cast<LinearBVH>(accel)) {
+            bvh->set_node_format(opt.bvh_nodes);
+            bvh->set_node_layout(opt.bvh_layout);
+        }
+        bvh_bytes += accel->memory_bytes();
+    }
+    if (auto bvh = std::dynamic_pointer_cast<LinearBVH>(scene.world)) {
+        if (!bvh->set_node_format(opt.bvh_nodes))
+            std::cerr << "BVH nodes not quantized, the scene has moving objects" << std::endl;
+        if (!bvh->set_node_layout(opt.bvh_layout))
+            std::cerr << "BVH nodes kept depth first, quantized nodes are not reordered" << std::endl;
+    }
+    bvh_bytes += scene.world->memory_bytes();
+    double load_secs = seconds_since(load_start);
+
+    if (opt.width > 0 && opt.height == 0)
+        opt.height = std::max(1, int(float(opt.width) * desc.image_height / desc.image_width + 0.5f));
+    if (opt.height > 0 && opt.width == 0)
+        opt.width = std::max(1, int(float(opt.height) * desc.image_width / desc.image_height + 0.5f));
+    if (opt.width > 0) {
+        desc.image_width = opt.width;
+        desc.image_height = opt.height;
+    }
+    if (opt.spp > 0) desc.samples_per_pixel = opt.spp;
+    if (opt.depth > 0) desc.max_depth = opt.depth;
 
-    boxes2.rotate_y(15);
-    boxes2.translate(Vec3f(-100, 270, 395));
-    world.add(make_shared<BVHNode>(boxes2));
-
-    auto empty_material = make_shared<Material>();
-    HittableList highlights;
-
+    auto image = make_shared<FloatImage>(desc.image_width, desc.image_height, 4);
     RayTracer raytracer(image);
-    raytracer.samples_per_pixel = 500;
-    raytracer.max_depth = 40;
-    raytracer.background = Color3f(0.f, 0.f, 0.f);
-
-    raytracer.fovY = 40.f;
-    raytracer.eye = Point3f(478.f, 278.f, -600.f);
-    raytracer.lookat = Point3f(278.f, 278.f, 0.f);
-    
-    raytracer.defocus_angle = 0.f;
+    desc.setup(raytracer);
+    // the denoiser needs its guides even when they are not written out
+    int aov_flags = opt.aov_flags;
+    if (opt.denoise)
+        aov_flags |= AOVBuffers::ALBEDO | AOVBuffers::NORMAL | AOVBuffers::DEPTH;
+    if (aov_flags != 0)
+        raytracer.aovs = make_shared<AOVBuffers>(desc.image_width, desc.image_height, aov_flags);
+    raytracer.num_threads = opt.threads;
+    raytracer.filter = make_filter(opt.pixel_filter, opt.filter_radius);
+    if (!opt.preview.empty()) {
+        std::string preview_format = extension_format(opt.preview);
+        raytracer.preview_interval = opt.preview_interval;
+        // runs on a render thread, keep it single threaded and cheap
+        Options preview_opt = opt;
+        preview_opt.threads = 1;
+        preview_opt.write_options.threads = 1;
+        preview_opt.write_options.png_level = std::min(opt.write_options.png_level, 1);
+        raytracer.preview = [=](const FloatImage& snapshot) {
+            write_image(snapshot, preview_opt.preview, preview_format, preview_opt);
+        };
+    }
 
-    auto start = std::chrono::steady_clock::now();
-    raytracer.render(BVHNode(world), highlights);
-    auto end = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration<double>(end - start).count();
-    std::cout << "Raytracing time consumption: " << duration << " secs" << std::endl;
+    // a sequence renders every frame with the scene, textures, prototype BVHs and render threads of the first
+    int first_frame = opt.first_frame >= 0 ? opt.first_frame : desc.first_frame;
+    int last_frame = opt.first_frame >= 0 ? opt.last_frame : desc.last_frame;
+    bool sequence = opt.first_frame >= 0 || desc.last_frame > desc.first_frame;
+    if (sequence && opt.repeat > 1) {
+        std::cerr << "--repeat cannot be combined with a frame sequence" << std::endl;
+        return 2;
+    }
+    if (sequence)
+        raytracer.pool = make_shared<ThreadPool>(opt.threads);
+
+    RenderStats stats;
+    double best_secs = 0.0, total_secs = 0.0, refit_secs = 0.0, denoise_secs = 0.0, write_secs = 0.0;
+    for (int frame = first_frame; frame <= last_frame; ++frame) {
+        auto refit_start = std::chrono::steady_clock::now();
+        int moved = set_scene_frame(desc, scene, float(frame));
+        desc.setup(raytracer, float(frame));
+        raytracer.seed = RayTracer::frame_seed(opt.seed, frame);
+        refit_secs += seconds_since(refit_start);
+
+        double frame_secs = 0.0;
+        for (int run = 0; run < opt.repeat; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            raytracer.render(*scene.world, scene.highlights);
+            double secs = seconds_since(start);
+            frame_secs = run == 0 ? secs : std::min(frame_secs, secs);
+            total_secs += secs;
+            if (!opt.json && !sequence)
+                std::cout << "Raytracing time consumption: " << secs << " secs" << std::endl;
+        }
+        best_secs += frame_secs;
+        stats.merge_counters(raytracer.stats);
 
-    image->write_png_file("rst.png");
+        if (opt.denoise) {
+            auto start = std::chrono::steady_clock::now();
+            denoise(*image, *raytracer.aovs, opt.denoise_settings, opt.threads);
+            denoise_secs += seconds_since(start);
+        }
+        // leave the preview showing the finished frame
+        if (raytracer.preview)
+            raytracer.preview(*image);
+
+        if (opt.write_output) {
+            auto start = std::chrono::steady_clock::now();
+            std::string output = sequence ? frame_path(opt.output, frame) : opt.output;
+            if (!write_image(*image, output, opt.format, opt)) {
+                std::cerr << "failed to write '" << output << "'" << std::endl;
+                return 1;
+            }
+            std::string hdr_output = sequence ? frame_path(opt.hdr_output, frame) : opt.hdr_output;
+            if (!opt.hdr_output.empty() &&
+                !write_image(*image, hdr_output, extension_format(hdr_output), opt)) {
+                std::cerr << "failed to write '" << hdr_output << "'" << std::endl;
+                return 1;
+            }
+            if (opt.aov_flags != 0) {
+                // the beauty pass is the unnamed default layer, the AOVs are named layers
+                std::vector<ExrChannel> channels = {{"R", image.get(), 0}, {"G", image.get(), 1},
+                                                    {"B", image.get(), 2}, {"A", image.get(), 3}};
+                auto aov_channels = raytracer.aovs->exr_channels();
+                channels.insert(channels.end(), aov_channels.begin(), aov_channels.end());
+                std::string aov_output = sequence ? frame_path(opt.aov_output, frame) : opt.aov_output;
+                if (!write_exr(aov_output.c_str(), channels, opt.exr_compression, opt.exr_pixel_type, opt.threads)) {
+                    std::cerr << "failed to write '" << aov_output << "'" << std::endl;
+                    return 1;
+                }
+            }
+            write_secs += seconds_since(start);
+        }
+        if (sequence && !opt.json)
+            std::cout << "Frame " << frame << ": " << frame_secs << " secs, " << moved << " objects moved" << std::endl;
+    }
 
-}
+    stats.load_secs = load_secs;
+    stats.bvh_build_secs = scene.bvh_build_secs;
+    stats.bvh_node_bytes = bvh_bytes;
+    stats.bvh_refit_secs = refit_secs;
+    stats.render_secs = best_secs;
+    stats.denoise_secs = denoise_secs;
+    stats.write_secs = write_secs;
+    if (opt.stats)
+        stats.print(opt.json ? std::cerr : std::cout);
+    if (!opt.stats_json.empty()) {
+        std::ofstream out(opt.stats_json.c_str());
+        stats.write_json(out);
+        if (!out) {
+            std::cerr << "failed to write '" << opt.stats_json << "'" << std::endl;
+            return 1;
+        }
+    }
 
-int main() {
-    switch (7) {
-        case 1: bouncing_spheres(); break;
-        case 2: checkered_spheres(); break;
-        case 3: earth(); break;
-        case 4: perlin_spheres(); break;
-        case 5: quad_mesh(); break;
-        case 7: cornell_box(); break;
-        case 9: final_scene(); break;
+    int frame_count = last_frame - first_frame + 1;
+    double rays_per_sec = best_secs > 0.0 ? stats.rays() / best_secs : 0.0;
+    if (opt.json) {
+        std::cout << "{\"scene\": " << json_string(opt.scene_file)
+                  << ", \"width\": " << desc.image_width
+                  << ", \"height\": " << desc.image_height
+                  << ", \"spp\": " << raytracer.samples_per_pixel_used()
+                  << ", \"max_depth\": " << desc.max_depth
+                  << ", \"threads\": " << raytracer.threads_used
+                  << ", \"seed\": " << opt.seed
+                  << ", \"frames\": " << frame_count
+                  << ", \"cache_hit\": " << (cache_hit ? "true" : "false")
+                  << ", \"load_secs\": " << load_secs
+                  << ", \"render_secs\": " << best_secs
+                  << ", \"render_secs_mean\": " << total_secs / opt.repeat
+                  << ", \"refit_secs\": " << refit_secs
+                  << ", \"denoise_secs\": " << denoise_secs
+                  << ", \"write_secs\": " << write_secs
+                  << ", \"rays\": " << stats.rays()
+                  << ", \"rays_per_sec\": " << rays_per_sec
+                  << ", \"output\": " << (opt.write_output ? json_string(opt.output) : "null")
+                  << ", \"aov_output\": " << (opt.write_output && opt.aov_flags ? json_string(opt.aov_output) : "null")
+                  << "}" << std::endl;
+    } else {
+        std::cout << "Scene loading time consumption: " << load_secs << " secs"
+                  << (cache_hit ? " (cached)" : "") << std::endl;
+        if (sequence)
+            std::cout << "Rendered " << frame_count << " frames in " << best_secs << " secs (BVH refit "
+                      << refit_secs << " secs)" << std::endl;
+        std::cout << "Rays traced: " << stats.rays() << " (" << rays_per_sec / 1e6 << " Mrays/s)" << std::endl;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,289 @@
+#include "mipmap.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+TextureOptions& texture_options() {
+    static TextureOptions options;
+    return options;
+}
+
+TextureCache& TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+void TextureCache::set_capacity(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity_bytes = bytes;
+    trim();
+}
+
+size_t TextureCache::resident_bytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size() * sizeof(TexturePage);
+}
+
+void TextureCache::evict(uint64_t texture_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = lru.begin(); it != lru.end();) {
+        if ((it->key >> 32) == texture_id) {
+            entries.erase(it->key);
+            it = lru.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// the page just inserted is always kept, even with a capacity below one page
+void TextureCache::trim() {
+    while (lru.size() > 1 && lru.size() * sizeof(TexturePage) > capacity_bytes) {
+        entries.erase(lru.back().key);
+        lru.pop_back();
+    }
+}
+
+namespace {
+
+inline uint32_t pack_rgba(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+    return uint32_t(r) | (uint32_t(g) << 8) | (uint32_t(b) << 16) | (uint32_t(a) << 24);
+}
+
+inline Color3f unpack_rgb(uint32_t texel) {
+    const float scale = 1.f / 255.f;
+    return Color3f(float(texel & 0xff) * scale, float((texel >> 8) & 0xff) * scale, float((texel >> 16) & 0xff) * scale);
+}
+
+// 2x2 box filter, the last row/column of an odd sized level is folded into its neighbour
+std::vector<uint32_t> downsample(const std::vector<uint32_t>& src, int w, int h, int w2, int h2) {
+    std::vector<uint32_t> dst(size_t(w2) * h2);
+    for (int y = 0; y < h2; ++y) {
+        int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+        for (int x = 0; x < w2; ++x) {
+            int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+            uint32_t a = src[size_t(y0) * w + x0], b = src[size_t(y0) * w + x1];
+            uint32_t c = src[size_t(y1) * w + x0], d = src[size_t(y1) * w + x1];
+            uint32_t texel = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+                texel |= ((sum + 2) >> 2) << shift;
+            }
+            dst[size_t(y) * w2 + x] = texel;
+        }
+    }
+    return dst;
+}
+
+// pages start on a cache line so every 4x4 Morton block is one line
+TexturePage* allocate_pages(size_t count) {
+    void* p = nullptr;
+#ifdef _WIN32
+    p = _aligned_malloc(count * sizeof(TexturePage), texture_page_align);
+#else
+    if (posix_memalign(&p, texture_page_align, count * sizeof(TexturePage)) != 0)
+        p = nullptr;
+#endif
+    if (!p) {
+        std::cerr << "Failed to allocate " << count * sizeof(TexturePage) << " bytes of texture pages" << std::endl;
+        exit(-1);
+    }
+    return static_cast<TexturePage*>(p);
+}
+
+void free_pages(TexturePage* pages) {
+#ifdef _WIN32
+    _aligned_free(pages);
+#else
+    free(pages);
+#endif
+}
+
+std::atomic<uint64_t> next_texture_id(1);
+
+// 每个线程最近用过的页，按 (纹理, 页号) 直接映射
+struct PageSlot {
+    uint64_t texture_id = 0;
+    uint32_t page = 0;
+    std::shared_ptr<const TexturePage> data;
+};
+
+const int page_slot_count = 64;
+
+PageSlot* page_slots() {
+    static thread_local PageSlot slots[page_slot_count];
+    return slots;
+}
+
+}
+
+MipMap::MipMap(Image& image) : filter(texture_options().filter), lod_scale(0.f), id(next_texture_id++) {
+    int w = image.get_width(), h = image.get_height(), bpp = image.get_bytespp();
+    const unsigned char* src = image.buffer();
+    if (w <= 0 || h <= 0 || !src)
+        return;
+
+    std::vector<uint32_t> texels(size_t(w) * h);
+    for (size_t i = 0; i < texels.size(); ++i, src += bpp) {
+        switch (bpp) {
+            case 1:  texels[i] = pack_rgba(src[0], src[0], src[0], 255); break;
+            case 2:  texels[i] = pack_rgba(src[0], src[0], src[0], src[1]); break;
+            case 3:  texels[i] = pack_rgba(src[0], src[1], src[2], 255); break;
+            default: texels[i] = pack_rgba(src[0], src[1], src[2], src[3]); break;
+        }
+    }
+
+    for (int lw = w, lh = h;; lw = std::max(1, lw / 2), lh = std::max(1, lh / 2)) {
+        int pages_x = (lw + texture_page_size - 1) >> texture_page_shift;
+        int pages_y = (lh + texture_page_size - 1) >> texture_page_shift;
+        levels.push_back(Level{lw, lh, pages_x, page_count});
+        page_count += uint32_t(pages_x * pages_y);
+        if (lw == 1 && lh == 1)
+            break;
+    }
+    lod_scale = std::sqrt(float(w) * float(h));
+
+    if (bytes() > texture_options().stream_bytes) {
+        page_file = std::tmpfile();
+        if (!page_file)
+            std::cerr << "Failed to create texture page file, keeping the texture in memory" << std::endl;
+    }
+    if (!streamed())
+        pages = allocate_pages(page_count);
+
+    std::vector<TexturePage> staging;
+    for (size_t li = 0; li < levels.size(); ++li) {
+        const Level& level = levels[li];
+        int pages_y = (level.height + texture_page_size - 1) >> texture_page_shift;
+        TexturePage* out;
+        if (streamed()) {
+            staging.assign(size_t(level.pages_x) * pages_y, TexturePage());
+            out = staging.data();
+        } else {
+            out = pages + level.first_page;
+            std::fill(out, out + size_t(level.pages_x) * pages_y, TexturePage());
+        }
+        for (int y = 0; y < level.height; ++y) {
+            for (int x = 0; x < level.width; ++x) {
+                TexturePage& page = out[(y >> texture_page_shift) * level.pages_x + (x >> texture_page_shift)];
+                page.texels[texel_index(x, y)] = texels[size_t(y) * level.width + x];
+            }
+        }
+        if (streamed() && std::fwrite(staging.data(), sizeof(TexturePage), staging.size(), page_file) != staging.size()) {
+            std::cerr << "Failed to write texture page file" << std::endl;
+            exit(-1);
+        }
+        if (li + 1 < levels.size())
+            texels = downsample(texels, level.width, level.height, levels[li + 1].width, levels[li + 1].height);
+    }
+}
+
+MipMap::~MipMap() {
+    if (pages)
+        free_pages(pages);
+    if (page_file) {
+        std::fclose(page_file);
+        TextureCache::instance().evict(id);
+    }
+}
+
+// page files of huge textures pass 2 GB, beyond a 32 bit long (Win32)
+static int seek_file(FILE* file, int64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, off_t(offset), SEEK_SET);
+#endif
+}
+
+std::shared_ptr<const TexturePage> MipMap::load_page(uint32_t page) const {
+    STAT_INC(texture_page_loads);
+    std::shared_ptr<TexturePage> data(allocate_pages(1), free_pages);
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (seek_file(page_file, int64_t(page) * int64_t(sizeof(TexturePage))) != 0 ||
+        std::fread(data->texels, sizeof(TexturePage), 1, page_file) != 1) {
+        std::cerr << "Failed to read texture page " << page << std::endl;
+        exit(-1);
+    }
+    return data;
+}
+
+const TexturePage* MipMap::cached_page(uint32_t page) const {
+    PageSlot& slot = page_slots()[(page ^ uint32_t(id * 0x9E3779B9u)) & (page_slot_count - 1)];
+    if (slot.texture_id != id || slot.page != page || !slot.data) {
+        slot.data = TextureCache::instance().fetch(id, page, [&]() { return load_page(page); });
+        slot.texture_id = id;
+        slot.page = page;
+    }
+    return slot.data.get();
+}
+
+Color3f MipMap::bilinear(int level_index, float x, float y) const {
+    const Level& level = levels[level_index];
+    x -= 0.5f;
+    y -= 0.5f;
+    float fx = std::floor(x), fy = std::floor(y);
+    float tx = x - fx, ty = y - fy;
+    int x0 = int(fx), y0 = int(fy);
+    int x1 = std::min(x0 + 1, level.width - 1), y1 = std::min(y0 + 1, level.height - 1);
+    x0 = std::max(0, std::min(x0, level.width - 1));
+    y0 = std::max(0, std::min(y0, level.height - 1));
+    x1 = std::max(0, x1);
+    y1 = std::max(0, y1);
+
+    // the four texels usually share a page, look it up once
+    uint32_t t00, t10, t01, t11;
+    if (((x0 ^ x1) | (y0 ^ y1)) >> texture_page_shift == 0) {
+        const TexturePage* page = page_at(level, x0, y0);
+        t00 = page->texels[texel_index(x0, y0)];
+        t10 = page->texels[texel_index(x1, y0)];
+        t01 = page->texels[texel_index(x0, y1)];
+        t11 = page->texels[texel_index(x1, y1)];
+    } else {
+        t00 = texel(level, x0, y0);
+        t10 = texel(level, x1, y0);
+        t01 = texel(level, x0, y1);
+        t11 = texel(level, x1, y1);
+    }
+
+    Color3f top = unpack_rgb(t00) * (1.f - tx) + unpack_rgb(t10) * tx;
+    Color3f bottom = unpack_rgb(t01) * (1.f - tx) + unpack_rgb(t11) * tx;
+    return top * (1.f - ty) + bottom * ty;
+}
+
+Color3f MipMap::lookup(float u, float v, float footprint) const {
+    const Level& base = levels[0];
+    u = std::min(std::max(u, 0.f), 1.f);
+    v = 1.f - std::min(std::max(v, 0.f), 1.f);
+
+    if (filter == TextureOptions::NEAREST) {
+        int i = std::min(int(u * base.width), base.width - 1);
+        int j = std::min(int(v * base.height), base.height - 1);
+        return unpack_rgb(texel(base, i, j));
+    }
+
+    // 光锥覆盖的 texel 数取对数即为 mip 级别；像素内的抖动采样本身已在像素宽度上积分，
+    // 因此预滤波只取半个光锥宽度(级别减 1)，否则远处纹理会过度模糊
+    float lod = 0.f;
+    if (filter == TextureOptions::TRILINEAR && footprint > 0.f)
+        lod = std::min(std::log2(footprint * lod_scale) - 1.f, float(levels.size() - 1));
+    if (!(lod > 0.f))
+        return bilinear(0, u * base.width, v * base.height);
+
+    int l0 = int(lod);
+    float t = lod - float(l0);
+    Color3f c0 = bilinear(l0, u * levels[l0].width, v * levels[l0].height);
+    if (t <= 0.f || l0 + 1 >= level_count())
+        return c0;
+    Color3f c1 = bilinear(l0 + 1, u * levels[l0 + 1].width, v * levels[l0 + 1].height);
+    return c0 * (1.f - t) + c1 * t;
+}
@@ -0,0 +1,179 @@
+#include "perlin.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TINYRT_PERLIN_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+inline float fade(float x) {
+    float x2 = x*x;
+    return x2*x*(10-15*x+6*x2);
+}
+
+inline float lerp(float a, float b, float t) {
+    return a + t*(b-a);
+}
+
+// 'hash & 15' picks one of the 16 gradients of Perlin's improved noise: u + v where u is x or y, v is y, x or z,
+// and bits 0 and 1 flip their signs. Tabulated so the scalar path has no data dependent branches.
+const unsigned char grad_u[16] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1};
+const unsigned char grad_v[16] = {1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 0, 2, 0, 2};
+const float grad_sign[4] = {1.f, -1.f, 1.f, -1.f};
+
+inline float grad(int hash, float x, float y, float z) {
+    int h = hash & 15;
+    const float xyz[3] = {x, y, z};
+    return grad_sign[h & 1] * xyz[grad_u[h]] + grad_sign[(h >> 1) & 1] * xyz[grad_v[h]];
+}
+
+#ifdef TINYRT_PERLIN_SSE2
+inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 fade4(__m128 x) {
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 poly = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(10.f), _mm_mul_ps(_mm_set1_ps(15.f), x)),
+                             _mm_mul_ps(_mm_set1_ps(6.f), x2));
+    return _mm_mul_ps(_mm_mul_ps(x2, x), poly);
+}
+
+inline __m128 lerp4(__m128 a, __m128 b, __m128 t) {
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+inline __m128 grad4(__m128i hash, __m128 x, __m128 y, __m128 z) {
+    __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+    __m128 lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+    __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+    __m128 use_x = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_or_si128(h, _mm_set1_epi32(2)), _mm_set1_epi32(14)));
+    __m128 u = select(lt8, x, y);
+    __m128 v = select(lt4, y, select(use_x, x, z));
+    __m128 sign_u = _mm_castsi128_ps(_mm_slli_epi32(h, 31));
+    __m128 sign_v = _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(h, 1), 31));
+    return _mm_add_ps(_mm_xor_ps(u, sign_u), _mm_xor_ps(v, sign_v));
+}
+#endif
+
+}
+
+float Perlin::noise(const Point3f& p) const {
+    float fx = std::floor(p.x), fy = std::floor(p.y), fz = std::floor(p.z);
+    float x = p.x - fx, y = p.y - fy, z = p.z - fz;
+
+    int hash[8];
+    corner_hashes(int(fx), int(fy), int(fz), hash, 1);
+
+    float c[8];
+    for (int n = 0; n < 8; ++n)
+        c[n] = grad(hash[n], (n & 4) ? x - 1.f : x, (n & 2) ? y - 1.f : y, (n & 1) ? z - 1.f : z);
+
+    auto u = fade(x);
+    auto v = fade(y);
+    auto w = fade(z);
+    float c00 = lerp(c[0], c[4], u), c01 = lerp(c[1], c[5], u);
+    float c10 = lerp(c[2], c[6], u), c11 = lerp(c[3], c[7], u);
+    return lerp(lerp(c00, c10, v), lerp(c01, c11, v), w);
+}
+
+void Perlin::noise4(const float* px, const float* py, const float* pz, float* out) const {
+#ifdef TINYRT_PERLIN_SSE2
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 p[3] = {_mm_loadu_ps(px), _mm_loadu_ps(py), _mm_loadu_ps(pz)};
+    __m128 f[3], f1[3];
+    alignas(16) int cell[3][4];
+    for (int a = 0; a < 3; ++a) {
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(p[a]));
+        t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, p[a]), one));     // floor
+        _mm_store_si128(reinterpret_cast<__m128i*>(cell[a]), _mm_cvttps_epi32(t));
+        f[a] = _mm_sub_ps(p[a], t);
+        f1[a] = _mm_sub_ps(f[a], one);
+    }
+
+    // the permutation lookups have no SIMD gather in SSE2, everything after them is 4 wide
+    alignas(16) int hash[8][4];
+    for (int lane = 0; lane < 4; ++lane)
+        corner_hashes(cell[0][lane], cell[1][lane], cell[2][lane], &hash[0][lane], 4);
+
+    __m128 c[8];
+    for (int n = 0; n < 8; ++n)
+        c[n] = grad4(_mm_load_si128(reinterpret_cast<const __m128i*>(hash[n])),
+                     (n & 4) ? f1[0] : f[0], (n & 2) ? f1[1] : f[1], (n & 1) ? f1[2] : f[2]);
+
+    __m128 u = fade4(f[0]), v = fade4(f[1]), w = fade4(f[2]);
+    __m128 c00 = lerp4(c[0], c[4], u), c01 = lerp4(c[1], c[5], u);
+    __m128 c10 = lerp4(c[2], c[6], u), c11 = lerp4(c[3], c[7], u);
+    _mm_storeu_ps(out, lerp4(lerp4(c00, c10, v), lerp4(c01, c11, v), w));
+#else
+    for (int lane = 0; lane < 4; ++lane)
+        out[lane] = noise(Point3f(px[lane], py[lane], pz[lane]));
+#endif
+}
+
+float Perlin::turb(const Point3f& p, int layer) const {
+    auto accum = 0.f;
+    auto temp_p = p;
+    auto weight = 1.f;
+
+    // four octaves per noise4() call
+    for (int first = 0; first < layer; first += 4) {
+        float x[4], y[4], z[4], n[4];
+        for (int o = 0; o < 4; ++o) {
+            x[o] = temp_p.x;
+            y[o] = temp_p.y;
+            z[o] = temp_p.z;
+            temp_p *= 2.f;
+        }
+        noise4(x, y, z, n);
+        for (int o = 0; o < 4 && first + o < layer; ++o) {
+            accum += weight * n[o];
+            weight *= 0.5f;
+        }
+    }
+    return std::fabs(accum);
+}
+
+void Perlin::noise(const Point3f* points, float* out, int count) const {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float x[4], y[4], z[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            x[lane] = points[i + lane].x;
+            y[lane] = points[i + lane].y;
+            z[lane] = points[i + lane].z;
+        }
+        noise4(x, y, z, out + i);
+    }
+    for (; i < count; ++i)
+        out[i] = noise(points[i]);
+}
+
+void Perlin::turb(const Point3f* points, float* out, int count, int layer) const {
+    int i = 0;
+    // four points per noise4() call, one call per octave
+    for (; i + 4 <= count; i += 4) {
+        float x[4], y[4], z[4], n[4], accum[4] = {0.f, 0.f, 0.f, 0.f};
+        for (int lane = 0; lane < 4; ++lane) {
+            x[lane] = points[i + lane].x;
+            y[lane] = points[i + lane].y;
+            z[lane] = points[i + lane].z;
+        }
+        auto weight = 1.f;
+        for (int o = 0; o < layer; ++o) {
+            noise4(x, y, z, n);
+            for (int lane = 0; lane < 4; ++lane) {
+                accum[lane] += weight * n[lane];
+                x[lane] *= 2.f;
+                y[lane] *= 2.f;
+                z[lane] *= 2.f;
+            }
+            weight *= 0.5f;
+        }
+        for (int lane = 0; lane < 4; ++lane)
+            out[i + lane] = std::fabs(accum[lane]);
+    }
+    for (; i < count; ++i)
+        out[i] = turb(points[i], layer);
+}
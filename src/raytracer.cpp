@@ -1,6 +1,12 @@
 #include "raytracer.h"
+#include "parallel.h"
 
-RayTracer::RayTracer(shared_ptr<Image> img) {
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+RayTracer::RayTracer(shared_ptr<FloatImage> img) {
     this->image = img;
 }
 
@@ -26,32 +32,120 @@ void RayTracer::init() {
 
     pixel_delta_u = viewport_u / float(image_width);
     pixel_delta_v = viewport_v / float(image_height);
+    pixel_spread = pixel_delta_v.norm() / focus_dist;      // angle subtended by one pixel
 
     Vec3f viewport_upper_left = center - (focus_dist * z_cam) - viewport_u/2.f - viewport_v/2.f;
     pixel00_loc = viewport_upper_left + 0.5f * (pixel_delta_u + pixel_delta_v);
     auto defocus_radius = focus_dist * tanf(degrees_to_radians(defocus_angle / 2.f));
     defocus_disk_u = x_cam * defocus_radius;
     defocus_disk_v = y_cam * defocus_radius;
+
+    tiles_x = (image_width + tile_size - 1) / tile_size;
+    tiles_y = (image_height + tile_size - 1) / tile_size;
 }
 
 void RayTracer::render(const Hittable &world, const HittableList& highlights) {
     init();
-    for (int i = 0; i < image_width; ++i) {
-        for (int j = 0; j < image_height; ++j) {
-            Vec3f pixel_color;
-            // for (int sample = 0; sample < samples_per_pixel; ++sample) {
-            //     Ray r = get_sample_ray(i, j);
-            //     pixel_color += ray_color(r, max_depth, world);
-            // }
-            // pixel_color = pixel_color / float(samples_per_pixel);
+    int tile_count = tiles_x * tiles_y;
+    int threads = pool ? pool->size() : std::max(1, std::min(resolve_thread_count(num_threads), tile_count));
+    threads_used = threads;
+
+    // 图块按原子计数器动态分配给各线程
+    // 每个线程的计数器写入各自的槽位，join 之后再汇总
+    // 样本先溅射到各图块自己的胶片缓冲，所有线程结束后再统一合并
+    Film film(image_width, image_height, tile_size, filter);
+    std::atomic<int> next_tile(0);
+    std::vector<RenderStats> thread_results(threads);
+    auto last_preview = std::chrono::steady_clock::now();
+    auto worker = [&](int index) {
+        thread_stats().reset_counters();
+        for (int tile = next_tile++; tile < tile_count; tile = next_tile++) {
+            render_tile(tile, film, world, highlights);
+            film.end_tile(tile);
+            if (preview && index == 0 && tile + 1 < tile_count &&
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - last_preview).count() >= preview_interval) {
+                FloatImage snapshot(image_width, image_height, 4);
+                film.develop(snapshot, 1, true);
+                preview(snapshot);
+                last_preview = std::chrono::steady_clock::now();
+            }
+        }
+        thread_results[index] = thread_stats();
+    };
+
+    if (pool) {
+        pool->run(worker);
+    } else {
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; ++t)
+            workers.emplace_back(worker, t);
+        worker(0);
+        for (auto& th : workers)
+            th.join();
+    }
+    film.develop(*image, threads);
+
+    stats.reset_counters();
+    for (const auto& result : thread_results)
+        stats.merge_counters(result);
+    ray_count = stats.rays();
+}
+
+void RayTracer::render_tile(int tile, Film& film, const Hittable& world, const HittableList& highlights) {
+    // the sample pattern of a tile depends only on the seed and the tile index
+    seed_random(seed * 0x9E3779B9u ^ (unsigned int)(tile + 1) * 0x85EBCA6Bu);
+
+    int x0 = (tile % tiles_x) * tile_size;
+    int y0 = (tile / tiles_x) * tile_size;
+    int x1 = std::min(x0 + tile_size, image_width);
+    int y1 = std::min(y0 + tile_size, image_height);
+    FilmTile& film_tile = film.begin_tile(tile);
+    AOVBuffers* aov = aovs.get();
+    for (int i = x0; i < x1; ++i) {
+        for (int j = y0; j < y1; ++j) {
+            Color3f albedo;
+            Vec3f normal;
+            float depth = 0.f;
+            int hits = 0;
+            int object_id = -1, material_id = -1;
             for (int s_i = 0; s_i < sqrt_spp; ++s_i) {
                 for (int s_j = 0; s_j < sqrt_spp; ++s_j) {
-                    Ray r = get_sample_ray(i, j, s_i, s_j);
-                    pixel_color += ray_color(r, max_depth, world, highlights);
+                    Vec3f offset = sample_square_stratified(s_i, s_j);
+                    Ray r = get_sample_ray(i, j, offset);
+                    float fx = 0.5f + offset.x, fy = 0.5f + offset.y;
+                    if (!aov) {
+                        film.add_sample(film_tile, i, j, fx, fy, ray_color(r, max_depth, world, highlights));
+                        continue;
+                    }
+                    FirstHit first;
+                    film.add_sample(film_tile, i, j, fx, fy, ray_color(r, max_depth, world, highlights, &first));
+                    albedo += first.albedo;
+                    normal += first.normal;
+                    if (first.hit) {
+                        depth += first.t;
+                        // ids cannot be averaged, keep the first sample that hit something
+                        if (hits++ == 0) {
+                            object_id = first.object_id;
+                            material_id = first.material_id;
+                        }
+                    }
+                }
+            }
+
+            if (aov) {
+                if (aov->enabled(AOVBuffers::ALBEDO))
+                    aov->albedo.set(i, j, Vec4f(albedo * pixel_samples_scale, 1.f));
+                if (aov->enabled(AOVBuffers::NORMAL))
+                    aov->normal.set(i, j, Vec4f(normal * pixel_samples_scale, 1.f));
+                if (aov->enabled(AOVBuffers::DEPTH))
+                    aov->depth.pixel(i, j)[0] = hits > 0 ? depth / hits : INFINITY;
+                if (aov->enabled(AOVBuffers::IDS)) {
+                    aov->ids.pixel(i, j)[0] = float(object_id);
+                    aov->ids.pixel(i, j)[1] = float(material_id);
                 }
+                if (aov->enabled(AOVBuffers::SAMPLES))
+                    aov->sample_count.pixel(i, j)[0] = float(sqrt_spp * sqrt_spp);
             }
-            pixel_color = pixel_color * pixel_samples_scale;
-            image->set(i, j, vec2Color(linear_to_gamma(pixel_color)));
         }
     }
 }
@@ -71,12 +165,12 @@ Ray RayTracer::get_sample_ray(int i, int j) const {
     Vec3f dir = pixel_center - ray_origin;
     float ray_time = random_float();
 
-    return Ray(ray_origin, dir, ray_time);
+    Ray ray(ray_origin, dir, ray_time);
+    ray.set_cone(0.f, pixel_spread);
+    return ray;
 }
 
-Ray RayTracer::get_sample_ray(int i, int j, int s_i, int s_j) const {
-    auto offset = sample_square_stratified(s_i, s_j);
-    
+Ray RayTracer::get_sample_ray(int i, int j, const Vec3f& offset) const {
     Vec3f pixel_center = pixel00_loc + 
                         (i+offset.x) * pixel_delta_u +
                         (j+offset.y) * pixel_delta_v;
@@ -91,7 +185,9 @@ Ray RayTracer::get_sample_ray(int i, int j, int s_i, int s_j) const {
     Vec3f dir = (pixel_center - ray_origin).unit();
     float ray_time = random_float();
 
-    return Ray(ray_origin, dir, ray_time);
+    Ray ray(ray_origin, dir, ray_time);
+    ray.set_cone(0.f, pixel_spread);
+    return ray;
 }
 
 Vec3f RayTracer::sample_square_stratified(int s_i, int s_j) const {
@@ -101,7 +197,8 @@ Vec3f RayTracer::sample_square_stratified(int s_i, int s_j) const {
     return Vec3f(px, py, 0.f);
 }
 
-Color3f RayTracer::ray_color(const Ray &r, int depth, const Hittable& world, const HittableList& highlights) {  
+Color3f RayTracer::ray_color(const Ray &r, int depth, const Hittable& world, const HittableList& highlights,
+                             FirstHit* first) {
     // params lights only tells us position without material and intensity.
 
     // it means ray bounces between objects all the time and no light(emit or background) is touched.
@@ -109,16 +206,34 @@ Color3f RayTracer::ray_color(const Ray &r, int depth, const Hittable& world, con
         return Color3f(0.f, 0.f, 0.f);
     
     // Raytracing process
+    if (depth == max_depth)
+        STAT_INC(camera_rays);
+    else
+        STAT_INC(bounce_rays);
     HitRecord rec;
-    if (!world.hit(r, Interval(0.001f, INFINITY), rec))
+    if (!world.hit(r, Interval(0.001f, INFINITY), rec)) {
+        if (first)
+            first->albedo = background;
         return background;
+    }
+    if (first) {
+        first->hit = true;
+        first->t = rec.t;
+        first->albedo = rec.mat->reflectance(rec);
+        first->normal = rec.normal;
+        first->object_id = rec.object_id;
+        first->material_id = rec.mat->id;
+    }
 
     ScatterRecord srec;
     auto emit_color = rec.mat->emit(r, rec, rec.u, rec.v, rec.p);
     if (!rec.mat->scatter(r, rec, srec))    // scatter方法采样的scattered(ray)是按照scatter_pdf概率密度的, 因此sample_pdf也就等于scatter_pdf
         return emit_color;
     
+    // 次级光线从交点处的光锥宽度开始，保持相机光线的扩张角
+    float cone_width = r.cone_width_at(rec.t);
     if (srec.skip_pdf) {
+        srec.skip_pdf_ray.set_cone(cone_width, r.cone_spread());
         return srec.attenuation * ray_color(srec.skip_pdf_ray, depth-1, world, highlights);
     }
 
@@ -129,9 +244,12 @@ Color3f RayTracer::ray_color(const Ray &r, int depth, const Hittable& world, con
         sample_pdf_ptr = make_shared<MixturePDF>(make_shared<HittablePDF>(highlights, rec.p), srec.pdf_ptr);
 
     auto scattered = Ray(rec.p, sample_pdf_ptr->generate(), r.time());                         // 采样的散射光线 
+    scattered.set_cone(cone_width, r.cone_spread());
     auto sample_pdf_value = sample_pdf_ptr->value(scattered.direction());
-    if (sample_pdf_value < 1e-4f) 
+    if (sample_pdf_value < 1e-4f) {
+        STAT_INC(pdf_rejections);
         return emit_color;
+    }
 
     auto scatter_pdf_value = rec.mat->scattering_pdf(r, rec, scattered);     // 相函数
 
@@ -0,0 +1,878 @@
+#include "scene.h"
+#include "sphere.h"
+#include "quad.h"
+#include "mesh.h"
+#include "constant_medium.h"
+#include "bvh.h"
+#include "kdtree.h"
+#include "grid.h"
+#include "texture_registry.h"
+#include "baked_texture.h"
+#include "instance.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace {
+
+struct Token {
+    const char* begin;
+    const char* end;
+
+    std::string str() const { return std::string(begin, end); }
+    bool is(const char* s) const {
+        auto len = strlen(s);
+        return size_t(end - begin) == len && strncmp(begin, s, len) == 0;
+    }
+};
+
+class SceneParser {
+public:
+    SceneParser(const std::string& text, const std::string& name, const std::string& base_dir)
+        : text(text), base_dir(base_dir) {
+        desc.name = name;
+    }
+
+    SceneDesc parse() {
+        const char* p = text.c_str();
+        const char* text_end = p + text.size();
+        line_no = 0;
+        while (p < text_end) {
+            const char* line_end = p;
+            while (line_end < text_end && *line_end != '\n') ++line_end;
+            ++line_no;
+            tokenize(p, line_end);
+            if (!tokens.empty())
+                statement();
+            p = line_end + 1;
+        }
+        if (!groups.empty()) {
+            line_no = groups.back().line;
+            error(groups.back().define ? "'define' without matching 'end'" : "'group' without matching 'end'");
+        }
+        return desc;
+    }
+
+private:
+    struct Group {
+        size_t first_object;
+        size_t first_light;
+        int line;
+        bool define;            // 'define <name>' block, closed by a plain 'end'
+        std::string name;
+    };
+
+    const std::string& text;
+    std::string base_dir;
+    SceneDesc desc;
+    std::map<std::string, int> texture_names;
+    std::map<std::string, int> material_names;
+    std::map<std::string, int> prototype_names;
+    std::vector<Group> groups;
+    int defining = -1;          // prototype whose 'define' block is open
+    int last_object = -1;       // top level object of the previous statement, the one 'key' animates
+    std::vector<Token> tokens;
+    size_t cur = 0;
+    int line_no = 0;
+
+    void tokenize(const char* p, const char* end) {
+        tokens.clear();
+        cur = 0;
+        while (p < end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+            if (p == end || *p == '#') break;
+            const char* start = p;
+            while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#') ++p;
+            tokens.push_back(Token{start, p});
+        }
+    }
+
+    [[noreturn]] void error(const std::string& msg) const {
+        std::ostringstream out;
+        out << desc.name << ":" << line_no << ": " << msg;
+        throw SceneError(out.str());
+    }
+
+    bool at_end() const { return cur >= tokens.size(); }
+
+    const Token& next(const char* what) {
+        if (at_end())
+            error(std::string("expected ") + what + " at end of line");
+        return tokens[cur++];
+    }
+
+    bool peek_number() const {
+        if (at_end()) return false;
+        char c = *tokens[cur].begin;
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+    }
+
+    float number() {
+        const Token& tok = next("number");
+        std::string s = tok.str();
+        char* parse_end = nullptr;
+        float val = strtof(s.c_str(), &parse_end);
+        if (parse_end != s.c_str() + s.size())
+            error("expected number, got '" + s + "'");
+        return val;
+    }
+
+    int integer() {
+        const Token& tok = next("integer");
+        std::string s = tok.str();
+        char* parse_end = nullptr;
+        long val = strtol(s.c_str(), &parse_end, 10);
+        if (parse_end != s.c_str() + s.size())
+            error("expected integer, got '" + s + "'");
+        return int(val);
+    }
+
+    Vec3f vec3() {
+        float x = number();
+        float y = number();
+        float z = number();
+        return Vec3f(x, y, z);
+    }
+
+    std::string identifier(const char* what) {
+        const Token& tok = next(what);
+        std::string s = tok.str();
+        char c = s[0];
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.')
+            error(std::string("expected ") + what + ", got '" + s + "'");
+        return s;
+    }
+
+    void end_of_statement() {
+        if (!at_end())
+            error("unexpected '" + tokens[cur].str() + "'");
+    }
+
+    // <texture name> | r g b
+    int texture_ref() {
+        if (peek_number()) {
+            TextureDesc tex;
+            tex.type = TextureDesc::SOLID;
+            tex.color = vec3();
+            desc.textures.push_back(tex);
+            return int(desc.textures.size()) - 1;
+        }
+        auto name = identifier("texture name or color");
+        auto it = texture_names.find(name);
+        if (it == texture_names.end())
+            error("unknown texture '" + name + "'");
+        return it->second;
+    }
+
+    int material_ref() {
+        auto name = identifier("material name");
+        if (name == "none")
+            return -1;
+        auto it = material_names.find(name);
+        if (it == material_names.end())
+            error("unknown material '" + name + "'");
+        return it->second;
+    }
+
+    void transforms(std::vector<TransformDesc>& out) {
+        while (!at_end()) {
+            const Token& tok = next("transform");
+            TransformDesc t;
+            if (tok.is("translate")) {
+                t.type = TransformDesc::TRANSLATE;
+                t.offset = vec3();
+            } else if (tok.is("rotate_y")) {
+                t.type = TransformDesc::ROTATE_Y;
+                t.angle = number();
+            } else if (tok.is("rotate_x") || tok.is("rotate_z")) {
+                t.type = TransformDesc::ROTATE;
+                t.offset = tok.is("rotate_x") ? Vec3f(1.f, 0.f, 0.f) : Vec3f(0.f, 0.f, 1.f);
+                t.angle = number();
+            } else if (tok.is("rotate")) {
+                t.type = TransformDesc::ROTATE;
+                t.angle = number();
+                t.offset = vec3();
+                if (t.offset.norm_squared() == 0.f)
+                    error("rotation axis must not be zero");
+            } else if (tok.is("scale")) {
+                t.type = TransformDesc::SCALE;
+                float sx = number();
+                t.offset = Vec3f(sx, sx, sx);
+                if (peek_number()) {
+                    t.offset.y = number();
+                    t.offset.z = number();
+                }
+                if (t.offset.x == 0.f || t.offset.y == 0.f || t.offset.z == 0.f)
+                    error("scale factors must not be zero");
+            } else {
+                error("unknown transform '" + tok.str() + "'");
+            }
+            out.push_back(t);
+        }
+    }
+
+    // shapes are moved in place, which only works for translations and rotations about y
+    void check_shape_transforms(const std::vector<TransformDesc>& list) {
+        for (const auto& t : list)
+            if (t.type != TransformDesc::TRANSLATE && t.type != TransformDesc::ROTATE_Y)
+                error("rotate, rotate_x, rotate_z and scale only apply to instances");
+    }
+
+    std::vector<ObjectDesc>& current_objects() {
+        return defining >= 0 ? desc.prototypes[defining].objects : desc.objects;
+    }
+
+    ShapeDesc shape() {
+        const Token& tok = next("shape");
+        ShapeDesc s;
+        if (tok.is("sphere")) {
+            s.type = ShapeDesc::SPHERE;
+            s.material = material_ref();
+            s.p[0] = vec3();
+            s.radius = number();
+            s.p[1] = s.p[0];
+            if (!at_end() && tokens[cur].is("moving")) {
+                ++cur;
+                s.p[1] = vec3();
+            }
+        } else if (tok.is("quad") || tok.is("mesh")) {
+            s.type = tok.is("quad") ? ShapeDesc::QUAD : ShapeDesc::MESH;
+            s.material = material_ref();
+            s.p[0] = vec3();
+            s.p[1] = vec3();
+            s.p[2] = vec3();
+        } else if (tok.is("box")) {
+            s.type = ShapeDesc::BOX;
+            s.material = material_ref();
+            s.p[0] = vec3();
+            s.p[1] = vec3();
+        } else {
+            error("unknown shape '" + tok.str() + "'");
+        }
+        transforms(s.transforms);
+        check_shape_transforms(s.transforms);
+        return s;
+    }
+
+    void statement() {
+        const Token& tok = tokens[cur++];
+        int keyed = last_object;
+        last_object = -1;
+        if (tok.is("image")) {
+            desc.image_width = integer();
+            desc.image_height = integer();
+            if (desc.image_width <= 0 || desc.image_height <= 0)
+                error("image size must be positive");
+            end_of_statement();
+        } else if (tok.is("camera")) {
+            camera();
+        } else if (tok.is("render")) {
+            render();
+        } else if (tok.is("texture")) {
+            texture();
+        } else if (tok.is("material")) {
+            material();
+        } else if (tok.is("sphere") || tok.is("quad") || tok.is("mesh") || tok.is("box")) {
+            --cur;
+            ObjectDesc obj;
+            obj.shape = shape();
+            add_object(obj);
+        } else if (tok.is("instance")) {
+            auto name = identifier("prototype name");
+            auto it = prototype_names.find(name);
+            if (it == prototype_names.end())
+                error("unknown prototype '" + name + "'");
+            ObjectDesc obj;
+            obj.prototype = it->second;
+            transforms(obj.shape.transforms);
+            add_object(obj);
+        } else if (tok.is("medium")) {
+            ObjectDesc obj;
+            obj.medium = true;
+            obj.density = number();
+            if (obj.density <= 0.f)
+                error("medium density must be positive");
+            obj.phase_texture = texture_ref();
+            obj.shape = shape();
+            add_object(obj);
+        } else if (tok.is("light")) {
+            if (defining >= 0)
+                error("lights cannot be part of a definition");
+            desc.lights.push_back(shape());
+        } else if (tok.is("frames")) {
+            desc.first_frame = integer();
+            desc.last_frame = integer();
+            end_of_statement();
+            if (desc.first_frame < 0 || desc.last_frame < desc.first_frame)
+                error("frames must be 0 or more, the last not before the first");
+        } else if (tok.is("key")) {
+            keyframe(keyed);
+        } else if (tok.is("group")) {
+            end_of_statement();
+            groups.push_back(Group{current_objects().size(), desc.lights.size(), line_no, false, ""});
+        } else if (tok.is("define")) {
+            auto name = identifier("prototype name");
+            PrototypeDesc proto;
+            if (!at_end() && tokens[cur].is("accel")) {
+                ++cur;
+                proto.accelerator = accelerator();
+            }
+            end_of_statement();
+            if (defining >= 0)
+                error("definitions cannot be nested");
+            if (prototype_names.count(name))
+                error("prototype '" + name + "' already defined");
+            desc.prototypes.push_back(proto);
+            defining = int(desc.prototypes.size()) - 1;
+            groups.push_back(Group{0, desc.lights.size(), line_no, true, name});
+        } else if (tok.is("end")) {
+            if (groups.empty())
+                error("'end' without matching 'group' or 'define'");
+            if (groups.back().define) {
+                end_of_statement();
+                if (current_objects().empty())
+                    error("prototype '" + groups.back().name + "' is empty");
+                prototype_names[groups.back().name] = defining;
+                defining = -1;
+                groups.pop_back();
+                return;
+            }
+            std::vector<TransformDesc> group_transforms;
+            transforms(group_transforms);
+            Group g = groups.back();
+            groups.pop_back();
+            auto& objects = current_objects();
+            for (size_t i = g.first_object; i < objects.size(); ++i) {
+                auto& t = objects[i].shape.transforms;
+                if (objects[i].prototype < 0)
+                    check_shape_transforms(group_transforms);
+                t.insert(t.end(), group_transforms.begin(), group_transforms.end());
+            }
+            for (size_t i = g.first_light; i < desc.lights.size(); ++i) {
+                auto& t = desc.lights[i].transforms;
+                t.insert(t.end(), group_transforms.begin(), group_transforms.end());
+            }
+        } else {
+            error("unknown statement '" + tok.str() + "'");
+        }
+    }
+
+    void add_object(const ObjectDesc& obj) {
+        current_objects().push_back(obj);
+        if (defining < 0)
+            last_object = int(desc.objects.size()) - 1;
+    }
+
+    // the camera of the 'camera' statements so far
+    CameraKey static_camera() const {
+        CameraKey c;
+        c.fovY = desc.fovY;
+        c.eye = desc.eye;
+        c.lookat = desc.lookat;
+        c.defocus_angle = desc.defocus_angle;
+        c.focus_dist = desc.focus_dist;
+        return c;
+    }
+
+    void camera() {
+        CameraKey c = static_camera();
+        camera_options(c);
+        desc.fovY = c.fovY;
+        desc.eye = c.eye;
+        desc.lookat = c.lookat;
+        desc.defocus_angle = c.defocus_angle;
+        desc.focus_dist = c.focus_dist;
+    }
+
+    void camera_options(CameraKey& c) {
+        while (!at_end()) {
+            const Token& key = next("camera option");
+            if (key.is("fov"))              c.fovY = number();
+            else if (key.is("eye"))         c.eye = vec3();
+            else if (key.is("lookat"))      c.lookat = vec3();
+            else if (key.is("defocus"))     c.defocus_angle = number();
+            else if (key.is("focus"))       c.focus_dist = number();
+            else error("unknown camera option '" + key.str() + "'");
+        }
+    }
+
+    // key <frame> camera <options>: options not given keep the values of the previous camera key (or of
+    // the camera statement before the first key)
+    // key <frame> <transforms>: animates the object of the previous statement, or of the key before
+    void keyframe(int keyed) {
+        int frame = integer();
+        if (frame < 0)
+            error("frame must be 0 or more");
+        if (!at_end() && tokens[cur].is("camera")) {
+            ++cur;
+            auto& keys = desc.camera_keys;
+            if (!keys.empty() && frame <= keys.back().frame)
+                error("keys must be in increasing frame order");
+            CameraKey c = keys.empty() ? static_camera() : keys.back();
+            c.frame = frame;
+            camera_options(c);
+            keys.push_back(c);
+            return;
+        }
+
+        if (keyed < 0)
+            error("'key' must follow the object it animates, outside of definitions");
+        auto& keys = desc.objects[keyed].keys;
+        TransformKey k;
+        k.frame = frame;
+        transforms(k.transforms);
+        if (k.transforms.empty())
+            error("expected transform at end of line");
+        if (!keys.empty()) {
+            if (frame <= keys.back().frame)
+                error("keys must be in increasing frame order");
+            bool same = k.transforms.size() == keys[0].transforms.size();
+            for (size_t i = 0; same && i < k.transforms.size(); ++i)
+                same = k.transforms[i].type == keys[0].transforms[i].type;
+            if (!same)
+                error("every key of an object must list the same transforms");
+        }
+        keys.push_back(k);
+        last_object = keyed;
+    }
+
+    void render() {
+        while (!at_end()) {
+            const Token& key = next("render option");
+            if (key.is("spp"))              desc.samples_per_pixel = integer();
+            else if (key.is("depth"))       desc.max_depth = integer();
+            else if (key.is("background"))  desc.background = vec3();
+            else if (key.is("shutter"))     desc.shutter = number();
+            else if (key.is("segments"))    desc.motion_segments = integer();
+            else if (key.is("splits"))      desc.spatial_splits = number();
+            else if (key.is("accel"))       desc.accelerator = accelerator();
+            else error("unknown render option '" + key.str() + "'");
+        }
+        if (desc.samples_per_pixel <= 0)
+            error("spp must be positive");
+        if (!(desc.shutter >= 0.f))
+            error("shutter must be 0 or more frames");
+        if (desc.motion_segments < 1)
+            error("segments must be positive");
+        if (!(desc.spatial_splits >= 0.f))
+            error("splits must be 0 or more");
+    }
+
+    Accelerator::Type accelerator() {
+        const Token& tok = next("accelerator");
+        if (tok.is("bvh"))      return Accelerator::BVH;
+        if (tok.is("kdtree"))   return Accelerator::KD_TREE;
+        if (tok.is("grid"))     return Accelerator::GRID;
+        error("unknown accelerator '" + tok.str() + "', expected bvh, kdtree or grid");
+        return Accelerator::BVH;
+    }
+
+    void texture() {
+        auto name = identifier("texture name");
+        if (texture_names.count(name))
+            error("texture '" + name + "' already defined");
+        const Token& kind = next("texture type");
+        TextureDesc tex;
+        if (kind.is("solid")) {
+            tex.type = TextureDesc::SOLID;
+            tex.color = vec3();
+        } else if (kind.is("checker")) {
+            tex.type = TextureDesc::CHECKER;
+            tex.scale = number();
+            tex.even = texture_ref();
+            tex.odd = texture_ref();
+        } else if (kind.is("image")) {
+            tex.type = TextureDesc::IMAGE;
+            auto path = next("image path").str();
+            tex.path = (path[0] == '/' || base_dir.empty()) ? path : base_dir + "/" + path;
+            std::ifstream probe(tex.path.c_str());
+            if (!probe)
+                error("cannot open image '" + tex.path + "'");
+        } else if (kind.is("noise")) {
+            tex.type = TextureDesc::NOISE;
+            tex.scale = number();
+        } else {
+            error("unknown texture type '" + kind.str() + "'");
+        }
+        if (!at_end() && tokens[cur].is("bake")) {
+            if (tex.type != TextureDesc::CHECKER && tex.type != TextureDesc::NOISE)
+                error("only checker and noise textures can be baked");
+            ++cur;
+            tex.bake_tolerance = number();
+            if (!(tex.bake_tolerance > 0.f))
+                error("bake tolerance must be positive");
+        }
+        end_of_statement();
+        desc.textures.push_back(tex);
+        texture_names[name] = int(desc.textures.size()) - 1;
+    }
+
+    void material() {
+        auto name = identifier("material name");
+        if (name == "none")
+            error("'none' is reserved");
+        if (material_names.count(name))
+            error("material '" + name + "' already defined");
+        const Token& kind = next("material type");
+        MaterialDesc mat;
+        if (kind.is("lambertian")) {
+            mat.type = MaterialDesc::LAMBERTIAN;
+            mat.texture = texture_ref();
+        } else if (kind.is("metal")) {
+            mat.type = MaterialDesc::METAL;
+            mat.albedo = vec3();
+            mat.fuzz = number();
+        } else if (kind.is("dielectric")) {
+            mat.type = MaterialDesc::DIELECTRIC;
+            mat.ior = number();
+        } else if (kind.is("light")) {
+            mat.type = MaterialDesc::DIFFUSE_LIGHT;
+            mat.texture = texture_ref();
+        } else if (kind.is("isotropic")) {
+            mat.type = MaterialDesc::ISOTROPIC;
+            mat.texture = texture_ref();
+        } else {
+            error("unknown material type '" + kind.str() + "'");
+        }
+        end_of_statement();
+        desc.materials.push_back(mat);
+        material_names[name] = int(desc.materials.size()) - 1;
+    }
+};
+
+shared_ptr<Texture> make_texture(const TextureDesc& desc, const std::vector<shared_ptr<Texture>>& built,
+                                 shared_ptr<ImageTexture> image) {
+    switch (desc.type) {
+        case TextureDesc::SOLID:   return make_shared<SolidColor>(desc.color);
+        case TextureDesc::CHECKER: return make_shared<CheckerTexture>(desc.scale, built[desc.even], built[desc.odd]);
+        case TextureDesc::IMAGE:   return image;
+        case TextureDesc::NOISE:   return make_shared<NoiseTexture>(desc.scale);
+    }
+    return nullptr;
+}
+
+shared_ptr<Material> make_material(const MaterialDesc& desc, const std::vector<shared_ptr<Texture>>& textures) {
+    switch (desc.type) {
+        case MaterialDesc::LAMBERTIAN:    return make_shared<Lambertian>(textures[desc.texture]);
+        case MaterialDesc::METAL:         return make_shared<Metal>(desc.albedo, desc.fuzz);
+        case MaterialDesc::DIELECTRIC:    return make_shared<Dielectric>(desc.ior);
+        case MaterialDesc::DIFFUSE_LIGHT: return make_shared<DiffuseLight>(textures[desc.texture]);
+        case MaterialDesc::ISOTROPIC:     return make_shared<Isotropic>(textures[desc.texture]);
+    }
+    return nullptr;
+}
+
+shared_ptr<Hittable> make_shape(const ShapeDesc& desc, const std::vector<shared_ptr<Material>>& materials) {
+    auto mat = desc.material < 0 ? shared_ptr<Material>() : materials[desc.material];
+    shared_ptr<Hittable> shape;
+    switch (desc.type) {
+        case ShapeDesc::SPHERE: shape = make_shared<Sphere>(desc.p[0], desc.p[1], desc.radius, mat); break;
+        case ShapeDesc::QUAD:   shape = make_shared<Quad>(desc.p[0], desc.p[1], desc.p[2], mat); break;
+        case ShapeDesc::MESH:   shape = make_shared<Mesh>(desc.p[0], desc.p[1], desc.p[2], mat); break;
+        case ShapeDesc::BOX:    shape = make_shared<Box>(desc.p[0], desc.p[1], mat); break;
+    }
+    for (const auto& t : desc.transforms) {
+        if (t.type == TransformDesc::TRANSLATE)
+            shape->translate(t.offset);
+        else
+            shape->rotate_y(t.angle);
+    }
+    return shape;
+}
+
+Transform make_transform(const std::vector<TransformDesc>& list) {
+    Transform m;
+    for (const auto& t : list) {
+        switch (t.type) {
+            case TransformDesc::TRANSLATE: m = Transform::translate(t.offset) * m; break;
+            case TransformDesc::ROTATE_Y:  m = Transform::rotate(Vec3f(0.f, 1.f, 0.f), t.angle) * m; break;
+            case TransformDesc::ROTATE:    m = Transform::rotate(t.offset, t.angle) * m; break;
+            case TransformDesc::SCALE:     m = Transform::scale(t.offset) * m; break;
+        }
+    }
+    return m;
+}
+
+// the key at or before 'frame' and the weight of the one after it; frames outside the keys clamp to the
+// first or last key
+template <typename Key>
+int key_span(const std::vector<Key>& keys, float frame, float& w) {
+    w = 0.f;
+    if (frame <= keys.front().frame)
+        return 0;
+    int last = int(keys.size()) - 1;
+    if (frame >= keys[last].frame)
+        return last;
+    int i = 0;
+    while (frame >= keys[i + 1].frame)
+        ++i;
+    w = (frame - keys[i].frame) / float(keys[i + 1].frame - keys[i].frame);
+    return i;
+}
+
+Transform key_transform(const std::vector<TransformKey>& keys, float frame) {
+    float w;
+    int i = key_span(keys, frame, w);
+    if (w == 0.f)
+        return make_transform(keys[i].transforms);
+    std::vector<TransformDesc> list = keys[i].transforms;
+    const auto& next = keys[i + 1].transforms;
+    for (size_t j = 0; j < list.size(); ++j) {
+        Vec3f offset = list[j].offset + w * (next[j].offset - list[j].offset);
+        // an axis turning into its opposite passes through zero, keep the earlier one there
+        if (list[j].type != TransformDesc::ROTATE || offset.norm_squared() > 0.f)
+            list[j].offset = offset;
+        list[j].angle += w * (next[j].angle - list[j].angle);
+    }
+    return make_transform(list);
+}
+
+// the transforms of a keyed object while the shutter is open after 'frame', one without motion blur
+std::vector<Transform> motion_transforms(const SceneDesc& desc, const ObjectDesc& obj, const Transform& placement,
+                                         float frame) {
+    int segments = desc.shutter > 0.f ? desc.motion_segments : 0;
+    std::vector<Transform> samples;
+    for (int i = 0; i <= segments; ++i) {
+        float t = segments > 0 ? float(i) / float(segments) : 0.f;
+        samples.push_back(key_transform(obj.keys, frame + desc.shutter * t) * placement);
+    }
+    return samples;
+}
+
+// 'spatial_splits' only applies to a BVH
+shared_ptr<Accelerator> make_accelerator(Accelerator::Type type, const HittableList& objects, float spatial_splits) {
+    if (type == Accelerator::KD_TREE)
+        return make_shared<KdTree>(objects);
+    if (type == Accelerator::GRID)
+        return make_shared<UniformGrid>(objects);
+    return make_shared<LinearBVH>(objects, spatial_splits);
+}
+
+shared_ptr<Hittable> make_object(const ObjectDesc& obj, const Scene& scene) {
+    if (obj.prototype >= 0)
+        return make_shared<Instance>(scene.prototypes[obj.prototype], make_transform(obj.shape.transforms));
+    auto shape = make_shape(obj.shape, scene.materials);
+    if (obj.medium)
+        return make_shared<ConstantMedium>(shape, obj.density, scene.textures[obj.phase_texture]);
+    return shape;
+}
+
+// objects with keys are wrapped in an instance, shapes have been moved by their own transforms already
+shared_ptr<Hittable> make_animated_object(const SceneDesc& desc, int index, Scene& scene, int frame) {
+    const ObjectDesc& obj = desc.objects[index];
+    AnimatedObject a;
+    a.object = index;
+    shared_ptr<Hittable> object;
+    if (obj.prototype >= 0) {
+        object = scene.prototypes[obj.prototype];
+        a.placement = make_transform(obj.shape.transforms);
+    } else {
+        object = make_object(obj, scene);
+    }
+    a.instance = make_shared<Instance>(object, a.placement);
+    a.instance->set_motion(motion_transforms(desc, obj, a.placement, float(frame)));
+    scene.animated.push_back(a);
+    return a.instance;
+}
+
+}   // namespace
+
+void SceneDesc::setup(RayTracer& raytracer) const {
+    raytracer.samples_per_pixel = samples_per_pixel;
+    raytracer.max_depth = max_depth;
+    raytracer.background = background;
+    raytracer.fovY = fovY;
+    raytracer.eye = eye;
+    raytracer.lookat = lookat;
+    raytracer.defocus_angle = defocus_angle;
+    raytracer.focus_dist = focus_dist;
+}
+
+void SceneDesc::setup(RayTracer& raytracer, float frame) const {
+    setup(raytracer);
+    if (camera_keys.empty())
+        return;
+    float w;
+    int i = key_span(camera_keys, frame, w);
+    const CameraKey& a = camera_keys[i];
+    const CameraKey& b = camera_keys[w == 0.f ? i : i + 1];
+    raytracer.fovY = a.fovY + w * (b.fovY - a.fovY);
+    raytracer.eye = a.eye + w * (b.eye - a.eye);
+    raytracer.lookat = a.lookat + w * (b.lookat - a.lookat);
+    raytracer.defocus_angle = a.defocus_angle + w * (b.defocus_angle - a.defocus_angle);
+    raytracer.focus_dist = a.focus_dist + w * (b.focus_dist - a.focus_dist);
+}
+
+SceneDesc parse_scene(const std::string& text, const std::string& name, const std::string& base_dir) {
+    SceneParser parser(text, name, base_dir);
+    return parser.parse();
+}
+
+SceneDesc parse_scene_file(const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in)
+        throw SceneError("cannot open scene file '" + filename + "'");
+    std::ostringstream buf;
+    buf << in.rdbuf();
+
+    auto slash = filename.find_last_of("/\\");
+    std::string base_dir = slash == std::string::npos ? "" : filename.substr(0, slash);
+    return parse_scene(buf.str(), filename, base_dir);
+}
+
+// the union of the bounding boxes of everything a texture is evaluated on, checker textures pass theirs
+// on to their children
+static void add_texture_bounds(const SceneDesc& desc, int texture, const aabb& box, std::vector<aabb>& bounds) {
+    if (texture < 0)
+        return;
+    bounds[texture] = aabb(bounds[texture], box);
+    const TextureDesc& tex = desc.textures[texture];
+    if (tex.type == TextureDesc::CHECKER) {
+        add_texture_bounds(desc, tex.even, box, bounds);
+        add_texture_bounds(desc, tex.odd, box, bounds);
+    }
+}
+
+static void add_shape_bounds(const SceneDesc& desc, const ObjectDesc& obj, const aabb& box, std::vector<aabb>& bounds) {
+    if (obj.medium)
+        add_texture_bounds(desc, obj.phase_texture, box, bounds);
+    else if (obj.shape.material >= 0)
+        add_texture_bounds(desc, desc.materials[obj.shape.material].texture, box, bounds);
+}
+
+// 'built' holds the objects of every prototype followed by the top level ones, in description order
+static void add_object_bounds(const SceneDesc& desc, const std::vector<ObjectDesc>& objects,
+                              const std::vector<HittableList>& built, int list, const Transform& to_world,
+                              std::vector<aabb>& bounds) {
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const auto& obj = objects[i];
+        if (!obj.keys.empty()) {
+            // every pose from the first key to the last, sampled once per frame
+            auto instance = std::static_pointer_cast<Instance>(built[list].objects[i]);
+            for (int frame = obj.keys.front().frame; frame <= obj.keys.back().frame; ++frame) {
+                Transform m = to_world * key_transform(obj.keys, float(frame));
+                if (obj.prototype >= 0)
+                    add_object_bounds(desc, desc.prototypes[obj.prototype].objects, built, obj.prototype,
+                                      m * make_transform(obj.shape.transforms), bounds);
+                else
+                    add_shape_bounds(desc, obj, m.box(instance->prototype()->bounding_box()), bounds);
+            }
+            continue;
+        }
+        if (obj.prototype >= 0) {
+            add_object_bounds(desc, desc.prototypes[obj.prototype].objects, built, obj.prototype,
+                              to_world * make_transform(obj.shape.transforms), bounds);
+            continue;
+        }
+        add_shape_bounds(desc, obj, to_world.box(built[list].objects[i]->bounding_box()), bounds);
+    }
+}
+
+static void bake_textures(const SceneDesc& desc, Scene& scene, const std::vector<HittableList>& built) {
+    std::vector<aabb> bounds(desc.textures.size(), aabb::empty);
+    add_object_bounds(desc, desc.objects, built, int(desc.prototypes.size()), Transform(), bounds);
+
+    for (size_t i = 0; i < scene.textures.size(); ++i) {
+        auto baked = std::dynamic_pointer_cast<BakedTexture>(scene.textures[i]);
+        if (!baked || !(bounds[i].x.size() > 0.f))
+            continue;
+        if (!baked->source_texture()->position_only())
+            std::cerr << desc.name << ": texture #" << i << " not baked, it depends on texture coordinates\n";
+        else if (!baked->bake(bounds[i], texture_options().bake_bytes))
+            std::cerr << desc.name << ": texture #" << i << " not baked, a grid within tolerance "
+                      << desc.textures[i].bake_tolerance << " needs more than "
+                      << (texture_options().bake_bytes >> 20) << " MB (RMS error " << baked->error() << ")\n";
+    }
+}
+
+Scene build_scene(const SceneDesc& desc, const PrebuiltScene* prebuilt) {
+    Scene scene;
+    if (prebuilt)
+        scene.backing = prebuilt->backing;
+
+    // image textures are shared through the registry, files it has not seen yet are decoded in parallel
+    auto& registry = TextureRegistry::instance();
+    if (!prebuilt) {
+        std::vector<std::string> paths;
+        for (const auto& tex : desc.textures)
+            if (tex.type == TextureDesc::IMAGE)
+                paths.push_back(tex.path);
+        registry.preload(paths);
+    }
+    for (size_t i = 0; i < desc.textures.size(); ++i) {
+        const auto& tex = desc.textures[i];
+        TextureRegistry::Entry entry;
+        if (tex.type == TextureDesc::IMAGE)
+            entry = registry.get(tex.path, prebuilt ? prebuilt->images[i] : nullptr);
+        scene.textures.push_back(make_texture(tex, scene.textures, entry.texture));
+        // filled in by bake_textures() once the bounds of the objects are known
+        if (tex.bake_tolerance > 0.f && texture_options().bake_bytes > 0)
+            scene.textures.back() = make_shared<BakedTexture>(scene.textures.back(), tex.bake_tolerance);
+    }
+    for (size_t i = 0; i < desc.materials.size(); ++i) {
+        scene.materials.push_back(make_material(desc.materials[i], scene.textures));
+        scene.materials.back()->id = int(i);
+    }
+
+    // every prototype gets its own BVH in object space (BLAS), instances only hold a transform and a
+    // reference to it; the top level BVH over the objects is the TLAS
+    std::vector<HittableList> built(desc.prototypes.size() + 1);
+    for (size_t i = 0; i < desc.prototypes.size(); ++i) {
+        for (const auto& obj : desc.prototypes[i].objects)
+            built[i].add(make_object(obj, scene));
+        int type = desc.prototypes[i].accelerator;
+        scene.prototypes.push_back(make_accelerator(type >= 0 ? Accelerator::Type(type) : desc.accelerator, built[i],
+                                                    desc.spatial_splits));
+    }
+    HittableList& objects = built.back();
+    for (size_t i = 0; i < desc.objects.size(); ++i) {
+        const auto& obj = desc.objects[i];
+        if (obj.keys.empty())
+            objects.add(make_object(obj, scene));
+        else
+            objects.add(make_animated_object(desc, int(i), scene, desc.first_frame));
+    }
+    for (const auto& light : desc.lights)
+        scene.highlights.add(make_shape(light, scene.materials));
+    bake_textures(desc, scene, built);
+
+    auto bvh_start = std::chrono::steady_clock::now();
+    // the cache only holds the nodes of a BVH
+    if (prebuilt && desc.accelerator == Accelerator::BVH)
+        scene.world = make_shared<LinearBVH>(objects.objects, prebuilt->order, prebuilt->order_count,
+                                             prebuilt->nodes, prebuilt->node_count, prebuilt->backing,
+                                             desc.spatial_splits);
+    else
+        scene.world = make_accelerator(desc.accelerator, objects, desc.spatial_splits);
+    scene.bvh_build_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - bvh_start).count();
+    return scene;
+}
+
+static bool same_transform(const Transform& a, const Transform& b) {
+    return memcmp(a.m, b.m, sizeof(a.m)) == 0;
+}
+
+int set_scene_frame(const SceneDesc& desc, Scene& scene, float frame) {
+    int moved = 0;
+    for (auto& a : scene.animated) {
+        auto samples = motion_transforms(desc, desc.objects[a.object], a.placement, frame);
+        const auto& current = a.instance->motion_samples();
+        bool same = current.empty() ? samples.size() == 1 && same_transform(samples[0], a.instance->object_to_world())
+                                    : samples.size() == current.size() &&
+                                      std::equal(samples.begin(), samples.end(), current.begin(), same_transform);
+        if (same)
+            continue;
+        a.instance->set_motion(samples);
+        ++moved;
+    }
+    // the instances only hold a reference to their geometry, so only the top level structure changes
+    if (moved > 0)
+        scene.world->objects_moved();
+    return moved;
+}
@@ -0,0 +1,687 @@
+#include "scene_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char cache_magic[8] = {'T', 'R', 'S', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t cache_version = 7;
+const size_t section_alignment = 16;
+
+struct Section {
+    uint64_t offset;    // from the start of the file
+    uint64_t count;     // elements, bytes for 'pixels' and 'strings'
+};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;         // sizeof(LinearBVHNode), guards against layout changes
+    uint64_t source_hash;
+    uint64_t file_size;
+
+    int32_t image_width, image_height;
+    int32_t samples_per_pixel, max_depth;
+    float fovY;
+    float eye[3], lookat[3];
+    float defocus_angle, focus_dist;
+    float background[3];
+    int32_t first_frame, last_frame;
+    float shutter;
+    int32_t motion_segments;
+    float spatial_splits;
+    int32_t accelerator;        // Accelerator::Type, nodes and order are empty unless a BVH
+
+    Section textures, materials, objects, lights, transforms, nodes, order, pixels, strings;
+    Section prototypes, prototype_objects, camera_keys, object_keys;
+};
+
+struct CacheTexture {
+    int32_t type;
+    float color[3];
+    float scale;
+    int32_t even, odd;
+    int32_t width, height, bytespp;
+    float bake_tolerance;
+    uint64_t pixel_offset;      // into 'pixels'
+    uint64_t path_offset;       // into 'strings'
+    uint64_t path_length;
+    int64_t file_size, file_mtime;
+};
+
+struct CacheMaterial {
+    int32_t type;
+    int32_t texture;
+    float albedo[3];
+    float fuzz;
+    float ior;
+};
+
+struct CacheShape {
+    int32_t type;
+    int32_t material;
+    float p[9];
+    float radius;
+    uint32_t first_transform, transform_count;
+};
+
+struct CacheObject {
+    CacheShape shape;
+    int32_t medium;
+    float density;
+    int32_t phase_texture;
+    int32_t prototype;
+};
+
+struct CachePrototype {
+    uint32_t first_object;      // into 'prototype_objects'
+    uint32_t object_count;
+    int32_t accelerator;        // -1 for the scene's
+};
+
+struct CacheTransform {
+    int32_t type;
+    float offset[3];
+    float angle;
+};
+
+struct CacheCameraKey {
+    int32_t frame;
+    float fovY;
+    float eye[3], lookat[3];
+    float defocus_angle, focus_dist;
+};
+
+// keys of an object are stored in frame order, one after the other
+struct CacheObjectKey {
+    uint32_t object;            // into 'objects'
+    int32_t frame;
+    uint32_t first_transform, transform_count;
+};
+
+class MappedFile {
+public:
+    static shared_ptr<MappedFile> open(const std::string& path) {
+        shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+        file->handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file->handle == INVALID_HANDLE_VALUE) return nullptr;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file->handle, &size) || size.QuadPart == 0) return nullptr;
+        file->length = size_t(size.QuadPart);
+        file->mapping = CreateFileMappingA(file->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!file->mapping) return nullptr;
+        file->addr = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!file->addr) return nullptr;
+#else
+        file->fd = ::open(path.c_str(), O_RDONLY);
+        if (file->fd < 0) return nullptr;
+        struct stat st;
+        if (fstat(file->fd, &st) != 0 || st.st_size == 0) return nullptr;
+        file->length = size_t(st.st_size);
+        void* addr = mmap(NULL, file->length, PROT_READ, MAP_PRIVATE, file->fd, 0);
+        if (addr == MAP_FAILED) return nullptr;
+        file->addr = addr;
+#endif
+        return file;
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (addr) UnmapViewOfFile(addr);
+        if (mapping) CloseHandle(mapping);
+        if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+#else
+        if (addr) munmap(addr, length);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    const char* data() const { return static_cast<const char*>(addr); }
+    size_t size() const { return length; }
+
+private:
+    MappedFile() {}
+
+    void* addr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+bool read_file(const std::string& filename, std::string& text) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in) return false;
+    std::ostringstream buf;
+    buf << in.rdbuf();
+    text = buf.str();
+    return true;
+}
+
+// FNV-1a
+uint64_t hash_bytes(const char* data, size_t size) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+uint64_t source_hash(const std::string& text) {
+    return hash_bytes(text.data(), text.size()) ^ cache_version;
+}
+
+bool file_stamp(const std::string& path, int64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    size = int64_t(st.st_size);
+    mtime = int64_t(st.st_mtime);
+    return true;
+}
+
+void copy3(float* dst, const Vec3f& v) { dst[0] = v.x; dst[1] = v.y; dst[2] = v.z; }
+Vec3f load3(const float* src) { return Vec3f(src[0], src[1], src[2]); }
+
+class CacheWriter {
+public:
+    std::vector<char> buf;
+
+    template <typename T>
+    Section append(const T* data, size_t count) {
+        return append_bytes(data, sizeof(T) * count, count);
+    }
+
+    Section append_bytes(const void* data, size_t bytes, size_t count) {
+        buf.resize((buf.size() + section_alignment - 1) / section_alignment * section_alignment, 0);
+        Section s = {uint64_t(buf.size()), uint64_t(count)};
+        buf.insert(buf.end(), static_cast<const char*>(data), static_cast<const char*>(data) + bytes);
+        return s;
+    }
+};
+
+// index of the first one in 'transforms'
+uint32_t pack_transforms(const std::vector<TransformDesc>& list, std::vector<CacheTransform>& transforms) {
+    uint32_t first = uint32_t(transforms.size());
+    for (const auto& t : list) {
+        CacheTransform ct;
+        memset(&ct, 0, sizeof(ct));
+        ct.type = t.type;
+        copy3(ct.offset, t.offset);
+        ct.angle = t.angle;
+        transforms.push_back(ct);
+    }
+    return first;
+}
+
+CacheShape pack_shape(const ShapeDesc& shape, std::vector<CacheTransform>& transforms) {
+    CacheShape c;
+    memset(&c, 0, sizeof(c));
+    c.type = shape.type;
+    c.material = shape.material;
+    for (int i = 0; i < 3; ++i)
+        copy3(c.p + 3 * i, shape.p[i]);
+    c.radius = shape.radius;
+    c.first_transform = pack_transforms(shape.transforms, transforms);
+    c.transform_count = uint32_t(shape.transforms.size());
+    return c;
+}
+
+// validates every index so that a corrupt cache is rejected instead of crashing the renderer
+class CacheReader {
+public:
+    CacheReader(const MappedFile& file) : file(file) {}
+
+    const CacheHeader* header() const {
+        if (file.size() < sizeof(CacheHeader)) return nullptr;
+        return reinterpret_cast<const CacheHeader*>(file.data());
+    }
+
+    template <typename T>
+    const T* section(const Section& s, size_t elem_size = sizeof(T)) const {
+        if (s.offset % section_alignment != 0 || s.offset > file.size()) return nullptr;
+        if (s.count > (file.size() - s.offset) / elem_size) return nullptr;
+        return reinterpret_cast<const T*>(file.data() + s.offset);
+    }
+
+private:
+    const MappedFile& file;
+};
+
+bool unpack_transforms(uint32_t first, uint32_t count, const CacheTransform* transforms, size_t num_transforms,
+                       std::vector<TransformDesc>& list) {
+    if (first > num_transforms || count > num_transforms - first)
+        return false;
+    for (uint32_t i = 0; i < count; ++i) {
+        const CacheTransform& ct = transforms[first + i];
+        if (ct.type < TransformDesc::TRANSLATE || ct.type > TransformDesc::SCALE) return false;
+        TransformDesc t;
+        t.type = TransformDesc::Type(ct.type);
+        t.offset = load3(ct.offset);
+        t.angle = ct.angle;
+        list.push_back(t);
+    }
+    return true;
+}
+
+bool unpack_shape(const CacheShape& c, const CacheTransform* transforms, size_t num_transforms,
+                  size_t num_materials, ShapeDesc& shape) {
+    if (c.type < ShapeDesc::SPHERE || c.type > ShapeDesc::BOX) return false;
+    if (c.material < -1 || c.material >= int64_t(num_materials)) return false;
+    shape.type = ShapeDesc::Type(c.type);
+    shape.material = c.material;
+    for (int i = 0; i < 3; ++i)
+        shape.p[i] = load3(c.p + 3 * i);
+    shape.radius = c.radius;
+    return unpack_transforms(c.first_transform, c.transform_count, transforms, num_transforms, shape.transforms);
+}
+
+bool unpack_object(const CacheObject& c, const CacheTransform* transforms, size_t num_transforms,
+                   size_t num_materials, size_t num_textures, size_t num_prototypes, ObjectDesc& obj) {
+    if (!unpack_shape(c.shape, transforms, num_transforms, num_materials, obj.shape)) return false;
+    obj.medium = c.medium != 0;
+    obj.density = c.density;
+    obj.phase_texture = c.phase_texture;
+    obj.prototype = c.prototype;
+    if (obj.medium && (c.phase_texture < 0 || c.phase_texture >= int64_t(num_textures))) return false;
+    return c.prototype >= -1 && c.prototype < int64_t(num_prototypes);
+}
+
+CacheObject pack_object(const ObjectDesc& obj, std::vector<CacheTransform>& transforms) {
+    CacheObject c;
+    memset(&c, 0, sizeof(c));
+    c.shape = pack_shape(obj.shape, transforms);
+    c.medium = obj.medium ? 1 : 0;
+    c.density = obj.density;
+    c.phase_texture = obj.phase_texture;
+    c.prototype = obj.prototype;
+    return c;
+}
+
+}   // namespace
+
+bool load_scene_cache(const std::string& cache_file, const std::string& scene_file,
+                      SceneDesc& desc, Scene& scene) {
+    std::string text;
+    if (!read_file(scene_file, text)) return false;
+
+    auto file = MappedFile::open(cache_file);
+    if (!file) return false;
+    CacheReader reader(*file);
+
+    const CacheHeader* h = reader.header();
+    if (!h || memcmp(h->magic, cache_magic, sizeof(cache_magic)) != 0) return false;
+    if (h->version != cache_version || h->node_size != sizeof(LinearBVHNode)) return false;
+    if (h->file_size != file->size() || h->source_hash != source_hash(text)) return false;
+
+    auto textures = reader.section<CacheTexture>(h->textures);
+    auto materials = reader.section<CacheMaterial>(h->materials);
+    auto objects = reader.section<CacheObject>(h->objects);
+    auto lights = reader.section<CacheShape>(h->lights);
+    auto transforms = reader.section<CacheTransform>(h->transforms);
+    auto nodes = reader.section<LinearBVHNode>(h->nodes);
+    auto order = reader.section<int32_t>(h->order);
+    auto pixels = reader.section<unsigned char>(h->pixels);
+    auto strings = reader.section<char>(h->strings);
+    auto prototypes = reader.section<CachePrototype>(h->prototypes);
+    auto prototype_objects = reader.section<CacheObject>(h->prototype_objects);
+    auto camera_keys = reader.section<CacheCameraKey>(h->camera_keys);
+    auto object_keys = reader.section<CacheObjectKey>(h->object_keys);
+    if (!textures || !materials || !objects || !lights || !transforms || !nodes || !order || !pixels || !strings ||
+        !prototypes || !prototype_objects || !camera_keys || !object_keys)
+        return false;
+
+    size_t num_textures = h->textures.count;
+    size_t num_materials = h->materials.count;
+    size_t num_objects = h->objects.count;
+    size_t num_nodes = h->nodes.count;
+    size_t num_refs = h->order.count;     // more than the objects after spatial splits
+    if (h->accelerator < Accelerator::BVH || h->accelerator > Accelerator::GRID) return false;
+    bool has_bvh = h->accelerator == Accelerator::BVH;
+    if (!has_bvh ? num_nodes != 0 || num_refs != 0 : num_refs < num_objects || num_refs >= size_t(1) << 31)
+        return false;
+    if (has_bvh && (num_objects > 0 ? num_nodes == 0 : num_nodes != 0)) return false;
+
+    SceneDesc d;
+    d.name = scene_file;
+    d.image_width = h->image_width;
+    d.image_height = h->image_height;
+    d.samples_per_pixel = h->samples_per_pixel;
+    d.max_depth = h->max_depth;
+    d.fovY = h->fovY;
+    d.eye = load3(h->eye);
+    d.lookat = load3(h->lookat);
+    d.defocus_angle = h->defocus_angle;
+    d.focus_dist = h->focus_dist;
+    d.background = load3(h->background);
+    d.first_frame = h->first_frame;
+    d.last_frame = h->last_frame;
+    if (d.first_frame < 0 || d.last_frame < d.first_frame) return false;
+    d.shutter = h->shutter;
+    d.motion_segments = h->motion_segments;
+    d.spatial_splits = h->spatial_splits;
+    d.accelerator = Accelerator::Type(h->accelerator);
+    if (!(d.shutter >= 0.f) || d.motion_segments < 1 || !(d.spatial_splits >= 0.f)) return false;
+
+    PrebuiltScene prebuilt;
+    for (size_t i = 0; i < num_textures; ++i) {
+        const CacheTexture& c = textures[i];
+        TextureDesc t;
+        if (c.type < TextureDesc::SOLID || c.type > TextureDesc::NOISE) return false;
+        t.type = TextureDesc::Type(c.type);
+        t.color = load3(c.color);
+        t.scale = c.scale;
+        t.even = c.even;
+        t.odd = c.odd;
+        t.bake_tolerance = c.bake_tolerance;
+        shared_ptr<Image> image;
+        if (t.type == TextureDesc::CHECKER) {
+            if (c.even < 0 || c.even >= int64_t(i) || c.odd < 0 || c.odd >= int64_t(i)) return false;
+        } else if (t.type == TextureDesc::IMAGE) {
+            if (c.path_offset > h->strings.count || c.path_length > h->strings.count - c.path_offset) return false;
+            t.path.assign(strings + c.path_offset, size_t(c.path_length));
+            int64_t size, mtime;
+            if (!file_stamp(t.path, size, mtime) || size != c.file_size || mtime != c.file_mtime) return false;
+
+            if (c.width <= 0 || c.height <= 0 || c.bytespp <= 0 || c.bytespp > 4) return false;
+            uint64_t bytes = uint64_t(c.width) * uint64_t(c.height) * uint64_t(c.bytespp);
+            if (c.pixel_offset > h->pixels.count || bytes > h->pixels.count - c.pixel_offset) return false;
+            // the image wraps the mapped pixels and keeps the mapping alive until the mip pyramid is built
+            // from it
+            image = shared_ptr<Image>(new Image(c.width, c.height, c.bytespp,
+                                                const_cast<unsigned char*>(pixels + c.pixel_offset)),
+                                      [file](Image* p) { delete p; });
+        }
+        d.textures.push_back(t);
+        prebuilt.images.push_back(image);
+    }
+
+    for (size_t i = 0; i < num_materials; ++i) {
+        const CacheMaterial& c = materials[i];
+        if (c.type < MaterialDesc::LAMBERTIAN || c.type > MaterialDesc::ISOTROPIC) return false;
+        MaterialDesc m;
+        m.type = MaterialDesc::Type(c.type);
+        m.texture = c.texture;
+        m.albedo = load3(c.albedo);
+        m.fuzz = c.fuzz;
+        m.ior = c.ior;
+        bool textured = m.type == MaterialDesc::LAMBERTIAN || m.type == MaterialDesc::DIFFUSE_LIGHT ||
+                        m.type == MaterialDesc::ISOTROPIC;
+        if (textured && (c.texture < 0 || c.texture >= int64_t(num_textures))) return false;
+        d.materials.push_back(m);
+    }
+
+    // a prototype may only instance the ones before it
+    size_t num_prototypes = h->prototypes.count;
+    for (size_t i = 0; i < num_prototypes; ++i) {
+        const CachePrototype& p = prototypes[i];
+        if (p.first_object > h->prototype_objects.count ||
+            p.object_count > h->prototype_objects.count - p.first_object)
+            return false;
+        PrototypeDesc proto;
+        if (p.accelerator < -1 || p.accelerator > Accelerator::GRID) return false;
+        proto.accelerator = p.accelerator;
+        for (uint32_t j = 0; j < p.object_count; ++j) {
+            ObjectDesc obj;
+            if (!unpack_object(prototype_objects[p.first_object + j], transforms, h->transforms.count,
+                               num_materials, num_textures, i, obj))
+                return false;
+            proto.objects.push_back(obj);
+        }
+        d.prototypes.push_back(proto);
+    }
+
+    for (size_t i = 0; i < num_objects; ++i) {
+        ObjectDesc obj;
+        if (!unpack_object(objects[i], transforms, h->transforms.count, num_materials, num_textures,
+                           num_prototypes, obj))
+            return false;
+        d.objects.push_back(obj);
+    }
+
+    for (size_t i = 0; i < h->lights.count; ++i) {
+        ShapeDesc shape;
+        if (!unpack_shape(lights[i], transforms, h->transforms.count, num_materials, shape)) return false;
+        d.lights.push_back(shape);
+    }
+
+    // keys in increasing frame order, those of an object list the same transform types
+    for (size_t i = 0; i < h->camera_keys.count; ++i) {
+        const CacheCameraKey& c = camera_keys[i];
+        if (c.frame < 0 || (i > 0 && c.frame <= camera_keys[i - 1].frame)) return false;
+        CameraKey k;
+        k.frame = c.frame;
+        k.fovY = c.fovY;
+        k.eye = load3(c.eye);
+        k.lookat = load3(c.lookat);
+        k.defocus_angle = c.defocus_angle;
+        k.focus_dist = c.focus_dist;
+        d.camera_keys.push_back(k);
+    }
+    for (size_t i = 0; i < h->object_keys.count; ++i) {
+        const CacheObjectKey& c = object_keys[i];
+        if (c.object >= num_objects || c.frame < 0) return false;
+        TransformKey k;
+        k.frame = c.frame;
+        if (!unpack_transforms(c.first_transform, c.transform_count, transforms, h->transforms.count, k.transforms) ||
+            k.transforms.empty())
+            return false;
+        auto& keys = d.objects[c.object].keys;
+        if (!keys.empty()) {
+            if (k.frame <= keys.back().frame || k.transforms.size() != keys[0].transforms.size()) return false;
+            for (size_t j = 0; j < k.transforms.size(); ++j)
+                if (k.transforms[j].type != keys[0].transforms[j].type) return false;
+        }
+        keys.push_back(k);
+    }
+
+    // every object is referenced by some leaf, the BVH restores the object list from the references
+    std::vector<bool> seen(num_objects, false);
+    size_t num_seen = has_bvh ? 0 : num_objects;
+    for (size_t i = 0; i < num_refs; ++i) {
+        if (order[i] < 0 || size_t(order[i]) >= num_objects) return false;
+        if (!seen[order[i]]) ++num_seen;
+        seen[order[i]] = true;
+    }
+    if (num_seen != num_objects) return false;
+    // children always follow their parent, so traversal of a validated array terminates; the depth of a child
+    // is final before the pass reaches it, and the traversal stacks hold LinearBVH::max_depth levels
+    std::vector<int> depth(num_nodes, 0);
+    for (size_t i = 0; i < num_nodes; ++i) {
+        const LinearBVHNode& node = nodes[i];
+        if (node.count > 0) {
+            // the quantized nodes keep the count of a leaf in 4 bits
+            if (node.count > LinearBVH::max_leaf_size) return false;
+            if (node.offset < 0 || size_t(node.offset) + size_t(node.count) > num_refs) return false;
+        } else {
+            int64_t left = node.count == 0 ? int64_t(i) + 1 : -int64_t(node.count);
+            if (left <= int64_t(i) || left >= int64_t(num_nodes)) return false;
+            if (node.offset <= int64_t(i) || size_t(node.offset) >= num_nodes || node.offset == left) return false;
+            if (depth[i] >= LinearBVH::max_depth) return false;
+            depth[left] = std::max(depth[left], depth[i] + 1);
+            depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+        }
+    }
+
+    prebuilt.nodes = nodes;
+    prebuilt.node_count = int(num_nodes);
+    prebuilt.order = order;
+    prebuilt.order_count = int(num_refs);
+    prebuilt.backing = file;
+
+    scene = build_scene(d, &prebuilt);
+    desc = d;
+    return true;
+}
+
+void write_scene_cache(const std::string& cache_file, const std::string& scene_file,
+                       const SceneDesc& desc, const Scene& scene) {
+    std::string text;
+    if (!read_file(scene_file, text))
+        throw SceneError("cannot read scene file '" + scene_file + "'");
+
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, cache_magic, sizeof(cache_magic));
+    h.version = cache_version;
+    h.node_size = sizeof(LinearBVHNode);
+    h.source_hash = source_hash(text);
+    h.image_width = desc.image_width;
+    h.image_height = desc.image_height;
+    h.samples_per_pixel = desc.samples_per_pixel;
+    h.max_depth = desc.max_depth;
+    h.fovY = desc.fovY;
+    copy3(h.eye, desc.eye);
+    copy3(h.lookat, desc.lookat);
+    h.defocus_angle = desc.defocus_angle;
+    h.focus_dist = desc.focus_dist;
+    copy3(h.background, desc.background);
+    h.first_frame = desc.first_frame;
+    h.last_frame = desc.last_frame;
+    h.shutter = desc.shutter;
+    h.motion_segments = desc.motion_segments;
+    h.spatial_splits = desc.spatial_splits;
+    h.accelerator = desc.accelerator;
+
+    std::vector<CacheTexture> textures;
+    std::vector<unsigned char> pixels;
+    std::string strings;
+    for (size_t i = 0; i < desc.textures.size(); ++i) {
+        const TextureDesc& t = desc.textures[i];
+        CacheTexture c;
+        memset(&c, 0, sizeof(c));
+        c.type = t.type;
+        copy3(c.color, t.color);
+        c.scale = t.scale;
+        c.even = t.even;
+        c.odd = t.odd;
+        c.bake_tolerance = t.bake_tolerance;
+        if (t.type == TextureDesc::IMAGE) {
+            // decoded again here rather than kept from the scene build, the textures only hold their mip
+            // pyramids
+            Image image(t.path.c_str());
+            c.width = image.get_width();
+            c.height = image.get_height();
+            c.bytespp = image.get_bytespp();
+            c.pixel_offset = pixels.size();
+            size_t bytes = size_t(c.width) * c.height * c.bytespp;
+            pixels.insert(pixels.end(), image.buffer(), image.buffer() + bytes);
+            c.path_offset = strings.size();
+            c.path_length = t.path.size();
+            strings += t.path;
+            if (!file_stamp(t.path, c.file_size, c.file_mtime))
+                throw SceneError("cannot stat image '" + t.path + "'");
+        }
+        textures.push_back(c);
+    }
+
+    std::vector<CacheMaterial> materials;
+    for (const auto& m : desc.materials) {
+        CacheMaterial c;
+        memset(&c, 0, sizeof(c));
+        c.type = m.type;
+        c.texture = m.texture;
+        copy3(c.albedo, m.albedo);
+        c.fuzz = m.fuzz;
+        c.ior = m.ior;
+        materials.push_back(c);
+    }
+
+    std::vector<CacheTransform> transforms;
+    std::vector<CachePrototype> prototypes;
+    std::vector<CacheObject> prototype_objects;
+    for (const auto& proto : desc.prototypes) {
+        CachePrototype c;
+        c.first_object = uint32_t(prototype_objects.size());
+        c.object_count = uint32_t(proto.objects.size());
+        c.accelerator = proto.accelerator;
+        for (const auto& obj : proto.objects)
+            prototype_objects.push_back(pack_object(obj, transforms));
+        prototypes.push_back(c);
+    }
+    std::vector<CacheObject> objects;
+    for (const auto& obj : desc.objects)
+        objects.push_back(pack_object(obj, transforms));
+    std::vector<CacheShape> lights;
+    for (const auto& light : desc.lights)
+        lights.push_back(pack_shape(light, transforms));
+
+    std::vector<CacheCameraKey> camera_keys;
+    for (const auto& k : desc.camera_keys) {
+        CacheCameraKey c;
+        memset(&c, 0, sizeof(c));
+        c.frame = k.frame;
+        c.fovY = k.fovY;
+        copy3(c.eye, k.eye);
+        copy3(c.lookat, k.lookat);
+        c.defocus_angle = k.defocus_angle;
+        c.focus_dist = k.focus_dist;
+        camera_keys.push_back(c);
+    }
+    std::vector<CacheObjectKey> object_keys;
+    for (size_t i = 0; i < desc.objects.size(); ++i) {
+        for (const auto& k : desc.objects[i].keys) {
+            CacheObjectKey c;
+            c.object = uint32_t(i);
+            c.frame = k.frame;
+            c.first_transform = pack_transforms(k.transforms, transforms);
+            c.transform_count = uint32_t(k.transforms.size());
+            object_keys.push_back(c);
+        }
+    }
+
+    // a kd-tree or grid is rebuilt on load
+    auto bvh = std::dynamic_pointer_cast<LinearBVH>(scene.world);
+    std::vector<int32_t> order32;
+    if (bvh)
+        order32.assign(bvh->primitive_order().begin(), bvh->primitive_order().end());
+
+    CacheWriter writer;
+    writer.append_bytes(&h, sizeof(h), 1);
+    h.textures = writer.append(textures.data(), textures.size());
+    h.materials = writer.append(materials.data(), materials.size());
+    h.objects = writer.append(objects.data(), objects.size());
+    h.lights = writer.append(lights.data(), lights.size());
+    h.transforms = writer.append(transforms.data(), transforms.size());
+    h.nodes = writer.append(bvh ? bvh->node_data() : nullptr, bvh ? size_t(bvh->node_count()) : 0);
+    h.order = writer.append(order32.data(), order32.size());
+    h.pixels = writer.append(pixels.data(), pixels.size());
+    h.strings = writer.append(strings.data(), strings.size());
+    h.prototypes = writer.append(prototypes.data(), prototypes.size());
+    h.prototype_objects = writer.append(prototype_objects.data(), prototype_objects.size());
+    h.camera_keys = writer.append(camera_keys.data(), camera_keys.size());
+    h.object_keys = writer.append(object_keys.data(), object_keys.size());
+    h.file_size = writer.buf.size();
+    memcpy(writer.buf.data(), &h, sizeof(h));
+
+    // write to a temporary file first so a concurrent reader never maps a partial cache
+    std::string tmp = cache_file + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out)
+        throw SceneError("cannot write scene cache '" + tmp + "'");
+    bool ok = fwrite(writer.buf.data(), 1, writer.buf.size(), out) == writer.buf.size();
+    ok = (fclose(out) == 0) && ok;
+    std::remove(cache_file.c_str());
+    if (!ok || std::rename(tmp.c_str(), cache_file.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw SceneError("cannot write scene cache '" + cache_file + "'");
+    }
+}
@@ -0,0 +1,81 @@
+#include "stats.h"
+
+void RenderStats::reset_counters() {
+    double load = load_secs, build = bvh_build_secs, refit = bvh_refit_secs, render = render_secs;
+    double denoise = denoise_secs, write = write_secs;
+    unsigned long long node_bytes = bvh_node_bytes;
+    *this = RenderStats();
+    bvh_node_bytes = node_bytes;
+    load_secs = load;
+    bvh_build_secs = build;
+    bvh_refit_secs = refit;
+    render_secs = render;
+    denoise_secs = denoise;
+    write_secs = write;
+}
+
+void RenderStats::merge_counters(const RenderStats& other) {
+    camera_rays += other.camera_rays;
+    bounce_rays += other.bounce_rays;
+    shadow_rays += other.shadow_rays;
+    bvh_nodes_visited += other.bvh_nodes_visited;
+    accel_cells_visited += other.accel_cells_visited;
+    sphere_tests += other.sphere_tests;
+    quad_tests += other.quad_tests;
+    box_tests += other.box_tests;
+    mesh_tests += other.mesh_tests;
+    medium_tests += other.medium_tests;
+    instance_tests += other.instance_tests;
+    pdf_rejections += other.pdf_rejections;
+    texture_page_loads += other.texture_page_loads;
+}
+
+void RenderStats::print(std::ostream& out) const {
+    double per_ray = rays() ? 1.0 / rays() : 0.0;
+    out << "Render statistics\n"
+        << "  camera rays           " << camera_rays << "\n"
+        << "  bounce rays           " << bounce_rays << "\n"
+        << "  shadow rays           " << shadow_rays << "\n"
+        << "  average path length   " << average_path_length() << "\n"
+        << "  BVH nodes visited     " << bvh_nodes_visited << " (" << bvh_nodes_visited * per_ray << " per ray)\n"
+        << "  kd/grid cells visited " << accel_cells_visited << " (" << accel_cells_visited * per_ray << " per ray)\n"
+        << "  sphere tests          " << sphere_tests << "\n"
+        << "  quad tests            " << quad_tests << "\n"
+        << "  box tests             " << box_tests << "\n"
+        << "  mesh tests            " << mesh_tests << "\n"
+        << "  medium tests          " << medium_tests << "\n"
+        << "  instance tests        " << instance_tests << "\n"
+        << "  pdf rejections        " << pdf_rejections << "\n"
+        << "  texture page loads    " << texture_page_loads << "\n"
+        << "  accelerator memory    " << bvh_node_bytes << " bytes\n"
+        << "  scene load            " << load_secs << " secs (BVH build " << bvh_build_secs << " secs)\n"
+        << "  BVH refit             " << bvh_refit_secs << " secs\n"
+        << "  render                " << render_secs << " secs\n"
+        << "  denoise               " << denoise_secs << " secs\n"
+        << "  image write           " << write_secs << " secs" << std::endl;
+}
+
+void RenderStats::write_json(std::ostream& out) const {
+    out << "{\"camera_rays\": " << camera_rays
+        << ", \"bounce_rays\": " << bounce_rays
+        << ", \"shadow_rays\": " << shadow_rays
+        << ", \"average_path_length\": " << average_path_length()
+        << ", \"bvh_nodes_visited\": " << bvh_nodes_visited
+        << ", \"accel_cells_visited\": " << accel_cells_visited
+        << ", \"primitive_tests\": {\"sphere\": " << sphere_tests
+        << ", \"quad\": " << quad_tests
+        << ", \"box\": " << box_tests
+        << ", \"mesh\": " << mesh_tests
+        << ", \"medium\": " << medium_tests
+        << ", \"instance\": " << instance_tests << "}"
+        << ", \"pdf_rejections\": " << pdf_rejections
+        << ", \"texture_page_loads\": " << texture_page_loads
+        << ", \"bvh_node_bytes\": " << bvh_node_bytes
+        << ", \"load_secs\": " << load_secs
+        << ", \"bvh_build_secs\": " << bvh_build_secs
+        << ", \"bvh_refit_secs\": " << bvh_refit_secs
+        << ", \"render_secs\": " << render_secs
+        << ", \"denoise_secs\": " << denoise_secs
+        << ", \"write_secs\": " << write_secs
+        << "}" << std::endl;
+}
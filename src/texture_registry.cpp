@@ -0,0 +1,95 @@
+#include "texture_registry.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+TextureRegistry& TextureRegistry::instance() {
+    static TextureRegistry registry;
+    return registry;
+}
+
+std::string TextureRegistry::normalize(const std::string& path) {
+    bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find_first_of("/\\", start);
+        if (end == std::string::npos)
+            end = path.size();
+        std::string part = path.substr(start, end - start);
+        if (part == "..") {
+            if (!parts.empty() && parts.back() != "..")
+                parts.pop_back();
+            else if (!absolute)
+                parts.push_back(part);
+        } else if (!part.empty() && part != ".") {
+            parts.push_back(part);
+        }
+        start = end + 1;
+    }
+
+    std::string out = absolute ? "/" : "";
+    for (size_t i = 0; i < parts.size(); ++i)
+        out += (i ? "/" : "") + parts[i];
+    return out.empty() ? "." : out;
+}
+
+TextureRegistry::Entry TextureRegistry::decode(const std::string& path, shared_ptr<Image> pixels) {
+    Entry entry;
+    entry.texture = make_shared<ImageTexture>(pixels ? pixels : make_shared<Image>(path.c_str()));
+    return entry;
+}
+
+void TextureRegistry::preload(const std::vector<std::string>& paths, int threads) {
+    std::vector<std::string> missing;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& path : paths) {
+            std::string key = normalize(path);
+            if (!entries.count(key) && std::find(missing.begin(), missing.end(), key) == missing.end())
+                missing.push_back(key);
+        }
+    }
+    if (missing.empty())
+        return;
+
+    // stbi_load and the mip pyramid build are independent per file
+    std::vector<Entry> decoded(missing.size());
+    parallel_for(int(missing.size()), threads, [&](int i) {
+        decoded[i] = decode(missing[i], nullptr);
+    });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < missing.size(); ++i)
+        entries.insert(std::make_pair(missing[i], decoded[i]));
+}
+
+TextureRegistry::Entry TextureRegistry::get(const std::string& path, shared_ptr<Image> pixels) {
+    std::string key = normalize(path);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end())
+            return it->second;
+    }
+
+    // decode without holding the lock; if another thread got there first its entry wins
+    Entry entry = decode(key, pixels);
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.insert(std::make_pair(key, entry)).first->second;
+}
+
+void TextureRegistry::release_unused() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.texture.use_count() == 1)
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+size_t TextureRegistry::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}